@@ -0,0 +1,377 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include "btree.h"
+#include "relation_gen.h"
+#include "exceptions/file_not_found_exception.h"
+#include "exceptions/no_such_key_found_exception.h"
+#include "exceptions/index_scan_completed_exception.h"
+
+using namespace badgerdb;
+
+// -----------------------------------------------------------------------------
+// Benchmark parameters and results
+// -----------------------------------------------------------------------------
+
+struct BenchConfig {
+	std::string relationName;
+	std::vector<int> relationSizes;
+	std::vector<KeyDistribution> distributions;
+	std::vector<int> bufferSizes;
+	int lookups;
+	int scans;
+	int scanLength;
+	int inserts;
+	int writeBackRate;
+	unsigned int seed;
+	bool json;
+	std::string outputName;
+};
+
+struct BenchResult {
+	KeyDistribution dist;
+	int relationSize;
+	int bufferPages;
+	std::string phase;
+	long long ops;
+	double seconds;
+	long long pagesRead;
+	long long pagesWritten;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// -----------------------------------------------------------------------------
+// Forward declarations
+// -----------------------------------------------------------------------------
+
+void usage();
+bool parseArgs(int argc, char **argv, BenchConfig &config);
+void runConfig(const BenchConfig &config, KeyDistribution dist, int relationSize, int bufferPages, std::vector<BenchResult> &results);
+long long rangeScan(BTreeIndex *index, int lowVal, int highVal, int maxResults);
+double perOp(long long pages, long long ops);
+void writeCSV(std::ostream &out, const std::vector<BenchResult> &results);
+void writeJSON(std::ostream &out, const std::vector<BenchResult> &results);
+
+int main(int argc, char **argv)
+{
+	BenchConfig config;
+	if(!parseArgs(argc, argv, config))
+	{
+		usage();
+		return 1;
+	}
+
+	std::vector<BenchResult> results;
+	for(size_t s = 0; s < config.relationSizes.size(); s++)
+	{
+		for(size_t d = 0; d < config.distributions.size(); d++)
+		{
+			createRelation(config.relationName, config.relationSizes[s], config.distributions[d], config.seed);
+			for(size_t b = 0; b < config.bufferSizes.size(); b++)
+			{
+				runConfig(config, config.distributions[d], config.relationSizes[s], config.bufferSizes[b], results);
+			}
+			File::remove(config.relationName);
+		}
+	}
+
+	if(config.outputName.empty())
+	{
+		config.json ? writeJSON(std::cout, results) : writeCSV(std::cout, results);
+	}
+	else
+	{
+		std::ofstream out(config.outputName.c_str());
+		config.json ? writeJSON(out, results) : writeCSV(out, results);
+	}
+	return 0;
+}
+
+void usage()
+{
+	std::cerr << "usage: badgerdb_benchmark [options]\n"
+		<< "  --size N[,N...]          relation sizes (default 100000)\n"
+		<< "  --dist D[,D...]          key distributions: sequential, reverse, uniform, zipfian, clustered (default all)\n"
+		<< "  --buffers B[,B...]       buffer pool sizes in pages (default 100,1000)\n"
+		<< "  --lookups N              point lookups per run (default 10000)\n"
+		<< "  --scans N                range scans per run (default 1000)\n"
+		<< "  --scan-length N          entries per range scan (default 100)\n"
+		<< "  --inserts N              inserts after the build per run (default 10000)\n"
+		<< "  --write-back-rate N      pages per second written by the background writer of the index, 0 for none (default 0)\n"
+		<< "  --seed N                 random seed (default 1)\n"
+		<< "  --format csv|json        output format (default csv)\n"
+		<< "  --output FILE            write results to FILE instead of stdout\n";
+}
+
+// parse a comma separated list of integers
+static bool parseIntList(const char *arg, std::vector<int> &out)
+{
+	out.clear();
+	std::stringstream ss(arg);
+	std::string item;
+	while(std::getline(ss, item, ','))
+	{
+		int val = atoi(item.c_str());
+		if(val <= 0)
+			return false;
+		out.push_back(val);
+	}
+	return !out.empty();
+}
+
+bool parseArgs(int argc, char **argv, BenchConfig &config)
+{
+	config.relationName = "benchRel";
+	config.relationSizes.assign(1, 100000);
+	config.distributions.clear();
+	for(int i = 0; i <= CLUSTERED_KEYS; i++)
+		config.distributions.push_back((KeyDistribution)i);
+	config.bufferSizes.clear();
+	config.bufferSizes.push_back(100);
+	config.bufferSizes.push_back(1000);
+	config.lookups = 10000;
+	config.scans = 1000;
+	config.scanLength = 100;
+	config.inserts = 10000;
+	config.writeBackRate = 0;
+	config.seed = 1;
+	config.json = false;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(i + 1 >= argc)
+			return false;
+		const char *opt = argv[i];
+		const char *val = argv[++i];
+		if(strcmp(opt, "--size") == 0)
+		{
+			if(!parseIntList(val, config.relationSizes))
+				return false;
+		}
+		else if(strcmp(opt, "--dist") == 0)
+		{
+			config.distributions.clear();
+			std::stringstream ss(val);
+			std::string item;
+			while(std::getline(ss, item, ','))
+			{
+				KeyDistribution dist;
+				if(!parseKeyDistribution(item, dist))
+					return false;
+				config.distributions.push_back(dist);
+			}
+		}
+		else if(strcmp(opt, "--buffers") == 0)
+		{
+			if(!parseIntList(val, config.bufferSizes))
+				return false;
+		}
+		else if(strcmp(opt, "--lookups") == 0)
+			config.lookups = atoi(val);
+		else if(strcmp(opt, "--scans") == 0)
+			config.scans = atoi(val);
+		else if(strcmp(opt, "--scan-length") == 0)
+			config.scanLength = atoi(val);
+		else if(strcmp(opt, "--inserts") == 0)
+			config.inserts = atoi(val);
+		else if(strcmp(opt, "--write-back-rate") == 0)
+			config.writeBackRate = atoi(val);
+		else if(strcmp(opt, "--seed") == 0)
+			config.seed = atoi(val);
+		else if(strcmp(opt, "--format") == 0)
+		{
+			if(strcmp(val, "json") != 0 && strcmp(val, "csv") != 0)
+				return false;
+			config.json = strcmp(val, "json") == 0;
+		}
+		else if(strcmp(opt, "--output") == 0)
+			config.outputName = val;
+		else
+			return false;
+	}
+	return !config.distributions.empty();
+}
+
+// -----------------------------------------------------------------------------
+// runConfig
+// -----------------------------------------------------------------------------
+
+// pages the index wrote itself past the buffer manager since the last call
+static long long takeIndexWrites(BTreeIndex *index)
+{
+	BTreeWriteStats stats;
+	index->getWriteStats(stats);
+	index->clearWriteStats();
+	return stats.pagesWrittenInBackground + stats.pagesWrittenInForeground;
+}
+
+// record one phase of a run, taking the I/O counts from the buffer manager and adding the pages the index wrote itself
+static void addResult(std::vector<BenchResult> &results, KeyDistribution dist, int relationSize, int bufferPages,
+		const char *phase, long long ops, Clock::time_point start, BufMgr *bufMgr, long long indexWrites)
+{
+	BenchResult result;
+	result.dist = dist;
+	result.relationSize = relationSize;
+	result.bufferPages = bufferPages;
+	result.phase = phase;
+	result.ops = ops;
+	result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	result.pagesRead = bufMgr->getBufStats().diskreads;
+	result.pagesWritten = bufMgr->getBufStats().diskwrites + indexWrites;
+	results.push_back(result);
+	bufMgr->clearBufStats();
+}
+
+void runConfig(const BenchConfig &config, KeyDistribution dist, int relationSize, int bufferPages, std::vector<BenchResult> &results)
+{
+	BufMgr *bufMgr = new BufMgr(bufferPages);
+	std::string indexName;
+	std::ostringstream idxStr;
+	idxStr << config.relationName << '.' << offsetof(GenRecord, i);
+	try
+	{
+		File::remove(idxStr.str());
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+
+	// build
+	bufMgr->clearBufStats();
+	Clock::time_point start = Clock::now();
+	BTreeIndexOptions options;
+	options.writeBackRate = config.writeBackRate;
+	BTreeIndex *index = new BTreeIndex(config.relationName, indexName, bufMgr, offsetof(GenRecord, i), INTEGER, options);
+	addResult(results, dist, relationSize, bufferPages, "build", relationSize, start, bufMgr, takeIndexWrites(index));
+
+	// point lookups, keys follow the distribution of the relation
+	KeyGenerator lookupKeys(dist == SEQUENTIAL_KEYS || dist == REVERSE_KEYS ? UNIFORM_KEYS : dist, relationSize, config.seed + 1);
+	start = Clock::now();
+	for(int i = 0; i < config.lookups; i++)
+	{
+		int key = lookupKeys.next();
+		rangeScan(index, key, key, -1);
+	}
+	addResult(results, dist, relationSize, bufferPages, "lookup", config.lookups, start, bufMgr, takeIndexWrites(index));
+
+	// short range scans starting at uniform random keys
+	KeyGenerator scanKeys(UNIFORM_KEYS, relationSize, config.seed + 2);
+	start = Clock::now();
+	for(int i = 0; i < config.scans; i++)
+	{
+		int key = scanKeys.next();
+		rangeScan(index, key, relationSize, config.scanLength);
+	}
+	addResult(results, dist, relationSize, bufferPages, "scan", config.scans, start, bufMgr, takeIndexWrites(index));
+
+	// inserts of new entries following the distribution of the relation
+	KeyGenerator insertKeys(dist, relationSize, config.seed + 3);
+	start = Clock::now();
+	for(int i = 0; i < config.inserts; i++)
+	{
+		int key = insertKeys.next();
+		RecordId rid;
+		rid.page_number = 1 + i / 100;
+		rid.slot_number = 1 + i % 100;
+		index->insertEntry(&key, rid);
+	}
+	addResult(results, dist, relationSize, bufferPages, "insert", config.inserts, start, bufMgr, takeIndexWrites(index));
+
+	// closing the index writes out everything the inserts left dirty, or what the background writer did not get to
+	start = Clock::now();
+	index->flush();
+	long long closeWrites = takeIndexWrites(index);
+	delete index;
+	addResult(results, dist, relationSize, bufferPages, "close", 1, start, bufMgr, closeWrites);
+
+	// write amplification of the inserts: pages written while inserting and when closing, per insert.
+	// Lookups and scans dirty nothing, so the close only writes what the inserts changed
+	BenchResult total = results[results.size() - 2];
+	total.phase = "insert_total";
+	total.seconds += results.back().seconds;
+	total.pagesRead += results.back().pagesRead;
+	total.pagesWritten += results.back().pagesWritten;
+	results.push_back(total);
+
+	File::remove(indexName);
+	delete bufMgr;
+}
+
+// scan [lowVal, highVal] and return the number of entries found, stopping after maxResults entries if it is not negative
+long long rangeScan(BTreeIndex *index, int lowVal, int highVal, int maxResults)
+{
+	long long found = 0;
+	try
+	{
+		index->startScan(&lowVal, GTE, &highVal, LTE);
+	}
+	catch(NoSuchKeyFoundException e)
+	{
+		return 0;
+	}
+	try
+	{
+		RecordId rid;
+		while(maxResults < 0 || found < maxResults)
+		{
+			index->scanNext(rid);
+			found++;
+		}
+	}
+	catch(IndexScanCompletedException e)
+	{
+	}
+	index->endScan();
+	return found;
+}
+
+// -----------------------------------------------------------------------------
+// Output
+// -----------------------------------------------------------------------------
+
+// pages per operation, 0 for a phase that ran no operation
+double perOp(long long pages, long long ops)
+{
+	return ops > 0 ? (double)pages / ops : 0;
+}
+
+void writeCSV(std::ostream &out, const std::vector<BenchResult> &results)
+{
+	out << "distribution,relation_size,buffer_pages,phase,ops,seconds,ops_per_sec,pages_read_per_op,pages_written_per_op\n";
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult &r = results[i];
+		out << keyDistributionName(r.dist) << ',' << r.relationSize << ',' << r.bufferPages << ',' << r.phase << ','
+			<< r.ops << ',' << r.seconds << ',' << (r.seconds > 0 ? r.ops / r.seconds : 0) << ','
+			<< perOp(r.pagesRead, r.ops) << ',' << perOp(r.pagesWritten, r.ops) << '\n';
+	}
+}
+
+void writeJSON(std::ostream &out, const std::vector<BenchResult> &results)
+{
+	out << "[\n";
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult &r = results[i];
+		out << "  {\"distribution\": \"" << keyDistributionName(r.dist) << "\", \"relation_size\": " << r.relationSize
+			<< ", \"buffer_pages\": " << r.bufferPages << ", \"phase\": \"" << r.phase << "\", \"ops\": " << r.ops
+			<< ", \"seconds\": " << r.seconds << ", \"ops_per_sec\": " << (r.seconds > 0 ? r.ops / r.seconds : 0)
+			<< ", \"pages_read_per_op\": " << perOp(r.pagesRead, r.ops)
+			<< ", \"pages_written_per_op\": " << perOp(r.pagesWritten, r.ops) << "}"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "]\n";
+}
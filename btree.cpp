@@ -5,8 +5,18 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <climits>
+#include <map>
+#include <queue>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "btree.h"
-#include "filescan.h"
+#include "page_iterator.h"
 #include "exceptions/bad_index_info_exception.h"
 #include "exceptions/bad_opcodes_exception.h"
 #include "exceptions/bad_scanrange_exception.h"
@@ -14,7 +24,7 @@
 #include "exceptions/scan_not_initialized_exception.h"
 #include "exceptions/index_scan_completed_exception.h"
 #include "exceptions/file_not_found_exception.h"
-#include "exceptions/end_of_file_exception.h"
+#include "exceptions/invalid_page_exception.h"
 
 
 //#define DEBUG
@@ -25,24 +35,148 @@ namespace badgerdb
 // BTree Node Allocation and debug Auxiliary Functions
 // -----------------------------------------------------------------------------
 	
-NonLeafNodeInt *BTreeIndex::allocNonLeaf(PageId &pageId)
+void BTreeIndex::allocIndexPage(PageId &pageId, Page *&page, PageId nearPageId)
 {
-	NonLeafNodeInt *node;
-	bufMgr->allocPage(file, pageId, (Page *&)node);
-	memset(node, 0, Page::SIZE);
-	return node;
+	collectReclaimedPages();
+	if(freePages.empty())
+	{
+		bufMgr->allocPage(file, pageId, page);
+		memset((void *)page, 0, Page::SIZE);
+		if(pageId > lastPageNum)
+			lastPageNum = pageId;
+		return;
+	}
+	//take the free page closest to nearPageId
+	std::set<PageId>::iterator it = freePages.lower_bound(nearPageId);
+	if(it == freePages.end())
+	{
+		--it;
+	}
+	else if(it != freePages.begin())
+	{
+		std::set<PageId>::iterator prev = it;
+		--prev;
+		if(nearPageId - *prev < *it - nearPageId)
+			it = prev;
+	}
+	pageId = *it;
+	freePages.erase(it);
+	freeListChanged = true;
+	bufMgr->readPage(file, pageId, page);
+	memset((void *)page, 0, Page::SIZE);
+}
+
+void BTreeIndex::freePage(PageId pageId)
+{
+	Page *page;
+	bufMgr->readPage(file, pageId, page);
+	memset((void *)page, 0, Page::SIZE);
+	((FreePageList *)page)->level = FREEPAGELEVEL;
+	unPinDirtyPage(pageId);
+	freePages.insert(pageId);
+	freeListChanged = true;
+}
+
+void BTreeIndex::readFreeList(PageId listPageNo)
+{
+	freePages.clear();
+	freeListChanged = false;
+	while(listPageNo != 0)
+	{
+		Page *page;
+		bufMgr->readPage(file, listPageNo, page);
+		FreePageList *list = (FreePageList *)page;
+		//the pages of the list are free pages as well
+		freePages.insert(listPageNo);
+		freePages.insert(list->pageNoArray, list->pageNoArray + list->numPages);
+		PageId nextPageNo = list->nextPageNo;
+		bufMgr->unPinPage(file, listPageNo, false);
+		listPageNo = nextPageNo;
+	}
+}
+
+PageId BTreeIndex::findLastPage()
+{
+	PageId last = headerPageNum;
+	if(!freePages.empty())
+		last = std::max(last, *freePages.rbegin());
+	//walk the non-leaf levels, leaves are known from their parents without being read
+	std::vector<PageId> level(1, rootPageNum);
+	while(!level.empty())
+	{
+		std::vector<PageId> next;
+		for(size_t i = 0; i < level.size(); i++)
+		{
+			last = std::max(last, level[i]);
+			Page *page;
+			bufMgr->readPage(file, level[i], page);
+			if(!isLeaf(page))
+			{
+				NonLeafNodeInt *node = (NonLeafNodeInt *)page;
+				int n = nonLeafKeyCount(node);
+				if(node->level == 1)
+					last = std::max(last, *std::max_element(node->pageNoArray, node->pageNoArray + n + 1));
+				else
+					next.insert(next.end(), node->pageNoArray, node->pageNoArray + n + 1);
+			}
+			bufMgr->unPinPage(file, level[i], false);
+		}
+		level.swap(next);
+	}
+	return last;
+}
+
+PageId BTreeIndex::writeFreeList()
+{
+	std::vector<PageId> pages(freePages.begin(), freePages.end());
+	PageId head = 0;
+	size_t end = pages.size();
+	//the highest free pages hold the list, each one the numbers of up to FREELISTSIZE pages below it
+	while(end > 0)
+	{
+		PageId listPageNo = pages[--end];
+		size_t start = end > (size_t)FREELISTSIZE ? end - FREELISTSIZE : 0;
+		Page *page;
+		bufMgr->readPage(file, listPageNo, page);
+		memset((void *)page, 0, Page::SIZE);
+		FreePageList *list = (FreePageList *)page;
+		list->level = FREEPAGELEVEL;
+		list->nextPageNo = head;
+		list->numPages = end - start;
+		memcpy(list->pageNoArray, &pages[start], (end - start) * sizeof(PageId));
+		unPinDirtyPage(listPageNo);
+		head = listPageNo;
+		end = start;
+	}
+	return head;
+}
+
+NonLeafNodeInt *BTreeIndex::allocNonLeaf(PageId &pageId, PageId nearPageId)
+{
+	Page *page;
+	allocIndexPage(pageId, page, nearPageId);
+	return (NonLeafNodeInt *)page;
 }
 
-LeafNodeInt *BTreeIndex::allocLeaf(PageId &pageId) 
+LeafNodeInt *BTreeIndex::allocLeaf(PageId &pageId, PageId nearPageId)
 {
-	LeafNodeInt *node;
-	bufMgr->allocPage(file, pageId, (Page *&)node);
-	memset(node, 0, Page::SIZE);
+	Page *page;
+	allocIndexPage(pageId, page, nearPageId);
+	LeafNodeInt *node = (LeafNodeInt *)page;
 	node->rightSibPageNo = 0;
 	node->level = -1;
 	return node;
 }
 
+SlottedLeafNodeInt *BTreeIndex::allocSlottedLeaf(PageId &pageId, PageId nearPageId)
+{
+	Page *page;
+	allocIndexPage(pageId, page, nearPageId);
+	SlottedLeafNodeInt *node = (SlottedLeafNodeInt *)page;
+	initSlottedLeaf(node, slottedEntrySize);
+	return node;
+}
+
 void BTreeIndex::printNode(PageId pid)
 {
 	Page *page;
@@ -50,16 +184,10 @@ void BTreeIndex::printNode(PageId pid)
 	//print leaf page
 	if(isLeaf(page))
 	{
-		LeafNodeInt *leaf = (LeafNodeInt *)page;
-		for(int i = 0; i < INTARRAYLEAFSIZE; i++)
+		int n = leafSize(page);
+		for(int i = 0; i < n; i++)
 		{
-			if(leaf->ridArray[i].page_number != 0){
-				printf("page: %u, idx: %d, key: %d\n", pid, i, leaf->keyArray[i]);
-			}
-			else
-			{
-				break;
-			}
+			printf("page: %u, idx: %d, key: %d\n", pid, i, leafKeyAt(page, i));
 		}
 	}
 	//print nonLeaf page
@@ -80,6 +208,126 @@ void BTreeIndex::printNode(PageId pid)
 	bufMgr->unPinPage(file, pid, false);
 }
 
+void BTreeIndex::analyzeShape(BTreeShapeStats &stats)
+{
+	stats.height = 0;
+	stats.nodesPerLevel.clear();
+	stats.leafCount = 0;
+	stats.nonLeafCount = 0;
+	stats.leafEntries = 0;
+	stats.nonLeafKeys = 0;
+	memset(stats.leafFillHistogram, 0, sizeof(stats.leafFillHistogram));
+	memset(stats.nonLeafFillHistogram, 0, sizeof(stats.nonLeafFillHistogram));
+	stats.leafLinks = 0;
+	stats.sequentialLeafLinks = 0;
+	stats.forwardLeafLinks = 0;
+	stats.wastedBytes = 0;
+	stats.unreachablePages = 0;
+	stats.freePages = 0;
+	std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+	epochs.drain();
+	collectReclaimedPages();
+	stats.snapshotPages = retiredPages.size() + epochs.pendingCount();
+	for(std::map<PageId, std::vector<PageVersion> >::iterator it = pageVersions.begin(); it != pageVersions.end(); ++it)
+	{
+		stats.snapshotPages += it->second.size();
+	}
+
+	//make the file up to date, then read it sequentially past the buffer pool
+	flush();
+	std::map<PageId, std::vector<PageId> > children; //sons of every non-leaf page
+	for(PageId pid = headerPageNum + 1; pid <= lastPageNum; pid++)
+	{
+		Page page = file->readPage(pid);
+		if(((FreePageList *)&page)->level == FREEPAGELEVEL)
+		{
+			stats.freePages++;
+		}
+		else if(isLeaf(&page))
+		{
+			int n = leafSize(&page);
+			int capacity = INTARRAYLEAFSIZE;
+			if(isSlottedLeaf(&page))
+			{
+				SlottedLeafNodeInt *leaf = (SlottedLeafNodeInt *)&page;
+				capacity = (Page::SIZE - offsetof(SlottedLeafNodeInt, slotArray)) / (sizeof(std::uint16_t) + leaf->entrySize);
+				stats.wastedBytes += Page::SIZE - offsetof(SlottedLeafNodeInt, slotArray) - n * (sizeof(std::uint16_t) + leaf->entrySize);
+			}
+			else
+			{
+				stats.wastedBytes += (INTARRAYLEAFSIZE - n) * (sizeof(int) + sizeof(RecordId)) + Page::SIZE - sizeof(LeafNodeInt);
+			}
+			stats.leafCount++;
+			stats.leafEntries += n;
+			stats.leafFillHistogram[std::min(n * FILLHISTOGRAMSIZE / capacity, FILLHISTOGRAMSIZE - 1)]++;
+			PageId rightSibPageNo = leafRightSib(&page);
+			if(rightSibPageNo != 0)
+			{
+				stats.leafLinks++;
+				if(rightSibPageNo == pid + 1)
+					stats.sequentialLeafLinks++;
+				if(rightSibPageNo > pid)
+					stats.forwardLeafLinks++;
+			}
+		}
+		else
+		{
+			NonLeafNodeInt *nonLeaf = (NonLeafNodeInt *)&page;
+			std::vector<PageId> &sons = children[pid];
+			sons.push_back(nonLeaf->pageNoArray[0]);
+			int n = 0;
+			while(n < INTARRAYNONLEAFSIZE && nonLeaf->pageNoArray[n+1] != 0)
+			{
+				sons.push_back(nonLeaf->pageNoArray[n+1]);
+				n++;
+			}
+			stats.nonLeafCount++;
+			stats.nonLeafKeys += n;
+			stats.nonLeafFillHistogram[std::min(n * FILLHISTOGRAMSIZE / INTARRAYNONLEAFSIZE, FILLHISTOGRAMSIZE - 1)]++;
+			stats.wastedBytes += (INTARRAYNONLEAFSIZE - n) * (sizeof(int) + sizeof(PageId)) + Page::SIZE - sizeof(NonLeafNodeInt);
+		}
+	}
+
+	//count the nodes on each level going down from the root
+	std::vector<PageId> level(1, rootPageNum);
+	int reachable = 0;
+	while(!level.empty())
+	{
+		stats.nodesPerLevel.push_back(level.size());
+		reachable += level.size();
+		std::vector<PageId> next;
+		for(size_t i = 0; i < level.size(); i++)
+		{
+			std::map<PageId, std::vector<PageId> >::iterator it = children.find(level[i]);
+			if(it != children.end())
+				next.insert(next.end(), it->second.begin(), it->second.end());
+		}
+		level.swap(next);
+	}
+	stats.height = stats.nodesPerLevel.size();
+	stats.unreachablePages = stats.leafCount + stats.nonLeafCount - reachable - stats.snapshotPages;
+}
+
+void BTreeIndex::printShape()
+{
+	BTreeShapeStats stats;
+	analyzeShape(stats);
+	printf("height: %d, leaves: %d, non-leaves: %d\n", stats.height, stats.leafCount, stats.nonLeafCount);
+	for(int i = 0; i < stats.height; i++)
+	{
+		printf("level: %d, nodes: %d\n", i, stats.nodesPerLevel[i]);
+	}
+	printf("leaf entries: %lld, non-leaf keys: %lld\n", stats.leafEntries, stats.nonLeafKeys);
+	for(int i = 0; i < FILLHISTOGRAMSIZE; i++)
+	{
+		printf("fill %3d%%-%3d%%: leaves: %d, non-leaves: %d\n", i * 100 / FILLHISTOGRAMSIZE, (i + 1) * 100 / FILLHISTOGRAMSIZE,
+			stats.leafFillHistogram[i], stats.nonLeafFillHistogram[i]);
+	}
+	printf("leaf links: %d, to next page: %d, forward: %d\n", stats.leafLinks, stats.sequentialLeafLinks, stats.forwardLeafLinks);
+	printf("wasted bytes: %lld, unreachable pages: %d, free pages: %d, snapshot pages: %d\n", stats.wastedBytes, stats.unreachablePages,
+		stats.freePages, stats.snapshotPages);
+}
+
 // -----------------------------------------------------------------------------
 // BTreeIndex::BTreeIndex -- Constructor
 // -----------------------------------------------------------------------------
@@ -88,13 +336,29 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 		std::string & outIndexName,
 		BufMgr *bufMgrIn,
 		const int attrByteOffset,
-		const Datatype attrType)
+		const Datatype attrType,
+		const BTreeIndexOptions & options)
 {
 	std :: ostringstream idxStr ;
 	idxStr << relationName << '.' << attrByteOffset ;
-	outIndexName = idxStr.str () ; // indexName is the name of the index file
+	outIndexName = options.indexName.empty() ? idxStr.str () : options.indexName ; // indexName is the name of the index file
 	bufMgr = bufMgrIn;
 	scanExecuting = false;
+	currentPageData = nullptr;
+	scanOwnsSnapshot = false;
+	snapshotEpoch = 0;
+	freeListChanged = false;
+	expiredPurgePending = false;
+	clearWriteStats();
+	writeBackRate = options.writeBackRate;
+	maxDirtyPages = options.maxDirtyPages;
+	writerStopping = false;
+	writeBackCursor = 0;
+	this->attrByteOffset = attrByteOffset;
+	attributeType = attrType;
+	lastIndexedRid.page_number = 0;
+	lastIndexedRid.slot_number = 0;
+	hasLastIndexedRid = true;
 	try
 	{
 		// try to open the index file
@@ -109,9 +373,30 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 		meta->attrByteOffset = attrByteOffset;
 		meta->attrType = attrType; 
 		rootPageNum = meta->rootPageNo;
+		lastPageNum = meta->lastPageNo;
+		leafFormat = meta->leafFormat;
+		PageId freeListPageNo = meta->freeListPageNo;
+		lastIndexedRid = meta->lastIndexedRid;
+		hasLastIndexedRid = meta->hasLastIndexedRid;
+		includedColumns.assign(meta->includedColumns, meta->includedColumns + meta->numIncludedColumns);
+		predicate = meta->predicate;
+		unique = meta->unique;
+		timeToLive = meta->timeToLive;
+		expiryWatermark = meta->hasExpiryWatermark ? meta->expiryWatermark : INT_MIN;
+		purgedWatermark = INT_MIN;
+		hasKeyRange = meta->hasKeyRange;
+		keyRangeLow = meta->keyRangeLow;
+		keyRangeHigh = meta->keyRangeHigh;
+		shardCount = meta->shardCount;
+		shardId = meta->shardId;
 
 		// unpin the header page
 		bufMgr->unPinPage(file, headerPageNum, false);
+		readFreeList(freeListPageNo);
+		//index files written before the last page was recorded read 0
+		if(lastPageNum == 0)
+			lastPageNum = findLastPage();
+		setPayloadLayout();
 	}
 	// if the index file does not exist. then catch the FileNotFoundException
 	catch (FileNotFoundException e)
@@ -121,39 +406,332 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 		// allocate root and header page
 		Page *headerPage = NULL;
 		bufMgr->allocPage(file, headerPageNum, headerPage);	
-		allocLeaf(rootPageNum);
+		lastPageNum = headerPageNum;
+		leafFormat = options.leafFormat;
+		includedColumns = options.includedColumns;
+		predicate = options.predicate;
+		unique = options.unique;
+		timeToLive = options.timeToLive;
+		expiryWatermark = INT_MIN;
+		purgedWatermark = INT_MIN;
+		hasKeyRange = options.hasKeyRange;
+		keyRangeLow = options.keyRangeLow;
+		keyRangeHigh = options.keyRangeHigh;
+		shardCount = options.shardCount;
+		shardId = options.shardId;
+		int includedSize = 0;
+		for(size_t i = 0; i < includedColumns.size(); i++)
+			includedSize += includedColumns[i].length;
+		if(includedColumns.size() > (size_t)MAXINCLUDEDCOLUMNS || includedSize > MAXPAYLOADSIZE)
+		{
+			bufMgr->unPinPage(file, headerPageNum, false);
+			bufMgr->flushFile(file);
+			delete file;
+			file = nullptr;
+			File::remove(outIndexName);
+			throw BadIndexInfoException("too many included columns");
+		}
+		// the included columns live in the heap entries of slotted leaves
+		if(!includedColumns.empty())
+			leafFormat = SLOTTED_LEAF;
+		setPayloadLayout();
+		if(leafFormat == SLOTTED_LEAF)
+			allocSlottedLeaf(rootPageNum);
+		else
+			allocLeaf(rootPageNum);
 		// fill meta info
 		IndexMetaInfo *meta = (IndexMetaInfo *)headerPage; // cast the first page to the meta page, then reference the meta data here
 		meta->attrByteOffset = attrByteOffset;
 		meta->attrType = attrType;
 		meta->rootPageNo = rootPageNum;
+		meta->lastPageNo = lastPageNum;
+		meta->leafFormat = leafFormat;
+		meta->freeListPageNo = 0;
+		meta->lastIndexedRid = lastIndexedRid;
+		meta->hasLastIndexedRid = true;
+		meta->numIncludedColumns = includedColumns.size();
+		for(size_t i = 0; i < includedColumns.size(); i++)
+			meta->includedColumns[i] = includedColumns[i];
+		meta->predicate = predicate;
+		meta->unique = unique;
+		meta->timeToLive = timeToLive;
+		meta->hasExpiryWatermark = false;
+		meta->expiryWatermark = INT_MIN;
+		meta->hasKeyRange = hasKeyRange;
+		meta->keyRangeLow = keyRangeLow;
+		meta->keyRangeHigh = keyRangeHigh;
+		meta->shardCount = shardCount;
+		meta->shardId = shardId;
 		strncpy((char *)(&(meta->relationName)), relationName.c_str(), 20);
 		meta->relationName[19] = 0;
 
-		bufMgr->unPinPage(file, headerPageNum, true);
-		bufMgr->unPinPage(file, rootPageNum, true);
-		// insert the records into the b+ tree (index file)
-		FileScan fileScan(relationName, bufMgr);
+		unPinDirtyPage(headerPageNum);
+		unPinDirtyPage(rootPageNum);
+	}
+
+	if(writeBackRate > 0)
+		writer = std::thread(&BTreeIndex::writeBackLoop, this);
+	// insert the records into the b+ tree (index file), only those appended since the last time if it exists
+	try
+	{
+		if(options.indexRelation && hasLastIndexedRid && !indexAppendedRecords(relationName))
+			throw BadIndexInfoException("the relation does not contain the last record of the index");
+	}
+	catch(...)
+	{
+		// the destructor does not run, the writer must not outlive the constructor
+		stopWriter();
 		try
 		{
-			RecordId outRid;
-			while (1)
+			flush();
+			bufMgr->flushFile(file);
+		}
+		catch(...)
+		{
+		}
+		delete file;
+		file = nullptr;
+		throw;
+	}
+	// save B+ tree file to disk, the background writer has already written most of it
+	flush();
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::indexAppendedRecords
+// -----------------------------------------------------------------------------
+
+/**
+ * A record collected by indexAppendedRecords(), with its included columns.
+ */
+struct CatchUpEntry {
+	RIDKeyPair<int> pair;
+	std::string payload;
+
+	bool operator<(const CatchUpEntry &other) const
+	{
+		return pair < other.pair;
+	}
+};
+
+bool BTreeIndex::indexAppendedRecords(const std::string & relationName)
+{
+	std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+	std::vector<CatchUpEntry> batch;
+	batch.reserve(CATCHUPBATCHSIZE);
+	RecordId lastScannedRid = lastIndexedRid;
+	auto insertBatch = [this, &batch]()
+	{
+		std::sort(batch.begin(), batch.end());
+		for(size_t i = 0; i < batch.size(); i++)
+		{
+			insertEntry(&batch[i].pair.key, batch[i].pair.rid, payloadSize > 0 ? batch[i].payload.data() : nullptr);
+		}
+		batch.clear();
+	};
+	bool found = readRelationAfter(bufMgr, relationName, lastIndexedRid,
+		[this, &batch, &lastScannedRid, &insertBatch](RecordId rid, const std::string &record)
+	{
+		lastScannedRid = rid;
+		if(matchesPredicate(record.c_str()))
+		{
+			CatchUpEntry entry;
+			entry.pair.set(rid, *((int *)(record.c_str() + attrByteOffset)));
+			if(payloadSize > 0)
 			{
-				fileScan.scanNext(outRid);
-				std::string record = fileScan.getRecord();
-				int key = *((int *)(record.c_str() + attrByteOffset));
-				//printf("key: %d\n", key);
-				insertEntry(&key, outRid); // insert the <key, rid> pair
+				entry.payload.resize(payloadSize);
+				extractPayload(record.c_str(), &entry.payload[0]);
 			}
+			batch.push_back(entry);
 		}
-		catch (EndOfFileException e)
+		if(batch.size() == (size_t)CATCHUPBATCHSIZE)
 		{
-			// save B+ tree file to disk
-			bufMgr->flushFile(file);
+			insertBatch();
+			// records left out by the predicate of a partial index are covered as well
+			lastIndexedRid = lastScannedRid;
+		}
+	});
+	insertBatch();
+	lastIndexedRid = lastScannedRid;
+	updateMetaPage();
+	return found;
+}
+
+bool BTreeIndex::readRelationAfter(BufMgr *bufMgr, const std::string &relationName, RecordId after,
+		const std::function<void(RecordId rid, const std::string &record)> &visit)
+{
+	PageFile relation = PageFile::open(relationName);
+	// the pages are chained in file scan order, the ones before the page of the record are not read
+	PageId pageNo = after.page_number == 0 ? relation.getFirstPageNo() : after.page_number;
+	bool found = after.page_number == 0;
+	try
+	{
+		while(pageNo != Page::INVALID_NUMBER)
+		{
+			Page *page;
+			try
+			{
+				bufMgr->readPage(&relation, pageNo, page);
+			}
+			catch(InvalidPageException e)
+			{
+				// the page of the record is gone, or the relation is empty
+				break;
+			}
+			try
+			{
+				for(PageIterator it = page->begin(); it != page->end(); ++it)
+				{
+					RecordId rid = it.getCurrentRecord();
+					if(!found)
+					{
+						found = rid == after;
+						continue;
+					}
+					visit(rid, *it);
+				}
+			}
+			catch(...)
+			{
+				bufMgr->unPinPage(&relation, pageNo, false);
+				throw;
+			}
+			PageId nextPageNo = page->next_page_number();
+			bufMgr->unPinPage(&relation, pageNo, false);
+			if(!found)
+				break;
+			pageNo = nextPageNo;
+		}
+	}
+	catch(...)
+	{
+		// the frames of the relation must not outlive the file object
+		bufMgr->flushFile(&relation);
+		throw;
+	}
+	bufMgr->flushFile(&relation);
+	return found;
+}
+
+/**
+ * A record collected by the BTreeIndex::indexAppendedRecords() of several indexes for one of them.
+ */
+struct RoutedCatchUpEntry {
+	RIDKeyPair<int> pair;
+	std::string record;
+
+	bool operator<(const RoutedCatchUpEntry &other) const
+	{
+		return pair < other.pair;
+	}
+};
+
+void BTreeIndex::indexAppendedRecords(const std::string &relationName, const std::vector<BTreeIndex *> &indexes,
+		const std::function<int(int key)> &route)
+{
+	//the indexes normally hold the relation up to the same record; after an interrupted build they may not,
+	//the relation is then read from the start and every index skips the records up to its own last one.
+	//Indexes written before the last indexed record was kept are not caught up, as with a single index.
+	RecordId after;
+	after.page_number = 0;
+	after.slot_number = 0;
+	bool first = true;
+	for(size_t i = 0; i < indexes.size(); i++)
+	{
+		if(!indexes[i]->hasLastIndexedRid)
+			continue;
+		if(first)
+			after = indexes[i]->lastIndexedRid;
+		else if(indexes[i]->lastIndexedRid != after)
+			after.page_number = 0;
+		first = false;
+	}
+	if(first)
+		return;
+	if(after.page_number == 0)
+		after.slot_number = 0;
+	std::vector<bool> caughtUp(indexes.size());
+	for(size_t i = 0; i < indexes.size(); i++)
+	{
+		caughtUp[i] = !indexes[i]->hasLastIndexedRid || indexes[i]->lastIndexedRid == after;
+	}
+
+	int attrByteOffset = indexes[0]->attrByteOffset;
+	std::vector<std::vector<RoutedCatchUpEntry> > batches(indexes.size());
+	auto insertBatch = [&indexes, &batches](int i)
+	{
+		std::sort(batches[i].begin(), batches[i].end());
+		for(size_t e = 0; e < batches[i].size(); e++)
+		{
+			indexes[i]->insertRecord(batches[i][e].record, batches[i][e].pair.rid);
+		}
+		batches[i].clear();
+	};
+	RecordId lastScannedRid = after;
+	//the buffer managers of the indexes belong to their write back threads, the relation gets its own
+	BufMgr scanBufMgr(CATCHUPSCANBUFFERPAGES);
+	bool found = readRelationAfter(&scanBufMgr, relationName, after,
+		[&indexes, &route, attrByteOffset, &caughtUp, &batches, &lastScannedRid, &insertBatch](RecordId rid,
+			const std::string &record)
+	{
+		lastScannedRid = rid;
+		int key = *((int *)(record.c_str() + attrByteOffset));
+		int i = route(key);
+		for(size_t p = 0; p < indexes.size(); p++)
+		{
+			if(!caughtUp[p] && indexes[p]->lastIndexedRid == rid)
+				caughtUp[p] = true;
 		}
+		if(!caughtUp[i] || !indexes[i]->hasLastIndexedRid)
+			return;
+		RoutedCatchUpEntry entry;
+		entry.pair.set(rid, key);
+		entry.record = record;
+		batches[i].push_back(entry);
+		if(batches[i].size() == (size_t)CATCHUPBATCHSIZE)
+			insertBatch(i);
+	});
+	for(size_t i = 0; i < indexes.size(); i++)
+	{
+		insertBatch(i);
+		if(!caughtUp[i])
+			found = false;
+	}
+	if(!found)
+		throw BadIndexInfoException("the relation does not contain the last record of an index");
+	for(size_t i = 0; i < indexes.size(); i++)
+	{
+		BTreeIndex &index = *indexes[i];
+		if(!index.hasLastIndexedRid)
+			continue;
+		std::lock_guard<std::recursive_mutex> lock(index.writeBackLatch);
+		index.lastIndexedRid = lastScannedRid;
+		index.updateMetaPage();
 	}
 }
 
+void BTreeIndex::setPayloadLayout()
+{
+	payloadSize = 0;
+	for(size_t i = 0; i < includedColumns.size(); i++)
+		payloadSize += includedColumns[i].length;
+	//keep the heap entries aligned for the key and record id
+	int align = alignof(SlottedLeafEntry);
+	slottedEntrySize = (sizeof(SlottedLeafEntry) + payloadSize + align - 1) / align * align;
+}
+
+void BTreeIndex::stopWriter()
+{
+	if(writer.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(writerLatch);
+			writerStopping = true;
+		}
+		writerWakeup.notify_all();
+		writer.join();
+	}
+}
 
 // -----------------------------------------------------------------------------
 // BTreeIndex::~BTreeIndex -- destructor
@@ -161,7 +739,21 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 
 BTreeIndex::~BTreeIndex()
 {
+	stopWriter();
+	if (scanExecuting && currentPageData != nullptr)
+	{
+		bufMgr->unPinPage(file, currentPageNum, false);
+	}
 	scanExecuting = false;
+	// snapshots do not survive the index object, free every page kept for them
+	liveSnapshots.clear();
+	reclaimPageVersions();
+	releaseRetiredPages();
+	// no operation is in progress anymore, so every retired page can be reclaimed
+	epochs.drain();
+  	updateMetaPage();
+  	// only the tail the background writer did not get to is left
+  	flush();
   	bufMgr->flushFile(BTreeIndex::file);
   	delete file;
   	file = nullptr;
@@ -177,7 +769,8 @@ BTreeIndex::~BTreeIndex()
 // BTreeIndex::insertEntry
 // -----------------------------------------------------------------------------
 
-bool BTreeIndex::insertNode(int key, RecordId rid, int& midKey, PageId pid, PageId& newSonPageId)
+bool BTreeIndex::insertNode(int key, RecordId rid, int& midKey, PageId pid, PageId& newSonPageId, const char *payload,
+                            bool replace, bool atSeparator, InsertStatus &status)
 {
 	Page *curPage;
 	bool split = false;
@@ -185,32 +778,105 @@ bool BTreeIndex::insertNode(int key, RecordId rid, int& midKey, PageId pid, Page
 	NonLeafNodeInt* nonLeaf = (NonLeafNodeInt *)curPage;
 
 	//current node is leaf node
-	if(nonLeaf->level == -1) 	
+	if(isLeaf(curPage)) 	
 	{
-		bufMgr->unPinPage(file, pid, false);
+		//the duplicate check and the insertion work on the leaf the descent has pinned
+		PageId foundPid;
+		int foundIdx;
+		if((unique || replace) && findExistingEntry(key, pid, curPage, atSeparator, foundPid, foundIdx))
+		{
+			bufMgr->unPinPage(file, pid, false);
+			if(replace)
+				replaceLeafEntry(foundPid, foundIdx, rid, payload);
+			status = replace ? REPLACED : DUPLICATE_KEY;
+			return false;
+		}
 		//insert new entry to leaf, split is set to true if the node is splitted
-		split = insertToLeaf(key, rid, pid, midKey, newSonPageId); 
+		split = insertToLeaf(key, rid, pid, curPage, midKey, newSonPageId, payload); 
+		status = INSERTED;
 	}
 	else //non-leaf node
 	{
 		//find the index of key
 		int idx = findNonLeafIndex(nonLeaf, key);
 		PageId sonPid = nonLeaf->pageNoArray[idx];
-		bufMgr->unPinPage(file, pid, true);
+		// the last child of a node ends at the separator on the right of the node itself
+		bool sonAtSeparator = idx < nonLeafKeyCount(nonLeaf) ? nonLeaf->keyArray[idx] == key : atSeparator;
+		bufMgr->unPinPage(file, pid, false);
 		//recursively find the leaf node, insert a pushed up entry to current node if son is splitted
-		if(insertNode(key, rid, midKey, sonPid, newSonPageId))
+		if(insertNode(key, rid, midKey, sonPid, newSonPageId, payload, replace, sonAtSeparator, status))
 		{
 			int sonMidKey = midKey;
 			PageId sonPageId = newSonPageId;
-			split = insertToNonLeafNode(sonMidKey, sonPageId, pid, midKey, newSonPageId);
+			split = insertToNonLeafNode(sonMidKey, sonPageId, idx, pid, midKey, newSonPageId);
 		}	
 	}
 	return split;
 }
 
+bool BTreeIndex::findExistingEntry(int key, PageId pid, Page *page, bool atSeparator, PageId &foundPid, int &foundIdx)
+{
+	int lo = 0;
+	int hi = leafSize(page);
+	while(lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if(leafKeyAt(page, mid) < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(lo < leafSize(page) && leafKeyAt(page, lo) == key)
+	{
+		foundPid = pid;
+		foundIdx = lo;
+		return true;
+	}
+	// keys equal to the separator go left, but the leaf split that pushed it up left its first entry on the right
+	PageId next = (lo == leafSize(page) && atSeparator) ? leafRightSib(page) : 0;
+	while(next != 0)
+	{
+		Page *nextPage;
+		bufMgr->readPage(file, next, nextPage);
+		if(leafSize(nextPage) > 0)
+		{
+			bool found = leafKeyAt(nextPage, 0) == key;
+			bufMgr->unPinPage(file, next, false);
+			foundPid = next;
+			foundIdx = 0;
+			return found;
+		}
+		// a leaf emptied by deleteRange() keeps its place in the chain
+		PageId right = leafRightSib(nextPage);
+		bufMgr->unPinPage(file, next, false);
+		next = right;
+	}
+	return false;
+}
+
+void BTreeIndex::replaceLeafEntry(PageId pid, int idx, RecordId rid, const char *payload)
+{
+	savePageVersion(pid);
+	Page *page;
+	bufMgr->readPage(file, pid, page);
+	if(isSlottedLeaf(page))
+	{
+		SlottedLeafNodeInt *node = (SlottedLeafNodeInt *)page;
+		SlottedLeafEntry *entry = slottedEntry(node, idx);
+		entry->rid = rid;
+		//the alignment padding after the payload stays zero
+		memset(entry + 1, 0, node->entrySize - sizeof(SlottedLeafEntry));
+		if(payload != nullptr)
+			memcpy(entry + 1, payload, payloadSize);
+	}
+	else
+		((LeafNodeInt *)page)->ridArray[idx] = rid;
+	unPinDirtyPage(pid);
+}
 
-bool BTreeIndex::insertToNonLeafNode(int key, PageId sonPid, PageId pid, int& midKey, PageId& newPid)
+bool BTreeIndex::insertToNonLeafNode(int key, PageId sonPid, int sonIdx, PageId pid, int& midKey, PageId& newPid)
 {
+	savePageVersion(pid);
 	Page *curPage;
 	bufMgr->readPage(file, pid, curPage);
 	NonLeafNodeInt* node = (NonLeafNodeInt *)curPage;
@@ -221,241 +887,770 @@ bool BTreeIndex::insertToNonLeafNode(int key, PageId sonPid, PageId pid, int& mi
 	if(node->pageNoArray[INTARRAYNONLEAFSIZE] != 0) 
 	{
 		split = true;
-		bufMgr->unPinPage(file, pid, true);
-		midKey = splitNonLeafNode(key, sonPid, pid, newPid);	
+		bufMgr->unPinPage(file, pid, false);
+		midKey = splitNonLeafNode(key, sonPid, sonIdx, pid, newPid);
 	}
 	else //insert a new key and a pointer to the son to the right of the key
 	{
-		int i = 0;
-		//find the index where the new key should be inserted to
-		while(i < INTARRAYNONLEAFSIZE && node->pageNoArray[i+1] != 0 && node->keyArray[i] <= key)
-		{
-			i++;
-		}
-		int j = INTARRAYNONLEAFSIZE - 1;
-		//move all succeeding entries backward
-		while(j > i)
-		{
-			node->keyArray[j] = node->keyArray[j-1];
-			node->pageNoArray[j+1] = node->pageNoArray[j];
-			j--;
-		}
-		//insert new entry
-		node->keyArray[i] = key;
-		node->pageNoArray[i+1] = sonPid;	
-		bufMgr->unPinPage(file, pid, true);
+		insertNonLeafEntry(node, key, sonPid, sonIdx);
+		unPinDirtyPage(pid);
 	}
 	return split;
 }
 
 
 
-bool BTreeIndex::insertToLeaf(int key, RecordId rid, PageId pid, int& midKey, PageId& newPid)
+bool BTreeIndex::insertToLeaf(int key, RecordId rid, PageId pid, Page *curPage, int& midKey, PageId& newPid, const char *payload)
 {
-	Page *curPage;
-	bufMgr->readPage(file, pid, curPage);
-	LeafNodeInt* node = (LeafNodeInt *)curPage;
+	savePageVersion(pid);
 	
 	bool split = false;
-	int next = 0;
 
-	//test whether node is full
-	while(node->ridArray[next].page_number != 0 && next < INTARRAYLEAFSIZE)
+	//purge the expired entries of the leaf while it is at hand, which may spare the split
+	int expired = leafEntriesBelow(curPage, expiryWatermark);
+	if(expired > 0)
 	{
-		next++;
+		removeLeafEntries(curPage, 0, expired);
+		writeStats.entriesExpired += expired;
 	}
+
 	//insert and split if node is full
-	if(next == INTARRAYLEAFSIZE)
+	if(leafIsFull(curPage))
 	{ 
-		bufMgr->unPinPage(file, pid, true);
-		midKey = splitLeafNode(key, rid, pid, newPid);
+		if(expired > 0)
+			unPinDirtyPage(pid);
+		else
+			bufMgr->unPinPage(file, pid, false);
+		midKey = splitLeafNode(key, rid, pid, newPid, payload);
 		split = true;
+		expiredPurgePending = expiryWatermark > purgedWatermark;
 	}
-	else //insert an entry if node is not full
+	else if(isSlottedLeaf(curPage)) //insert an entry if node is not full
 	{
-		int i = 0;
-		if(node->ridArray[0].page_number == 0) //if the node is empty
-		{
-			node->keyArray[0] = key;
-			node->ridArray[0] = rid;
-			bufMgr->unPinPage(file, pid, true);
-			return split;
-		}
-
-		//find the index for the new key
-		while(i < INTARRAYLEAFSIZE)
-		{
-			if(node->ridArray[i].page_number == 0 || node->keyArray[i] > key)
-			{
-				int j = INTARRAYLEAFSIZE - 1;
-				//move all succeeding entries backward
-				while(j > i)
-				{
-					node->keyArray[j] = node->keyArray[j-1];
-					node->ridArray[j] = node->ridArray[j-1];
-					j--;
-				}
-				node->keyArray[i] = key;
-				node->ridArray[i] = rid;
-				break;
-			}
-			i++;
-		}
-		bufMgr->unPinPage(file, pid, true);
+		insertSlottedLeafEntry((SlottedLeafNodeInt *)curPage, key, rid, payload, payloadSize);
+		unPinDirtyPage(pid);
+	}
+	else
+	{
+		insertLeafEntry((LeafNodeInt *)curPage, key, rid);
+		unPinDirtyPage(pid);
 	}
 	return split;
 } 
 
 
 // return midVal of the newly splitted node
-int BTreeIndex::splitNonLeafNode(int key, PageId sonPid, PageId pid, PageId& newPid)
+int BTreeIndex::splitNonLeafNode(int key, PageId sonPid, int sonIdx, PageId pid, PageId& newPid)
 {
 	Page *curPage;
 	bufMgr->readPage(file, pid, curPage);
 	NonLeafNodeInt* node = (NonLeafNodeInt *)curPage;
-	int tempKey[INTARRAYNONLEAFSIZE+1], tempPid[INTARRAYNONLEAFSIZE+1];
-
-	//create array with newly inserted entry
-	tempPid[0] = node->pageNoArray[0];
-	for(int i = 0, j = 0; i <= INTARRAYNONLEAFSIZE; i++, j++)
-	{
-		//insert new pair to the temp array
-		if(j == INTARRAYNONLEAFSIZE || node->pageNoArray[j+1] == 0)
-		{
-			tempKey[j] = key;
-			tempPid[j+1] = pid;
-			break;
-		}
-		if(j == i && key < node->keyArray[i])
-		{
-			tempKey[i] = key;
-			tempPid[i+1] = sonPid;
-			i++;
-		}
-		tempKey[i] = node->keyArray[j];
-		tempPid[i+1] = node->pageNoArray[j+1];
-	}
-
-	int midKey = tempKey[INTARRAYNONLEAFSIZE/2];
 
 	//split two nodes
-	NonLeafNodeInt *newNode = allocNonLeaf(newPid);
+	NonLeafNodeInt *newNode = allocNonLeaf(newPid, pid);
 	newNode->level = node->level;
-	for(int i = INTARRAYNONLEAFSIZE/2+1; i <= INTARRAYNONLEAFSIZE+1; i++)
-	{
-		node->pageNoArray[i] = 0; //mark unused array index
-		newNode->pageNoArray[i-INTARRAYNONLEAFSIZE/2-1] = tempPid[i];
-		if(i != INTARRAYNONLEAFSIZE+1)
-		{
-			newNode->keyArray[i-INTARRAYNONLEAFSIZE/2-1] = tempKey[i];
-		}
-	}
-	bufMgr->unPinPage(file, newPid, true);
-	bufMgr->unPinPage(file, pid, true);
+	int midKey = splitNonLeafEntries(node, newNode, key, sonPid, sonIdx);
+
+	unPinDirtyPage(newPid);
+	unPinDirtyPage(pid);
 	return midKey;
 }
 
 
 // split leaf and return mid value
-int BTreeIndex::splitLeafNode(int key, RecordId rid, PageId pid, PageId& newPid)
+int BTreeIndex::splitLeafNode(int key, RecordId rid, PageId pid, PageId& newPid, const char *payload)
 {
 	Page *curPage;
 	bufMgr->readPage(file, pid, curPage);
-	LeafNodeInt* node = (LeafNodeInt *)curPage;
-	int tempKey[INTARRAYLEAFSIZE+1];
-	RecordId tempRid[INTARRAYLEAFSIZE+1];
+	int midKey;
+
+	//split two nodes and update leaf node linked list
+	if(isSlottedLeaf(curPage))
+	{
+		SlottedLeafNodeInt* node = (SlottedLeafNodeInt *)curPage;
+		SlottedLeafNodeInt *newNode = allocSlottedLeaf(newPid, pid);
+		midKey = splitSlottedLeafEntries(node, newNode, key, rid, payload, payloadSize);
+		newNode->rightSibPageNo = node->rightSibPageNo;
+		node->rightSibPageNo = newPid;
+	}
+	else
+	{
+		LeafNodeInt* node = (LeafNodeInt *)curPage;
+		LeafNodeInt *newNode = allocLeaf(newPid, pid);
+		midKey = splitLeafEntries(node, newNode, key, rid);
+		newNode->rightSibPageNo = node->rightSibPageNo;
+		node->rightSibPageNo = newPid;
+	}
 	
-	//create array with newly inserted entry
-	for(int i = 0, j = 0; i <= INTARRAYLEAFSIZE; i++, j++) 
+	unPinDirtyPage(pid);
+	unPinDirtyPage(newPid);
+	return midKey;
+}
+
+// -----------------------------------------------------------------------------
+// Node kernels, they work on a node in memory without the buffer manager
+// -----------------------------------------------------------------------------
+
+int BTreeIndex::leafEntryCount(LeafNodeInt *node)
+{
+	//entries fill a prefix of the arrays, find the first free slot by binary search
+	int low = 0, high = INTARRAYLEAFSIZE;
+	while(low < high)
 	{
-		//insert new pair to the temp array
-		if(j == INTARRAYLEAFSIZE || node->ridArray[j].page_number == 0)
-		{
-			tempKey[j] = key;
-			tempRid[j] = rid;
-			break;
-		}
-		if(j == i && key < node->keyArray[i]) 
-		{
-			tempKey[i] = key;
-			tempRid[i] = rid;
-			i++;
-		}
-		tempKey[i] = node->keyArray[j];
-		tempRid[i] = node->ridArray[j];
+		int mid = (low + high) / 2;
+		if(node->ridArray[mid].page_number != 0)
+			low = mid + 1;
+		else
+			high = mid;
 	}
+	return low;
+}
 
-	//split two nodes
-	LeafNodeInt *newNode = allocLeaf(newPid);
-	for(int i = INTARRAYLEAFSIZE/2; i <= INTARRAYLEAFSIZE; i++)	
+int BTreeIndex::nonLeafKeyCount(NonLeafNodeInt *node)
+{
+	//children fill a prefix of pageNoArray, find the first free slot after the leftmost child by binary search
+	int low = 0, high = INTARRAYNONLEAFSIZE;
+	while(low < high)
 	{
-		if(i < INTARRAYLEAFSIZE)
-			node->ridArray[i].page_number = 0; //mark unused array index
-		newNode->ridArray[i-INTARRAYLEAFSIZE/2] = tempRid[i];
-		newNode->keyArray[i-INTARRAYLEAFSIZE/2] = tempKey[i];
+		int mid = (low + high) / 2;
+		if(node->pageNoArray[mid+1] != 0)
+			low = mid + 1;
+		else
+			high = mid;
 	}
+	return low;
+}
 
-	//update leaf node linked list
-	newNode->rightSibPageNo = node->rightSibPageNo;
-	node->rightSibPageNo = newPid;
-	
-	bufMgr->unPinPage(file, pid, true);
-	bufMgr->unPinPage(file, newPid, true);
-	return tempKey[INTARRAYLEAFSIZE/2];// return mid key;
+void BTreeIndex::insertNonLeafEntry(NonLeafNodeInt *node, int key, PageId sonPid, int pos)
+{
+	int n = nonLeafKeyCount(node);
+	//the new key goes after all keys smaller than or equal to it, unless its position is given
+	int i = pos >= 0 ? pos : std::upper_bound(node->keyArray, node->keyArray + n, key) - node->keyArray;
+	//move the succeeding entries backward in bulk
+	memmove(&node->keyArray[i+1], &node->keyArray[i], (n - i) * sizeof(int));
+	memmove(&node->pageNoArray[i+2], &node->pageNoArray[i+1], (n - i) * sizeof(PageId));
+	//insert new entry
+	node->keyArray[i] = key;
+	node->pageNoArray[i+1] = sonPid;	
 }
 
-void BTreeIndex::updateRootPageNo()
+void BTreeIndex::insertLeafEntry(LeafNodeInt *node, int key, RecordId rid)
 {
-	Page *headerPage;
-	bufMgr->readPage(file, headerPageNum, headerPage);
-	IndexMetaInfo *header = (IndexMetaInfo *)headerPage;
-	header->rootPageNo = rootPageNum; 
-	bufMgr->unPinPage(file, headerPageNum, true);
+	int n = leafEntryCount(node);
+	//the new key goes after all keys smaller than or equal to it
+	int i = std::upper_bound(node->keyArray, node->keyArray + n, key) - node->keyArray;
+	//move the succeeding entries backward in bulk
+	memmove(&node->keyArray[i+1], &node->keyArray[i], (n - i) * sizeof(int));
+	memmove(&node->ridArray[i+1], &node->ridArray[i], (n - i) * sizeof(RecordId));
+	node->keyArray[i] = key;
+	node->ridArray[i] = rid;
 }
 
-//
-const void BTreeIndex::insertEntry(const void *key, const RecordId rid) 
+void BTreeIndex::removeLeafEntries(Page *page, int first, int end)
 {
-	Page *curPage;
-	PageId pid = rootPageNum;
+	int removed = end - first;
+	if(isSlottedLeaf(page))
+	{
+		SlottedLeafNodeInt *node = (SlottedLeafNodeInt *)page;
+		memmove(&node->slotArray[first], &node->slotArray[end], (node->numSlots - end) * sizeof(std::uint16_t));
+		node->numSlots -= removed;
+		node->deadBytes += removed * node->entrySize;
+		return;
+	}
+	LeafNodeInt *node = (LeafNodeInt *)page;
+	int n = leafEntryCount(node);
+	memmove(&node->keyArray[first], &node->keyArray[end], (n - end) * sizeof(int));
+	memmove(&node->ridArray[first], &node->ridArray[end], (n - end) * sizeof(RecordId));
+	//the entries fill a prefix of the arrays, clear the tail
+	memset(&node->keyArray[n - removed], 0, removed * sizeof(int));
+	memset((void *)&node->ridArray[n - removed], 0, removed * sizeof(RecordId));
+}
+
+int BTreeIndex::leafEntriesBelow(Page *page, int watermark)
+{
+	int lo = 0;
+	int hi = leafSize(page);
+	while(lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if(leafKeyAt(page, mid) < watermark)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int BTreeIndex::splitNonLeafEntries(NonLeafNodeInt *node, NonLeafNodeInt *newNode, int key, PageId sonPid, int pos)
+{
+	const int n = INTARRAYNONLEAFSIZE;
+	const int m = INTARRAYNONLEAFSIZE/2;
+	int p = pos >= 0 ? pos : std::upper_bound(node->keyArray, node->keyArray + n, key) - node->keyArray;
+	int midKey;
+
+	//with the new pair at position p, the node keeps keys [0, m) and the middle key m goes up.
+	//Move the upper half directly into the new node and shift only what stays on the side of the new pair
+	if(p < m)
+	{
+		midKey = node->keyArray[m-1];
+		memcpy(newNode->keyArray, &node->keyArray[m], (n - m) * sizeof(int));
+		memcpy(newNode->pageNoArray, &node->pageNoArray[m], (n - m + 1) * sizeof(PageId));
+		memmove(&node->keyArray[p+1], &node->keyArray[p], (m - 1 - p) * sizeof(int));
+		memmove(&node->pageNoArray[p+2], &node->pageNoArray[p+1], (m - 1 - p) * sizeof(PageId));
+		node->keyArray[p] = key;
+		node->pageNoArray[p+1] = sonPid;
+	}
+	else if(p == m)
+	{
+		midKey = key;
+		newNode->pageNoArray[0] = sonPid;
+		memcpy(newNode->keyArray, &node->keyArray[m], (n - m) * sizeof(int));
+		memcpy(&newNode->pageNoArray[1], &node->pageNoArray[m+1], (n - m) * sizeof(PageId));
+	}
+	else
+	{
+		midKey = node->keyArray[m];
+		memcpy(newNode->keyArray, &node->keyArray[m+1], (p - m - 1) * sizeof(int));
+		memcpy(newNode->pageNoArray, &node->pageNoArray[m+1], (p - m) * sizeof(PageId));
+		newNode->keyArray[p-m-1] = key;
+		newNode->pageNoArray[p-m] = sonPid;
+		memcpy(&newNode->keyArray[p-m], &node->keyArray[p], (n - p) * sizeof(int));
+		memcpy(&newNode->pageNoArray[p-m+1], &node->pageNoArray[p+1], (n - p) * sizeof(PageId));
+	}
+	//mark unused array index
+	memset(&node->pageNoArray[m+1], 0, (n - m) * sizeof(PageId));
+	return midKey;
+}
+
+int BTreeIndex::splitLeafEntries(LeafNodeInt *node, LeafNodeInt *newNode, int key, RecordId rid)
+{
+	const int n = INTARRAYLEAFSIZE;
+	const int m = INTARRAYLEAFSIZE/2;
+	int p = std::upper_bound(node->keyArray, node->keyArray + n, key) - node->keyArray;
+
+	//with the new pair at position p, the node keeps entries [0, m) and the rest goes to the new node.
+	//Move the upper half directly into the new node and shift only what stays on the side of the new pair
+	if(p < m)
+	{
+		memcpy(newNode->keyArray, &node->keyArray[m-1], (n - m + 1) * sizeof(int));
+		memcpy(newNode->ridArray, &node->ridArray[m-1], (n - m + 1) * sizeof(RecordId));
+		memmove(&node->keyArray[p+1], &node->keyArray[p], (m - 1 - p) * sizeof(int));
+		memmove(&node->ridArray[p+1], &node->ridArray[p], (m - 1 - p) * sizeof(RecordId));
+		node->keyArray[p] = key;
+		node->ridArray[p] = rid;
+	}
+	else
+	{
+		memcpy(newNode->keyArray, &node->keyArray[m], (p - m) * sizeof(int));
+		memcpy(newNode->ridArray, &node->ridArray[m], (p - m) * sizeof(RecordId));
+		newNode->keyArray[p-m] = key;
+		newNode->ridArray[p-m] = rid;
+		memcpy(&newNode->keyArray[p-m+1], &node->keyArray[p], (n - p) * sizeof(int));
+		memcpy(&newNode->ridArray[p-m+1], &node->ridArray[p], (n - p) * sizeof(RecordId));
+	}
+	//mark unused array index
+	memset(&node->ridArray[m], 0, (n - m) * sizeof(RecordId));
+	return newNode->keyArray[0];// return mid key;
+}
+
+void BTreeIndex::initSlottedLeaf(SlottedLeafNodeInt *node, int entrySize)
+{
+	memset((void *)node, 0, Page::SIZE);
+	node->level = SLOTTEDLEAFLEVEL;
+	node->rightSibPageNo = 0;
+	//the heap starts at the end of the page and grows toward the slot array
+	node->heapOffset = Page::SIZE;
+	node->entrySize = entrySize;
+}
+
+SlottedLeafEntry *BTreeIndex::slottedEntry(SlottedLeafNodeInt *node, int i)
+{
+	return (SlottedLeafEntry *)((char *)node + node->slotArray[i]);
+}
+
+bool BTreeIndex::slottedLeafHasRoom(SlottedLeafNodeInt *node)
+{
+	int freeBytes = node->heapOffset - (int)(offsetof(SlottedLeafNodeInt, slotArray) + node->numSlots * sizeof(std::uint16_t));
+	//space held by dead entries can be reclaimed by compacting the heap
+	return freeBytes + node->deadBytes >= (int)sizeof(std::uint16_t) + node->entrySize;
+}
+
+void BTreeIndex::compactSlottedLeaf(SlottedLeafNodeInt *node)
+{
+	char heap[Page::SIZE];
+	int offset = Page::SIZE;
+	//copy the live entries in slot order so that a scan reads the heap backward sequentially
+	for(int i = 0; i < node->numSlots; i++)
+	{
+		offset -= node->entrySize;
+		memcpy(&heap[offset], slottedEntry(node, i), node->entrySize);
+		node->slotArray[i] = offset;
+	}
+	memcpy((char *)node + offset, &heap[offset], Page::SIZE - offset);
+	node->heapOffset = offset;
+	node->deadBytes = 0;
+}
+
+void BTreeIndex::insertSlottedLeafEntry(SlottedLeafNodeInt *node, int key, RecordId rid, const char *payload,
+		int payloadSize)
+{
+	int n = node->numSlots;
+	int freeBytes = node->heapOffset - (int)(offsetof(SlottedLeafNodeInt, slotArray) + n * sizeof(std::uint16_t));
+	if(freeBytes < (int)sizeof(std::uint16_t) + node->entrySize)
+	{
+		compactSlottedLeaf(node);
+	}
+	//the entry is appended to the heap, only the two byte slots have to be kept sorted
+	node->heapOffset -= node->entrySize;
+	SlottedLeafEntry *entry = (SlottedLeafEntry *)((char *)node + node->heapOffset);
+	memset((void *)entry, 0, node->entrySize);
+	entry->key = key;
+	entry->rid = rid;
+	//the alignment padding after the payload stays zero
+	if(payload != nullptr)
+		memcpy(entry + 1, payload, payloadSize);
+
+	//the new key goes after all keys smaller than or equal to it
+	int low = 0, high = n;
+	while(low < high)
+	{
+		int mid = (low + high) / 2;
+		if(slottedEntry(node, mid)->key <= key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	memmove(&node->slotArray[low+1], &node->slotArray[low], (n - low) * sizeof(std::uint16_t));
+	node->slotArray[low] = node->heapOffset;
+	node->numSlots = n + 1;
+}
+
+int BTreeIndex::splitSlottedLeafEntries(SlottedLeafNodeInt *node, SlottedLeafNodeInt *newNode, int key, RecordId rid,
+		const char *payload, int payloadSize)
+{
+	const int n = node->numSlots;
+	const int m = n/2;
+
+	//move the upper half of the entries into the new node in key order
+	for(int i = m; i < n; i++)
+	{
+		newNode->heapOffset -= newNode->entrySize;
+		memcpy((char *)newNode + newNode->heapOffset, slottedEntry(node, i), node->entrySize);
+		newNode->slotArray[i-m] = newNode->heapOffset;
+	}
+	newNode->numSlots = n - m;
+	node->numSlots = m;
+	//the moved entries stay in the heap as dead space until an insert needs it
+	node->deadBytes += (n - m) * node->entrySize;
+
+	//the new pair goes to the side whose key range covers it
+	if(key < slottedEntry(newNode, 0)->key)
+		insertSlottedLeafEntry(node, key, rid, payload, payloadSize);
+	else
+		insertSlottedLeafEntry(newNode, key, rid, payload, payloadSize);
+	return slottedEntry(newNode, 0)->key;// return mid key;
+}
+
+int BTreeIndex::filterKeys(const int *keys, int n, const KeyPredicate &predicate, int *selection)
+{
+	int modulus = predicate.modulus > 1 ? predicate.modulus : 1;
+	//the non-negative remainder modulo a power of two is a mask of the low bits in two's complement
+	bool mask = (modulus & (modulus - 1)) == 0;
+	int count = 0;
+	int i = 0;
+#ifdef __SSE2__
+	if(mask)
+	{
+		const __m128i lowBits = _mm_set1_epi32(modulus - 1);
+		const __m128i remainder = _mm_set1_epi32(predicate.remainder);
+		for(; i + 4 <= n; i += 4)
+		{
+			__m128i k = _mm_loadu_si128((const __m128i *)(keys + i));
+			__m128i match = _mm_cmpeq_epi32(_mm_and_si128(k, lowBits), remainder);
+			for(size_t e = 0; e < predicate.excluded.size(); e++)
+			{
+				match = _mm_andnot_si128(_mm_cmpeq_epi32(k, _mm_set1_epi32(predicate.excluded[e])), match);
+			}
+			//one bit per lane, append the lanes that are set
+			int bits = _mm_movemask_ps(_mm_castsi128_ps(match));
+			while(bits != 0)
+			{
+				int lane = __builtin_ctz(bits);
+				selection[count++] = i + lane;
+				bits &= bits - 1;
+			}
+		}
+	}
+#endif
+	for(; i < n; i++)
+	{
+		int rest = keys[i] % modulus;
+		if(rest < 0)
+			rest += modulus;
+		if(rest != predicate.remainder)
+			continue;
+		if(std::find(predicate.excluded.begin(), predicate.excluded.end(), keys[i]) != predicate.excluded.end())
+			continue;
+		selection[count++] = i;
+	}
+	return count;
+}
+
+void BTreeIndex::updateMetaPage()
+{
+	collectReclaimedPages();
+	Page *headerPage;
+	bufMgr->readPage(file, headerPageNum, headerPage);
+	IndexMetaInfo *header = (IndexMetaInfo *)headerPage;
+	//only write the pages that change
+	bool modified = false;
+	if(freeListChanged)
+	{
+		header->freeListPageNo = writeFreeList();
+		freeListChanged = false;
+		modified = true;
+	}
+	if(header->rootPageNo != rootPageNum || header->lastPageNo != lastPageNum || header->lastIndexedRid != lastIndexedRid)
+	{
+		header->rootPageNo = rootPageNum; 
+		header->lastPageNo = lastPageNum;
+		header->lastIndexedRid = lastIndexedRid;
+		modified = true;
+	}
+	if(expiryWatermark != INT_MIN && (!header->hasExpiryWatermark || header->expiryWatermark != expiryWatermark))
+	{
+		header->hasExpiryWatermark = true;
+		header->expiryWatermark = expiryWatermark;
+		modified = true;
+	}
+	if(modified)
+		unPinDirtyPage(headerPageNum);
+	else
+		bufMgr->unPinPage(file, headerPageNum, false);
+}
+
+void BTreeIndex::unPinDirtyPage(PageId pageId)
+{
+	writeStats.pagesDirtied++;
+	if(writeBackRate == 0)
+	{
+		bufMgr->unPinPage(file, pageId, true);
+		return;
+	}
+	std::map<PageId, DirtyIndexPage>::iterator it = dirtyPages.find(pageId);
+	if(it != dirtyPages.end())
+	{
+		//already kept for the writer, which has to write it again
+		it->second.written = false;
+		bufMgr->unPinPage(file, pageId, false);
+		return;
+	}
+	if(!dirtyPages.empty() && (int)dirtyPages.size() >= maxDirtyPages)
+	{
+		collectWrittenPages();
+		if(!dirtyPages.empty() && (int)dirtyPages.size() >= maxDirtyPages)
+			writeDirtyPage(dirtyPages.begin());
+	}
+	//the pin of the caller is kept for the writer, the buffer manager never sees the page dirty
+	DirtyIndexPage dirty;
+	bufMgr->readPage(file, pageId, dirty.page);
+	bufMgr->unPinPage(file, pageId, false);
+	dirty.written = false;
+	dirtyPages[pageId] = dirty;
+}
+
+void BTreeIndex::writeDirtyPage(std::map<PageId, DirtyIndexPage>::iterator it)
+{
+	if(!it->second.written)
+	{
+		file->writePage(it->first, *it->second.page);
+		writeStats.pagesWrittenInForeground++;
+	}
+	bufMgr->unPinPage(file, it->first, false);
+	dirtyPages.erase(it);
+}
+
+void BTreeIndex::collectWrittenPages()
+{
+	std::map<PageId, DirtyIndexPage>::iterator it = dirtyPages.begin();
+	while(it != dirtyPages.end())
+	{
+		std::map<PageId, DirtyIndexPage>::iterator next = it;
+		++next;
+		if(it->second.written)
+			writeDirtyPage(it);
+		it = next;
+	}
+}
+
+void BTreeIndex::flush()
+{
+	std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+	if(writeBackRate == 0)
+	{
+		bufMgr->flushFile(file);
+		return;
+	}
+	//in page number order
+	while(!dirtyPages.empty())
+	{
+		writeDirtyPage(dirtyPages.begin());
+	}
+}
+
+void BTreeIndex::writeBackLoop()
+{
+	std::unique_lock<std::mutex> lock(writerLatch);
+	double credit = 0;
+	while(!writerStopping)
+	{
+		writerWakeup.wait_for(lock, std::chrono::milliseconds(WRITEBACKINTERVAL));
+		if(writerStopping)
+			break;
+		lock.unlock();
+		//pages allowed this round, what is not used is carried over up to one second worth
+		credit = std::min(credit + writeBackRate * WRITEBACKINTERVAL / 1000.0, (double)writeBackRate);
+		{
+			std::lock_guard<std::recursive_mutex> pagesLock(writeBackLatch);
+			//sweep upwards from where the previous round stopped, then wrap around once
+			std::map<PageId, DirtyIndexPage>::iterator it = dirtyPages.lower_bound(writeBackCursor);
+			bool wrapped = false;
+			while(credit >= 1)
+			{
+				if(it == dirtyPages.end())
+				{
+					if(wrapped)
+						break;
+					wrapped = true;
+					it = dirtyPages.begin();
+					continue;
+				}
+				if(wrapped && it->first >= writeBackCursor)
+					break;
+				if(!it->second.written)
+				{
+					file->writePage(it->first, *it->second.page);
+					it->second.written = true;
+					writeStats.pagesWrittenInBackground++;
+					credit -= 1;
+				}
+				++it;
+			}
+			writeBackCursor = it == dirtyPages.end() ? 0 : it->first;
+		}
+		lock.lock();
+	}
+}
+
+void BTreeIndex::getWriteStats(BTreeWriteStats &stats)
+{
+	std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+	stats = writeStats;
+}
+
+void BTreeIndex::clearWriteStats()
+{
+	std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+	writeStats.inserts = 0;
+	writeStats.pagesDirtied = 0;
+	writeStats.pagesWrittenInBackground = 0;
+	writeStats.pagesWrittenInForeground = 0;
+	writeStats.entriesExpired = 0;
+	writeStats.expiredPagesReleased = 0;
+}
+
+void BTreeIndex::setExpiryWatermark(int watermark)
+{
+	std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+	if(watermark <= expiryWatermark)
+		return;
+	expiryWatermark = watermark;
+	updateMetaPage();
+}
+
+int BTreeIndex::getExpiryWatermark()
+{
+	std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+	return expiryWatermark;
+}
+
+void BTreeIndex::purgeExpiredSubtrees()
+{
+	int lowVal = INT_MIN;
+	int highVal = expiryWatermark;
+	writeStats.expiredPagesReleased += deleteRange(&lowVal, GTE, &highVal, LT);
+	purgedWatermark = highVal;
+}
+
+void BTreeIndex::clipExpired(BTreeScanRange &range)
+{
+	std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+	if(range.lowVal < expiryWatermark)
+	{
+		range.lowVal = expiryWatermark;
+		range.lowOp = GTE;
+	}
+}
+
+//
+InsertStatus BTreeIndex::insertEntry(const void *key, const RecordId rid, const char *payload) 
+{
+	return insertKey(*(int *)key, rid, payload, false);
+}
+
+InsertStatus BTreeIndex::upsert(const void *key, const RecordId rid, const char *payload)
+{
+	return insertKey(*(int *)key, rid, payload, true);
+}
+
+bool BTreeIndex::isUnique() const
+{
+	return unique;
+}
+
+InsertStatus BTreeIndex::insertKey(int key, RecordId rid, const char *payload, bool replace)
+{
+	std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+	EpochGuard guard(epochs);
+	collectWrittenPages();
+	writeStats.inserts++;
+	if(key < expiryWatermark)
+		return EXPIRED;
+	// the watermark of a time to live follows the newest key, it is written to the meta page with the next update
+	if(timeToLive > 0 && (long long)key - timeToLive > expiryWatermark)
+		expiryWatermark = key - timeToLive;
+	InsertStatus status = INSERTED;
+	expiredPurgePending = false;
+	Page *curPage;
+	PageId pid = rootPageNum;
 	bufMgr->readPage(file, pid, curPage);
-	if(((LeafNodeInt*)curPage)->level == -1) //if root is leafnode
+	if(isLeaf(curPage)) //if root is leafnode
 	{
 		//printf("root is leaf, pid:%u\n", pid);
-		bufMgr->unPinPage(file, pid, true);
+		PageId foundPid;
+		int foundIdx;
+		if((unique || replace) && findExistingEntry(key, pid, curPage, false, foundPid, foundIdx))
+		{
+			bufMgr->unPinPage(file, pid, false);
+			if(replace)
+				replaceLeafEntry(foundPid, foundIdx, rid, payload);
+			return replace ? REPLACED : DUPLICATE_KEY;
+		}
 		int midKey;
 		PageId newPid;
-		if(insertToLeaf(*(int *)key, rid, pid, midKey, newPid)) //need to split root
+		if(insertToLeaf(key, rid, pid, curPage, midKey, newPid, payload)) //need to split root
 		{
 			//allocate new root node and assign the two son node entries
-			NonLeafNodeInt *newRoot = allocNonLeaf(rootPageNum);
+			NonLeafNodeInt *newRoot = allocNonLeaf(rootPageNum, pid);
 			newRoot->level = 1;
 			newRoot->keyArray[0] = midKey;
 			newRoot->pageNoArray[0] = pid;
 			newRoot->pageNoArray[1] = newPid;
-			bufMgr->unPinPage(file, rootPageNum, true);
+			unPinDirtyPage(rootPageNum);
 			//update root page number in header page
-			updateRootPageNo();
+			updateMetaPage();
 		}
 	} 
 	else
 	{
-		bufMgr->unPinPage(file, pid, true);
+		bufMgr->unPinPage(file, pid, false);
 		int midKey;
 		PageId newPid;
-		if(insertNode(*(int *)key, rid, midKey, rootPageNum, newPid)) // need to split root
+		if(insertNode(key, rid, midKey, rootPageNum, newPid, payload, replace, false, status)) // need to split root
 		{
 			//allocate new root node and assign the two son node entries
-			NonLeafNodeInt *newRoot = allocNonLeaf(rootPageNum);
+			NonLeafNodeInt *newRoot = allocNonLeaf(rootPageNum, pid);
 			newRoot->level = 0;
 			newRoot->keyArray[0] = midKey;
 			newRoot->pageNoArray[0] = pid;
 			newRoot->pageNoArray[1] = newPid;
-			bufMgr->unPinPage(file, rootPageNum, true);
+			unPinDirtyPage(rootPageNum);
 			//update root page number in header page
-			updateRootPageNo();
+			updateMetaPage();
 		}
 	}
+	if(expiredPurgePending)
+		purgeExpiredSubtrees();
+	return status;
+}
+
+InsertStatus BTreeIndex::insertRecord(const std::string &record, const RecordId rid)
+{
+	if(!matchesPredicate(record.c_str()))
+		return EXCLUDED;
+	int key = *((int *)(record.c_str() + attrByteOffset));
+	if(payloadSize == 0)
+		return insertEntry(&key, rid);
+	char payload[MAXPAYLOADSIZE];
+	extractPayload(record.c_str(), payload);
+	return insertEntry(&key, rid, payload);
+}
+
+bool BTreeIndex::getKeyRange(int &low, int &high) const
+{
+	low = keyRangeLow;
+	high = keyRangeHigh;
+	return hasKeyRange;
+}
+
+int BTreeIndex::getShard(int &count) const
+{
+	count = shardCount;
+	return shardId;
+}
+
+int BTreeIndex::hashShard(int key, int count)
+{
+	std::uint32_t hash = (std::uint32_t)key * 2654435761u;
+	hash ^= hash >> 16;
+	return hash % (std::uint32_t)count;
+}
+
+bool BTreeIndex::matchesPredicate(const char *record)
+{
+	if(hasKeyRange)
+	{
+		int key = *((int *)(record + attrByteOffset));
+		if(key < keyRangeLow || key > keyRangeHigh)
+			return false;
+	}
+	if(!predicate.enabled)
+		return true;
+	double value;
+	if(predicate.type == DOUBLE)
+		value = *((double *)(record + predicate.offset));
+	else
+		value = *((int *)(record + predicate.offset));
+	switch(predicate.op)
+	{
+	case LT:
+		return value < predicate.value;
+	case LTE:
+		return value <= predicate.value;
+	case GTE:
+		return value >= predicate.value;
+	default:
+		return value > predicate.value;
+	}
+}
+
+void BTreeIndex::extractPayload(const char *record, char *payload)
+{
+	for(size_t i = 0; i < includedColumns.size(); i++)
+	{
+		memcpy(payload, record + includedColumns[i].offset, includedColumns[i].length);
+		payload += includedColumns[i].length;
+	}
+}
+
+int BTreeIndex::getPayloadSize() const
+{
+	return payloadSize;
+}
+
+const std::vector<IncludedColumn> &BTreeIndex::getIncludedColumns() const
+{
+	return includedColumns;
 }
 
 
@@ -465,7 +1660,55 @@ const void BTreeIndex::insertEntry(const void *key, const RecordId rid)
 // ----------------------------------- 
 bool BTreeIndex::isLeaf(Page *page)
 {
-    return ((LeafNodeInt *)page)->level == -1;
+    int level = ((LeafNodeInt *)page)->level;
+    return level == -1 || level == SLOTTEDLEAFLEVEL;
+}
+
+bool BTreeIndex::isSlottedLeaf(Page *page)
+{
+    return ((LeafNodeInt *)page)->level == SLOTTEDLEAFLEVEL;
+}
+
+int BTreeIndex::leafSize(Page *page)
+{
+    if(isSlottedLeaf(page))
+        return ((SlottedLeafNodeInt *)page)->numSlots;
+    return leafEntryCount((LeafNodeInt *)page);
+}
+
+int BTreeIndex::leafKeyAt(Page *page, int i)
+{
+    if(isSlottedLeaf(page))
+        return slottedEntry((SlottedLeafNodeInt *)page, i)->key;
+    return ((LeafNodeInt *)page)->keyArray[i];
+}
+
+RecordId BTreeIndex::leafRidAt(Page *page, int i)
+{
+    if(isSlottedLeaf(page))
+        return slottedEntry((SlottedLeafNodeInt *)page, i)->rid;
+    return ((LeafNodeInt *)page)->ridArray[i];
+}
+
+const char *BTreeIndex::leafPayloadAt(Page *page, int i)
+{
+    if(!isSlottedLeaf(page) || ((SlottedLeafNodeInt *)page)->entrySize == sizeof(SlottedLeafEntry))
+        return nullptr;
+    return (const char *)(slottedEntry((SlottedLeafNodeInt *)page, i) + 1);
+}
+
+PageId BTreeIndex::leafRightSib(Page *page)
+{
+    if(isSlottedLeaf(page))
+        return ((SlottedLeafNodeInt *)page)->rightSibPageNo;
+    return ((LeafNodeInt *)page)->rightSibPageNo;
+}
+
+bool BTreeIndex::leafIsFull(Page *page)
+{
+    if(isSlottedLeaf(page))
+        return !slottedLeafHasRoom((SlottedLeafNodeInt *)page);
+    return leafEntryCount((LeafNodeInt *)page) == INTARRAYLEAFSIZE;
 }
 
 void BTreeIndex::recursiveScanPageId()
@@ -481,102 +1724,687 @@ void BTreeIndex::recursiveScanPageId()
     int idx = findNonLeafIndex(internal, lowValInt);
 	PageId nextPage = internal->pageNoArray[idx];
     bufMgr->unPinPage(file, currentPageNum, false);
-	currentPageNum = nextPage;
+	currentPageNum = snapshotPage(nextPage, scanSnapshot);
     recursiveScanPageId();
 }
 
 int BTreeIndex::findNonLeafIndex(NonLeafNodeInt *node, int key)
 {
     int idx = 0;
-	while(node->pageNoArray[idx+1] != 0 && key > node->keyArray[idx] && idx < INTARRAYNONLEAFSIZE){idx++;}
+	while(idx < INTARRAYNONLEAFSIZE && node->pageNoArray[idx+1] != 0 && key > node->keyArray[idx]){idx++;}
 	return idx;
 }
 
 
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::startScan
+// BTreeIndex::deleteRange
 // -----------------------------------------------------------------------------
 
-const void BTreeIndex::startScan(const void* lowValParm,
-				   const Operator lowOpParm,
-				   const void* highValParm,
-				   const Operator highOpParm)
+int BTreeIndex::deleteRange(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp)
 {
-    lowValInt = *((int *) lowValParm);
-    highValInt = *((int *) highValParm);
-    lowOp = lowOpParm;
-    highOp = highOpParm;
-    
-    if(lowOp != GT && lowOp != GTE) throw BadOpcodesException();
-    if(highOp != LT && highOp != LTE) throw BadOpcodesException();
-    if(lowValInt > highValInt) throw BadScanrangeException();
-    
-    //if another scan is already executing, end here
-    if(scanExecuting) 
-		endScan();
-  
-    currentPageNum = rootPageNum;
-    recursiveScanPageId();
-	bufMgr->readPage(file, currentPageNum, currentPageData);
-    //now we try to find the smallest entry that satisfy the operator
-    LeafNodeInt *leaf = (LeafNodeInt *) currentPageData;
+	std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+	EpochGuard guard(epochs);
+	if(lowOp != GT && lowOp != GTE) throw BadOpcodesException();
+	if(highOp != LT && highOp != LTE) throw BadOpcodesException();
+	int low = *((int *)lowVal);
+	int high = *((int *)highVal);
+	if(low > high) throw BadScanrangeException();
+	collectWrittenPages();
 
-	bool found_flag = false;
-    for (int i = 0; i < INTARRAYLEAFSIZE; i++)
+	//make both ends inclusive
+	if(lowOp == GT)
 	{
-		int key = leaf->keyArray[i];
-		// search to the end of the current node
-        if(leaf->ridArray[i].page_number == 0)
-        {
-			break; 
-        }else
-        {
-            // make sure if the key is within the correct range, stop searching if entry is found
-            if(lowOp == GT && key > lowValInt)
-            {
-                nextEntry = i;
-				found_flag = true;
-				break;
-            }
-                
-            if(lowOp == GTE && key >= lowValInt)
-            {
-                nextEntry = i;
-				found_flag = true;
-				break;
-            }
-               
-            if(highOp == LT && key > highValInt)
-            {
-        		bufMgr->unPinPage(file, currentPageNum, false);
-                throw NoSuchKeyFoundException();
-            }
-                
-            if(highOp == LTE && key >= highValInt)
-            {
-        		bufMgr->unPinPage(file, currentPageNum, false);
-                throw NoSuchKeyFoundException();
-            }
-        }
-    }
-	
+		if(low == INT_MAX)
+			return 0;
+		low++;
+	}
+	if(highOp == LT)
+	{
+		if(high == INT_MIN)
+			return 0;
+		high--;
+	}
+	if(low > high)
+		return 0;
+
+	RangeDeletion deletion;
+	deletion.low = low;
+	deletion.high = high;
+	deletion.firstLeaf = 0;
+	deletion.nextLeaf = 0;
+	deleteRangeNode(rootPageNum, false, 0, false, 0, deletion);
+
+	//link the leaf before the range to the leaf after it
+	Page *page;
+	bufMgr->readPage(file, deletion.firstLeaf, page);
+	bool relink = leafRightSib(page) != deletion.nextLeaf;
+	bufMgr->unPinPage(file, deletion.firstLeaf, false);
+	if(relink)
+	{
+		savePageVersion(deletion.firstLeaf);
+		bufMgr->readPage(file, deletion.firstLeaf, page);
+		if(isSlottedLeaf(page))
+			((SlottedLeafNodeInt *)page)->rightSibPageNo = deletion.nextLeaf;
+		else
+			((LeafNodeInt *)page)->rightSibPageNo = deletion.nextLeaf;
+		unPinDirtyPage(deletion.firstLeaf);
+	}
+
+	//a root left with a single child is replaced by it
+	PageId oldRootPageNum = rootPageNum;
+	while(true)
+	{
+		bufMgr->readPage(file, rootPageNum, page);
+		if(isLeaf(page) || nonLeafKeyCount((NonLeafNodeInt *)page) > 0)
+		{
+			bufMgr->unPinPage(file, rootPageNum, false);
+			break;
+		}
+		PageId childPageNum = ((NonLeafNodeInt *)page)->pageNoArray[0];
+		bufMgr->unPinPage(file, rootPageNum, false);
+		deletion.releasedPages.push_back(rootPageNum);
+		rootPageNum = childPageNum;
+	}
+
+	releaseTreePages(deletion.releasedPages);
+	if(rootPageNum != oldRootPageNum)
+		updateMetaPage();
+	return deletion.releasedPages.size();
+}
+
+bool BTreeIndex::deleteRangeNode(PageId pid, bool hasLow, int lowBound, bool hasHigh, int highBound, RangeDeletion &deletion)
+{
+	Page *page;
+	bufMgr->readPage(file, pid, page);
+	if(isLeaf(page))
+	{
+		//the entries of the range are contiguous
+		int n = leafSize(page);
+		int first = 0;
+		while(first < n && leafKeyAt(page, first) < deletion.low)
+			first++;
+		int end = first;
+		while(end < n && leafKeyAt(page, end) <= deletion.high)
+			end++;
+		bufMgr->unPinPage(file, pid, false);
+		if(end > first)
+		{
+			savePageVersion(pid);
+			bufMgr->readPage(file, pid, page);
+			removeLeafEntries(page, first, end);
+			unPinDirtyPage(pid);
+		}
+
+		if(deletion.firstLeaf == 0)
+		{
+			deletion.firstLeaf = pid;
+			return false;
+		}
+		if(n - (end - first) == 0 && pid != rootPageNum)
+		{
+			deletion.releasedPages.push_back(pid);
+			return true;
+		}
+		if(deletion.nextLeaf == 0)
+			deletion.nextLeaf = pid;
+		return false;
+	}
+
+	NonLeafNodeInt *node = (NonLeafNodeInt *)page;
+	int n = nonLeafKeyCount(node);
+	bool leafChildren = node->level == 1;
+	std::vector<int> keys(node->keyArray, node->keyArray + n);
+	std::vector<PageId> children(node->pageNoArray, node->pageNoArray + n + 1);
+	bufMgr->unPinPage(file, pid, false);
+
+	//child i holds the keys in [keys[i-1], keys[i]], the keys equal to a separator may be on either side of it
+	std::vector<int> kept;
+	for(int i = 0; i <= n; i++)
+	{
+		bool childHasLow = i > 0 || hasLow;
+		int childLow = i > 0 ? keys[i-1] : lowBound;
+		bool childHasHigh = i < n || hasHigh;
+		int childHigh = i < n ? keys[i] : highBound;
+		if(childHasLow && childLow > deletion.high)
+		{
+			//the first child after the range holds the next leaf, unless one was kept before it
+			if(deletion.nextLeaf == 0 && deletion.firstLeaf != 0)
+				deletion.nextLeaf = leftmostLeaf(children[i], leafChildren);
+			kept.push_back(i);
+			continue;
+		}
+		if(childHasHigh && childHigh < deletion.low)
+		{
+			kept.push_back(i);
+			continue;
+		}
+		bool covered = childHasLow && childLow >= deletion.low && childHasHigh && childHigh <= deletion.high;
+		if(covered && deletion.firstLeaf != 0)
+		{
+			releaseSubtree(children[i], leafChildren, deletion);
+		}
+		else if(!deleteRangeNode(children[i], childHasLow, childLow, childHasHigh, childHigh, deletion))
+		{
+			kept.push_back(i);
+		}
+	}
+
+	if(kept.empty())
+	{
+		deletion.releasedPages.push_back(pid);
+		return true;
+	}
+	if((int)kept.size() == n + 1)
+	{
+		return false;
+	}
+
+	//rewrite the node with the children that are left, each one after the separator on its left
+	savePageVersion(pid);
+	bufMgr->readPage(file, pid, page);
+	node = (NonLeafNodeInt *)page;
+	memset(node->keyArray, 0, sizeof(node->keyArray));
+	memset(node->pageNoArray, 0, sizeof(node->pageNoArray));
+	node->pageNoArray[0] = children[kept[0]];
+	for(size_t j = 1; j < kept.size(); j++)
+	{
+		node->keyArray[j-1] = keys[kept[j]-1];
+		node->pageNoArray[j] = children[kept[j]];
+	}
+	unPinDirtyPage(pid);
+	return false;
+}
+
+void BTreeIndex::releaseSubtree(PageId pid, bool leaf, RangeDeletion &deletion)
+{
+	deletion.releasedPages.push_back(pid);
+	if(leaf)
+		return;
+	Page *page;
+	bufMgr->readPage(file, pid, page);
+	NonLeafNodeInt *node = (NonLeafNodeInt *)page;
+	int n = nonLeafKeyCount(node);
+	bool leafChildren = node->level == 1;
+	std::vector<PageId> children(node->pageNoArray, node->pageNoArray + n + 1);
+	bufMgr->unPinPage(file, pid, false);
+	for(size_t i = 0; i < children.size(); i++)
+	{
+		releaseSubtree(children[i], leafChildren, deletion);
+	}
+}
+
+PageId BTreeIndex::leftmostLeaf(PageId pid, bool leaf)
+{
+	while(!leaf)
+	{
+		Page *page;
+		bufMgr->readPage(file, pid, page);
+		NonLeafNodeInt *node = (NonLeafNodeInt *)page;
+		leaf = node->level == 1;
+		PageId childPageNum = node->pageNoArray[0];
+		bufMgr->unPinPage(file, pid, false);
+		pid = childPageNum;
+	}
+	return pid;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::compact
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::allocIndexRun(int count, std::vector<PageId> &pageIds)
+{
+	collectReclaimedPages();
+	pageIds.clear();
+	//look for the lowest run of consecutive free pages that is long enough
+	PageId runStart = 0;
+	int runLength = 0;
+	for(std::set<PageId>::iterator it = freePages.begin(); it != freePages.end() && runLength < count; ++it)
+	{
+		if(runLength > 0 && *it == runStart + runLength)
+		{
+			runLength++;
+		}
+		else
+		{
+			runStart = *it;
+			runLength = 1;
+		}
+	}
+	if(runLength >= count)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			pageIds.push_back(runStart + i);
+			freePages.erase(runStart + i);
+		}
+		freeListChanged = true;
+		return;
+	}
+	//otherwise grow the file, the new pages follow each other at its end
+	for(int i = 0; i < count; i++)
+	{
+		PageId pageId;
+		Page *page;
+		bufMgr->allocPage(file, pageId, page);
+		unPinDirtyPage(pageId);
+		if(pageId > lastPageNum)
+			lastPageNum = pageId;
+		pageIds.push_back(pageId);
+	}
+}
+
+void BTreeIndex::releaseRetiredPages()
+{
+	for(size_t i = 0; i < retiredPages.size(); i++)
+	{
+		retirePage(retiredPages[i]);
+	}
+	retiredPages.clear();
+}
+
+void BTreeIndex::releaseTreePages(const std::vector<PageId> &pageIds)
+{
+	//a running scan keeps the old pages until it ends
+	if(!liveSnapshots.empty())
+	{
+		retiredPages.insert(retiredPages.end(), pageIds.begin(), pageIds.end());
+	}
+	else
+	{
+		for(size_t i = 0; i < pageIds.size(); i++)
+		{
+			retirePage(pageIds[i]);
+		}
+	}
+}
+
+void BTreeIndex::compact(float fillFactor)
+{
+	std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+	EpochGuard guard(epochs);
+	collectWrittenPages();
+	fillFactor = std::max(0.1f, std::min(fillFactor, 1.0f));
+
+	//collect the pages of the current version level by level, the last level holds the leaves in key order
+	std::vector<PageId> oldPages;
+	std::vector<PageId> level(1, rootPageNum);
+	while(true)
+	{
+		Page *page;
+		bufMgr->readPage(file, level[0], page);
+		bool leaves = isLeaf(page);
+		bufMgr->unPinPage(file, level[0], false);
+		if(leaves)
+			break;
+		std::vector<PageId> next;
+		for(size_t i = 0; i < level.size(); i++)
+		{
+			bufMgr->readPage(file, level[i], page);
+			NonLeafNodeInt *node = (NonLeafNodeInt *)page;
+			int n = nonLeafKeyCount(node);
+			next.insert(next.end(), node->pageNoArray, node->pageNoArray + n + 1);
+			bufMgr->unPinPage(file, level[i], false);
+		}
+		oldPages.insert(oldPages.end(), level.begin(), level.end());
+		level.swap(next);
+	}
+	std::vector<PageId> oldLeaves;
+	oldLeaves.swap(level);
+	oldPages.insert(oldPages.end(), oldLeaves.begin(), oldLeaves.end());
+
+	long long total = 0;
+	for(size_t i = 0; i < oldLeaves.size(); i++)
+	{
+		Page *page;
+		bufMgr->readPage(file, oldLeaves[i], page);
+		total += leafSize(page);
+		bufMgr->unPinPage(file, oldLeaves[i], false);
+	}
+
+	//spread the entries evenly over consecutive new leaves
+	int capacity = INTARRAYLEAFSIZE;
+	if(leafFormat == SLOTTED_LEAF)
+		capacity = (Page::SIZE - offsetof(SlottedLeafNodeInt, slotArray)) / (sizeof(std::uint16_t) + slottedEntrySize);
+	int perLeaf = std::max(1, (int)(capacity * fillFactor));
+	int leafCount = std::max(1LL, (total + perLeaf - 1) / perLeaf);
+	std::vector<PageId> newLeaves;
+	allocIndexRun(leafCount, newLeaves);
+	std::vector<int> firstKeys(leafCount, 0);
+
+	size_t oldLeaf = 0;
+	int oldEntry = 0;
+	long long copied = 0;
+	Page *oldPage;
+	bufMgr->readPage(file, oldLeaves[0], oldPage);
+	for(int i = 0; i < leafCount; i++)
+	{
+		Page *newPage;
+		bufMgr->readPage(file, newLeaves[i], newPage);
+		PageId rightSibPageNo = (i + 1 < leafCount) ? newLeaves[i+1] : 0;
+		if(leafFormat == SLOTTED_LEAF)
+		{
+			initSlottedLeaf((SlottedLeafNodeInt *)newPage, slottedEntrySize);
+			((SlottedLeafNodeInt *)newPage)->rightSibPageNo = rightSibPageNo;
+		}
+		else
+		{
+			memset((void *)newPage, 0, Page::SIZE);
+			((LeafNodeInt *)newPage)->level = -1;
+			((LeafNodeInt *)newPage)->rightSibPageNo = rightSibPageNo;
+		}
+		long long end = (i + 1) * total / leafCount;
+		for(int n = 0; copied < end; n++, copied++)
+		{
+			while(oldEntry == leafSize(oldPage))
+			{
+				bufMgr->unPinPage(file, oldLeaves[oldLeaf], false);
+				oldLeaf++;
+				bufMgr->readPage(file, oldLeaves[oldLeaf], oldPage);
+				oldEntry = 0;
+			}
+			int key = leafKeyAt(oldPage, oldEntry);
+			RecordId rid = leafRidAt(oldPage, oldEntry);
+			const char *payload = leafPayloadAt(oldPage, oldEntry);
+			oldEntry++;
+			if(n == 0)
+				firstKeys[i] = key;
+			if(leafFormat == SLOTTED_LEAF)
+			{
+				insertSlottedLeafEntry((SlottedLeafNodeInt *)newPage, key, rid, payload, payloadSize);
+			}
+			else
+			{
+				((LeafNodeInt *)newPage)->keyArray[n] = key;
+				((LeafNodeInt *)newPage)->ridArray[n] = rid;
+			}
+		}
+		unPinDirtyPage(newLeaves[i]);
+	}
+	bufMgr->unPinPage(file, oldLeaves[oldLeaf], false);
+
+	//build the internal levels bottom up, the first key of every node is pushed up as separator
+	std::vector<PageId> levelPages(newLeaves);
+	std::vector<int> levelKeys(firstKeys);
+	int perNode = std::max(2, (int)((INTARRAYNONLEAFSIZE + 1) * fillFactor));
+	int nodeLevel = 1;
+	while(levelPages.size() > 1)
+	{
+		size_t n = levelPages.size();
+		size_t nodeCount = (n + perNode - 1) / perNode;
+		std::vector<PageId> upperPages;
+		std::vector<int> upperKeys;
+		for(size_t i = 0; i < nodeCount; i++)
+		{
+			size_t start = i * n / nodeCount;
+			size_t end = (i + 1) * n / nodeCount;
+			PageId pid;
+			NonLeafNodeInt *node = allocNonLeaf(pid, levelPages[end-1]);
+			node->level = nodeLevel;
+			node->pageNoArray[0] = levelPages[start];
+			for(size_t j = start + 1; j < end; j++)
+			{
+				node->keyArray[j-start-1] = levelKeys[j];
+				node->pageNoArray[j-start] = levelPages[j];
+			}
+			unPinDirtyPage(pid);
+			upperPages.push_back(pid);
+			upperKeys.push_back(levelKeys[start]);
+		}
+		levelPages.swap(upperPages);
+		levelKeys.swap(upperKeys);
+		nodeLevel = 0;
+	}
+
+	//switch to the new version
+	rootPageNum = levelPages[0];
+	releaseTreePages(oldPages);
+	updateMetaPage();
+}
+
+// -----------------------------------------------------------------------------
+// Snapshots
+// -----------------------------------------------------------------------------
+
+BTreeSnapshot BTreeIndex::takeSnapshot()
+{
+	std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+	BTreeSnapshot snapshot;
+	snapshot.epoch = ++snapshotEpoch;
+	snapshot.rootPageNo = rootPageNum;
+	liveSnapshots.insert(snapshot.epoch);
+	return snapshot;
+}
+
+void BTreeIndex::releaseSnapshot(const BTreeSnapshot &snapshot)
+{
+	std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+	liveSnapshots.erase(snapshot.epoch);
+	reclaimPageVersions();
+	if(liveSnapshots.empty())
+	{
+		releaseRetiredPages();
+	}
+}
+
+PageId BTreeIndex::snapshotPage(PageId pageId, const BTreeSnapshot &snapshot)
+{
+	std::map<PageId, std::vector<PageVersion> >::iterator it = pageVersions.find(pageId);
+	if(it == pageVersions.end())
+	{
+		return pageId;
+	}
+	//the first before-image saved after the snapshot was taken holds the page as the snapshot saw it
+	std::vector<PageVersion> &versions = it->second;
+	for(size_t i = 0; i < versions.size(); i++)
+	{
+		if(versions[i].epoch >= snapshot.epoch)
+			return versions[i].pageNo;
+	}
+	return pageId;
+}
+
+void BTreeIndex::savePageVersion(PageId pageId)
+{
+	if(liveSnapshots.empty())
+	{
+		return;
+	}
+	//one before-image per page serves every snapshot taken since the previous one
+	std::vector<PageVersion> &versions = pageVersions[pageId];
+	if(!versions.empty() && versions.back().epoch >= *liveSnapshots.rbegin())
+	{
+		return;
+	}
+	PageVersion version;
+	version.epoch = snapshotEpoch;
+	Page *copyPage;
+	Page *page;
+	allocIndexPage(version.pageNo, copyPage, pageId);
+	bufMgr->readPage(file, pageId, page);
+	memcpy((void *)copyPage, page, Page::SIZE);
+	bufMgr->unPinPage(file, pageId, false);
+	unPinDirtyPage(version.pageNo);
+	versions.push_back(version);
+
+	//the scan is on a snapshot that now reads the before-image, move its pin there
+	if(scanExecuting && currentPageData != nullptr && currentPageNum == pageId)
+	{
+		bufMgr->unPinPage(file, currentPageNum, false);
+		currentPageNum = version.pageNo;
+		bufMgr->readPage(file, currentPageNum, currentPageData);
+	}
+}
+
+void BTreeIndex::reclaimPageVersions()
+{
+	std::map<PageId, std::vector<PageVersion> >::iterator it = pageVersions.begin();
+	while(it != pageVersions.end())
+	{
+		std::vector<PageVersion> &versions = it->second;
+		std::vector<PageVersion> kept;
+		int previousEpoch = 0;
+		for(size_t i = 0; i < versions.size(); i++)
+		{
+			//a before-image is read by the snapshots of the epochs after the previous before-image up to its own
+			std::set<int>::iterator reader = liveSnapshots.upper_bound(previousEpoch);
+			if(reader != liveSnapshots.end() && *reader <= versions[i].epoch)
+				kept.push_back(versions[i]);
+			else
+				retirePage(versions[i].pageNo);
+			previousEpoch = versions[i].epoch;
+		}
+		if(kept.empty())
+		{
+			pageVersions.erase(it++);
+		}
+		else
+		{
+			versions.swap(kept);
+			++it;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Epoch based reclamation
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::retirePage(PageId pageId)
+{
+	epochs.retire([this, pageId]()
+	{
+		std::lock_guard<std::mutex> lock(reclaimedLatch);
+		reclaimedPages.push_back(pageId);
+	});
+}
+
+void BTreeIndex::collectReclaimedPages()
+{
+	std::vector<PageId> pages;
+	{
+		std::lock_guard<std::mutex> lock(reclaimedLatch);
+		pages.swap(reclaimedPages);
+	}
+	for(size_t i = 0; i < pages.size(); i++)
+	{
+		freePage(pages[i]);
+	}
+}
+
+void BTreeIndex::registerThread()
+{
+	epochs.registerThread();
+}
+
+void BTreeIndex::unregisterThread()
+{
+	epochs.unregisterThread();
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::startScan
+// -----------------------------------------------------------------------------
+
+const void BTreeIndex::startScan(const void* lowValParm,
+				   const Operator lowOpParm,
+				   const void* highValParm,
+				   const Operator highOpParm,
+				   const BTreeSnapshot *snapshot)
+{
+    lowValInt = *((int *) lowValParm);
+    highValInt = *((int *) highValParm);
+    lowOp = lowOpParm;
+    highOp = highOpParm;
+    
+    if(lowOp != GT && lowOp != GTE) throw BadOpcodesException();
+    if(highOp != LT && highOp != LTE) throw BadOpcodesException();
+    if(lowValInt > highValInt) throw BadScanrangeException();
+
+    std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+    EpochGuard guard(epochs);
+    
+    //if another scan is already executing, end here
+    if(scanExecuting) 
+		endScan();
+
+    //expired keys are skipped by starting the scan at the watermark
+    if(lowValInt < expiryWatermark)
+    {
+        lowValInt = expiryWatermark;
+        lowOp = GTE;
+        if(lowValInt > highValInt)
+            throw NoSuchKeyFoundException();
+    }
+
+    //nothing is inserted while the scan starts, so without a given snapshot it can read the current pages
+    //and take its own snapshot once it is positioned
+    if(snapshot != nullptr)
+    {
+        scanSnapshot = *snapshot;
+    }
+    else
+    {
+        scanSnapshot.epoch = INT_MAX;
+        scanSnapshot.rootPageNo = rootPageNum;
+    }
+    currentPageNum = snapshotPage(scanSnapshot.rootPageNo, scanSnapshot);
+    recursiveScanPageId();
+	bufMgr->readPage(file, currentPageNum, currentPageData);
+    //now we try to find the smallest entry that satisfy the operator
+	bool found_flag = false;
+    int n = leafSize(currentPageData);
+    for (int i = 0; i < n; i++)
+	{
+		int key = leafKeyAt(currentPageData, i);
+        // make sure if the key is within the correct range, stop searching if entry is found
+        if(lowOp == GT && key > lowValInt)
+        {
+            nextEntry = i;
+            found_flag = true;
+            break;
+        }
+            
+        if(lowOp == GTE && key >= lowValInt)
+        {
+            nextEntry = i;
+            found_flag = true;
+            break;
+        }
+           
+        if(highOp == LT && key > highValInt)
+        {
+    		bufMgr->unPinPage(file, currentPageNum, false);
+            throw NoSuchKeyFoundException();
+        }
+            
+        if(highOp == LTE && key >= highValInt)
+        {
+    		bufMgr->unPinPage(file, currentPageNum, false);
+            throw NoSuchKeyFoundException();
+        }
+    }
+	
     if(found_flag == false)
 	{
 		//if the key is not in the current page and there is no next page exists, throw exception
-		if(leaf->rightSibPageNo == 0)
+		if(leafRightSib(currentPageData) == 0)
         {
         	bufMgr->unPinPage(file, currentPageNum, false);
             throw NoSuchKeyFoundException();
         } else //otherwise, the first entry of the next page is our target
         {
-			PageId nextPage = leaf->rightSibPageNo;
+			PageId nextPage = leafRightSib(currentPageData);
 			bufMgr->unPinPage(file, currentPageNum, false);
-            currentPageNum = nextPage;
+            currentPageNum = snapshotPage(nextPage, scanSnapshot);
     		bufMgr->readPage(file, currentPageNum, currentPageData);
             nextEntry = 0;
         }
 	}    
+    scanOwnsSnapshot = (snapshot == nullptr);
+    if(scanOwnsSnapshot)
+        scanSnapshot = takeSnapshot();
     scanExecuting = true;
 }
 
@@ -588,44 +2416,126 @@ const void BTreeIndex::startScan(const void* lowValParm,
 
 const void BTreeIndex::scanNext(RecordId& outRid)
 {
+    scanNext(outRid, nullptr);
+}
+
+const void BTreeIndex::scanNext(RecordId& outRid, char *outPayload)
+{
+    std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+    EpochGuard guard(epochs);
     if (!scanExecuting)
     {
         throw ScanNotInitializedException();
     }
 
-    // Cast page to node
-    LeafNodeInt *currentNode = (LeafNodeInt *)currentPageData;
-
-    outRid = currentNode->ridArray[nextEntry];
-
-    int val = currentNode->keyArray[nextEntry];
-    
-	// Check if the key is in range
-  	if (val > highValInt || (val == highValInt && highOp == LT))
+    // the scan already ran past its last entry and released the page
+    if (currentPageData == nullptr)
+    {
+        throw IndexScanCompletedException();
+    }
+
+    // if the scanner reach to the end of this page, move on to the next leaf if any exists
+    while (nextEntry >= leafSize(currentPageData) && leafRightSib(currentPageData) != 0)
+    {
+        // Unpin page and read next page
+        PageId nextPageNum = leafRightSib(currentPageData);
+        bufMgr->unPinPage(file, currentPageNum, false);
+		currentPageNum = snapshotPage(nextPageNum, scanSnapshot);
+        bufMgr->readPage(file, currentPageNum, currentPageData);
+        // Reset nextEntry
+        nextEntry = 0;
+    }
+
+    // the last leaf has been scanned to its end
+    if (nextEntry >= leafSize(currentPageData))
     {
         bufMgr->unPinPage(file, currentPageNum, false);
+        currentPageData = nullptr;
         throw IndexScanCompletedException();
-	}
+    }
+
+    int val = leafKeyAt(currentPageData, nextEntry);
     
+	// Check if the key is in range
+  	if (val > highValInt || (val == highValInt && highOp == LT))
+    {
+        bufMgr->unPinPage(file, currentPageNum, false);
+        currentPageData = nullptr;
+        throw IndexScanCompletedException();
+	}
+
+    outRid = leafRidAt(currentPageData, nextEntry);
+    if (outPayload != nullptr && payloadSize > 0)
+    {
+        memcpy(outPayload, leafPayloadAt(currentPageData, nextEntry), payloadSize);
+    }
 	nextEntry++;
+}
 
-    // if the scanner reach to the end of this page
-    if (nextEntry == INTARRAYLEAFSIZE || currentNode->ridArray[nextEntry].page_number == 0)
+const void BTreeIndex::scanNextLeaf(std::vector<RecordId> &outRids, const KeyPredicate &predicate)
+{
+    std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+    EpochGuard guard(epochs);
+    if (!scanExecuting)
     {
-        // No more next leaf
-        if (currentNode->rightSibPageNo == 0)
+        throw ScanNotInitializedException();
+    }
+
+    int keys[MAXLEAFENTRIES];
+    int selection[MAXLEAFENTRIES];
+    outRids.clear();
+    while (outRids.empty())
+    {
+        if (currentPageData == nullptr)
         {
-        	bufMgr->unPinPage(file, currentPageNum, false);
             throw IndexScanCompletedException();
         }
-        // Unpin page and read next page
-        PageId nextPageNum = currentNode->rightSibPageNo;
-        bufMgr->unPinPage(file, currentPageNum, false);
-		currentPageNum = nextPageNum;
-        bufMgr->readPage(file, currentPageNum, currentPageData);
-        currentNode = (LeafNodeInt *)currentPageData;
-        // Reset nextEntry
-        nextEntry = 0;
+        while (nextEntry >= leafSize(currentPageData) && leafRightSib(currentPageData) != 0)
+        {
+            PageId nextPageNum = leafRightSib(currentPageData);
+            bufMgr->unPinPage(file, currentPageNum, false);
+            currentPageNum = snapshotPage(nextPageNum, scanSnapshot);
+            bufMgr->readPage(file, currentPageNum, currentPageData);
+            nextEntry = 0;
+        }
+
+        // the keys of the rest of the leaf up to the high end of the range, which may end in this leaf
+        int n = leafSize(currentPageData);
+        int count = 0;
+        const int *leafKeys = keys;
+        if (isSlottedLeaf(currentPageData))
+        {
+            while (nextEntry + count < n)
+            {
+                int key = leafKeyAt(currentPageData, nextEntry + count);
+                if (key > highValInt || (key == highValInt && highOp == LT))
+                    break;
+                keys[count++] = key;
+            }
+        }
+        else
+        {
+            leafKeys = ((LeafNodeInt *)currentPageData)->keyArray + nextEntry;
+            while (nextEntry + count < n && (leafKeys[count] < highValInt || (leafKeys[count] == highValInt && highOp == LTE)))
+                count++;
+        }
+
+        int matches = filterKeys(leafKeys, count, predicate, selection);
+        for (int i = 0; i < matches; i++)
+        {
+            outRids.push_back(leafRidAt(currentPageData, nextEntry + selection[i]));
+        }
+        nextEntry += count;
+
+        // the range ends in this leaf or the leaf chain does
+        if (nextEntry < n || leafRightSib(currentPageData) == 0)
+        {
+            bufMgr->unPinPage(file, currentPageNum, false);
+            currentPageData = nullptr;
+            if (outRids.empty())
+                throw IndexScanCompletedException();
+            break;
+        }
     }
 }
 
@@ -635,16 +2545,998 @@ const void BTreeIndex::scanNext(RecordId& outRid)
 //
 const void BTreeIndex::endScan() 
 {
+	std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+	EpochGuard guard(epochs);
+	collectWrittenPages();
 	if (!scanExecuting)
   	{
     	throw ScanNotInitializedException();
   	}
 
+  	// release the page the scan stopped on
+  	if (currentPageData != nullptr)
+  	{
+  		bufMgr->unPinPage(file, currentPageNum, false);
+  	}
+
   	// reset the values
   	scanExecuting = false;
   	nextEntry = -1;
   	currentPageData = nullptr;
   	currentPageNum = 0;
+
+  	if (scanOwnsSnapshot)
+  	{
+  		releaseSnapshot(scanSnapshot);
+  	}
+}
+
+// -----------------------------------------------------------------------------
+// Parallel scans
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::splitRange(const BTreeScanRange &range, int parts, std::vector<BTreeScanRange> &ranges)
+{
+	if(range.lowOp != GT && range.lowOp != GTE) throw BadOpcodesException();
+	if(range.highOp != LT && range.highOp != LTE) throw BadOpcodesException();
+	if(range.lowVal > range.highVal) throw BadScanrangeException();
+
+	std::vector<int> separators;
+	{
+		std::lock_guard<std::recursive_mutex> lock(writeBackLatch);
+		EpochGuard guard(epochs);
+		//descend level by level through the nodes whose key range meets the range until they hold enough separators
+		std::vector<PageId> level(1, rootPageNum);
+		bool leaves = false;
+		while(parts > 1 && !leaves && (int)separators.size() < parts * SEPARATORSPERPART)
+		{
+			std::vector<PageId> next;
+			for(size_t i = 0; i < level.size(); i++)
+			{
+				Page *page;
+				bufMgr->readPage(file, level[i], page);
+				if(isLeaf(page))
+				{
+					bufMgr->unPinPage(file, level[i], false);
+					leaves = true;
+					break;
+				}
+				NonLeafNodeInt *node = (NonLeafNodeInt *)page;
+				//the sons of the level above the leaves are not read
+				leaves = node->level == 1;
+				int n = nonLeafKeyCount(node);
+				for(int j = 0; j <= n; j++)
+				{
+					//son j holds the keys between keyArray[j-1] and keyArray[j]
+					if(j < n && node->keyArray[j] < range.lowVal)
+						continue;
+					if(j > 0 && node->keyArray[j-1] > range.highVal)
+						break;
+					next.push_back(node->pageNoArray[j]);
+					if(j < n && node->keyArray[j] > range.lowVal && node->keyArray[j] <= range.highVal)
+						separators.push_back(node->keyArray[j]);
+				}
+				bufMgr->unPinPage(file, level[i], false);
+			}
+			level.swap(next);
+		}
+	}
+	std::sort(separators.begin(), separators.end());
+	separators.erase(std::unique(separators.begin(), separators.end()), separators.end());
+
+	//pick evenly spaced separators as the bounds of the parts
+	ranges.clear();
+	BTreeScanRange part = range;
+	int count = std::min(parts - 1, (int)separators.size());
+	for(int i = 1; i <= count; i++)
+	{
+		int separator = separators[(size_t)i * separators.size() / (count + 1)];
+		part.highVal = separator;
+		part.highOp = LT;
+		ranges.push_back(part);
+		part.lowVal = separator;
+		part.lowOp = GTE;
+	}
+	part.highVal = range.highVal;
+	part.highOp = range.highOp;
+	ranges.push_back(part);
+}
+
+void BTreeIndex::parallelScan(const BTreeScanRange &range, int workers,
+		const std::function<void(int part, int key, RecordId rid)> &visit)
+{
+	std::vector<BTreeScanRange> ranges;
+	splitRange(range, workers, ranges);
+	BTreeSnapshot snapshot = takeSnapshot();
+	std::vector<std::thread> threads;
+	std::vector<std::exception_ptr> errors(ranges.size());
+	for(size_t i = 0; i < ranges.size(); i++)
+	{
+		threads.push_back(std::thread([this, &ranges, &snapshot, &visit, &errors, i]()
+		{
+			try
+			{
+				BTreeRangeCursor cursor(*this, ranges[i], snapshot);
+				int key;
+				RecordId rid;
+				while(cursor.next(key, rid))
+				{
+					visit(i, key, rid);
+				}
+			}
+			catch(...)
+			{
+				errors[i] = std::current_exception();
+			}
+		}));
+	}
+	for(size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+	releaseSnapshot(snapshot);
+	for(size_t i = 0; i < errors.size(); i++)
+	{
+		if(errors[i])
+			std::rethrow_exception(errors[i]);
+	}
+}
+
+void BTreeIndex::parallelScan(const BTreeScanRange &range, int workers, std::vector<RecordId> &rids)
+{
+	//every part is filled by its own thread only
+	std::vector<std::vector<RecordId> > parts(std::max(workers, 1));
+	parallelScan(range, workers, [&parts](int part, int /*key*/, RecordId rid)
+	{
+		parts[part].push_back(rid);
+	});
+	rids.clear();
+	for(size_t i = 0; i < parts.size(); i++)
+	{
+		rids.insert(rids.end(), parts[i].begin(), parts[i].end());
+	}
+}
+
+BTreeRangeCursor::BTreeRangeCursor(BTreeIndex &indexIn, const BTreeScanRange &rangeIn, const BTreeSnapshot &snapshotIn)
+	: index(indexIn), range(rangeIn), snapshot(snapshotIn), nextEntry(0), nextPageNo(0), descents(0)
+{
+	//start from the leaf that may hold the low value, as startScan() does
+	index.clipExpired(range);
+	descend(range.lowVal);
+	readLeaf();
+}
+
+void BTreeRangeCursor::descend(int key)
+{
+	std::lock_guard<std::recursive_mutex> lock(index.writeBackLatch);
+	EpochGuard guard(index.epochs);
+	descents++;
+	PageId pageNo = snapshot.rootPageNo;
+	while(true)
+	{
+		PageId physicalPageNo = index.snapshotPage(pageNo, snapshot);
+		Page *page;
+		index.bufMgr->readPage(index.file, physicalPageNo, page);
+		if(BTreeIndex::isLeaf(page))
+		{
+			index.bufMgr->unPinPage(index.file, physicalPageNo, false);
+			break;
+		}
+		NonLeafNodeInt *node = (NonLeafNodeInt *)page;
+		pageNo = node->pageNoArray[BTreeIndex::findNonLeafIndex(node, key)];
+		index.bufMgr->unPinPage(index.file, physicalPageNo, false);
+	}
+	nextPageNo = pageNo;
+}
+
+void BTreeRangeCursor::readLeaf()
+{
+	std::lock_guard<std::recursive_mutex> lock(index.writeBackLatch);
+	EpochGuard guard(index.epochs);
+	entries.clear();
+	nextEntry = 0;
+	PageId physicalPageNo = index.snapshotPage(nextPageNo, snapshot);
+	Page *page;
+	index.bufMgr->readPage(index.file, physicalPageNo, page);
+	nextPageNo = BTreeIndex::leafRightSib(page);
+	int n = BTreeIndex::leafSize(page);
+	for(int i = 0; i < n; i++)
+	{
+		int key = BTreeIndex::leafKeyAt(page, i);
+		if(key < range.lowVal || (key == range.lowVal && range.lowOp == GT))
+			continue;
+		if(key > range.highVal || (key == range.highVal && range.highOp == LT))
+		{
+			nextPageNo = 0;
+			break;
+		}
+		RIDKeyPair<int> pair;
+		pair.set(BTreeIndex::leafRidAt(page, i), key);
+		entries.push_back(pair);
+	}
+	index.bufMgr->unPinPage(index.file, physicalPageNo, false);
+}
+
+bool BTreeRangeCursor::next(int &key, RecordId &rid)
+{
+	while(nextEntry == entries.size())
+	{
+		if(nextPageNo == 0)
+			return false;
+		readLeaf();
+	}
+	key = entries[nextEntry].key;
+	rid = entries[nextEntry].rid;
+	nextEntry++;
+	return true;
+}
+
+bool BTreeRangeCursor::seek(int target, int &key, RecordId &rid)
+{
+	if(entries.empty() || entries.back().key < target)
+	{
+		if(nextPageNo == 0)
+		{
+			nextEntry = entries.size();
+			return false;
+		}
+		//the right sibling is read anyway if the target is close
+		readLeaf();
+		if(nextPageNo != 0 && (entries.empty() || entries.back().key < target))
+		{
+			if(target > range.highVal || (target == range.highVal && range.highOp == LT))
+			{
+				entries.clear();
+				nextEntry = 0;
+				nextPageNo = 0;
+				return false;
+			}
+			descend(target);
+			readLeaf();
+		}
+	}
+
+	//skip the entries of the leaf below the target, the leaf found by a descent may hold none of them
+	nextEntry = std::lower_bound(entries.begin() + nextEntry, entries.end(), target,
+		[](const RIDKeyPair<int> &entry, int value) { return entry.key < value; }) - entries.begin();
+	while(next(key, rid))
+	{
+		if(key >= target)
+			return true;
+	}
+	return false;
+}
+
+int BTreeRangeCursor::getDescents() const
+{
+	return descents;
+}
+
+// -----------------------------------------------------------------------------
+// Probe cursor
+// -----------------------------------------------------------------------------
+
+BTreeProbeCursor::BTreeProbeCursor(BTreeIndex &indexIn, const BTreeSnapshot &snapshotIn)
+	: index(indexIn), snapshot(snapshotIn), leafPageNo(0), rightSibPageNo(0),
+	hasLow(false), lowBound(0), hasHigh(false), highBound(0), descents(0), leafReads(0)
+{
+}
+
+void BTreeProbeCursor::readLeaf(PageId pageNo)
+{
+	std::lock_guard<std::recursive_mutex> lock(index.writeBackLatch);
+	EpochGuard guard(index.epochs);
+	leafReads++;
+	entries.clear();
+	PageId physicalPageNo = index.snapshotPage(pageNo, snapshot);
+	Page *page;
+	index.bufMgr->readPage(index.file, physicalPageNo, page);
+	int n = BTreeIndex::leafSize(page);
+	for(int i = 0; i < n; i++)
+	{
+		RIDKeyPair<int> pair;
+		pair.set(BTreeIndex::leafRidAt(page, i), BTreeIndex::leafKeyAt(page, i));
+		entries.push_back(pair);
+	}
+	leafPageNo = pageNo;
+	rightSibPageNo = BTreeIndex::leafRightSib(page);
+	index.bufMgr->unPinPage(index.file, physicalPageNo, false);
+}
+
+void BTreeProbeCursor::descend(int key)
+{
+	std::lock_guard<std::recursive_mutex> lock(index.writeBackLatch);
+	EpochGuard guard(index.epochs);
+	descents++;
+	hasLow = false;
+	hasHigh = false;
+	PageId pageNo = snapshot.rootPageNo;
+	while(true)
+	{
+		PageId physicalPageNo = index.snapshotPage(pageNo, snapshot);
+		Page *page;
+		index.bufMgr->readPage(index.file, physicalPageNo, page);
+		if(BTreeIndex::isLeaf(page))
+		{
+			index.bufMgr->unPinPage(index.file, physicalPageNo, false);
+			break;
+		}
+		//child i holds the keys in (keyArray[i-1], keyArray[i]], the deeper separators are the tighter ones
+		NonLeafNodeInt *node = (NonLeafNodeInt *)page;
+		int i = BTreeIndex::findNonLeafIndex(node, key);
+		if(i > 0)
+		{
+			hasLow = true;
+			lowBound = node->keyArray[i-1];
+		}
+		if(i < INTARRAYNONLEAFSIZE && node->pageNoArray[i+1] != 0)
+		{
+			hasHigh = true;
+			highBound = node->keyArray[i];
+		}
+		pageNo = node->pageNoArray[i];
+		index.bufMgr->unPinPage(index.file, physicalPageNo, false);
+	}
+	readLeaf(pageNo);
+}
+
+bool BTreeProbeCursor::covers(int key) const
+{
+	return leafPageNo != 0 && (!hasLow || key > lowBound) && (!hasHigh || key <= highBound);
+}
+
+void BTreeProbeCursor::moveRight()
+{
+	hasLow = true;
+	lowBound = highBound;
+	readLeaf(rightSibPageNo);
+	if(rightSibPageNo == 0)
+		hasHigh = false;
+	else if(!entries.empty())
+		highBound = entries.back().key;
+}
+
+void BTreeProbeCursor::collect(int key, std::vector<RecordId> &rids)
+{
+	std::vector<RIDKeyPair<int> >::iterator it = std::lower_bound(entries.begin(), entries.end(), key,
+		[](const RIDKeyPair<int> &entry, int value) { return entry.key < value; });
+	for(; it != entries.end() && it->key == key; ++it)
+	{
+		rids.push_back(it->rid);
+	}
+}
+
+int BTreeProbeCursor::probe(int key, std::vector<RecordId> &rids)
+{
+	rids.clear();
+	if(key < index.getExpiryWatermark())
+		return 0;
+	if(!covers(key))
+	{
+		//a key just past the current leaf is in its right sibling
+		if(leafPageNo != 0 && hasHigh && key > highBound && rightSibPageNo != 0)
+			moveRight();
+		if(!covers(key))
+			descend(key);
+	}
+	collect(key, rids);
+
+	//a key equal to the high bound may have entries in the following leaves as well, since a split
+	//separates the leaves at the first key of the right one and later inserts of that key go left
+	while(hasHigh && key == highBound && rightSibPageNo != 0)
+	{
+		moveRight();
+		collect(key, rids);
+	}
+	return rids.size();
+}
+
+int BTreeProbeCursor::getDescents() const
+{
+	return descents;
+}
+
+int BTreeProbeCursor::getLeafReads() const
+{
+	return leafReads;
+}
+
+// -----------------------------------------------------------------------------
+// Merge join
+// -----------------------------------------------------------------------------
+
+BTreeMergeJoin::BTreeMergeJoin(BTreeIndex &leftIn, BTreeIndex &rightIn, const BTreeScanRange &range)
+	: leftSnapshot(leftIn), rightSnapshot(rightIn), left(leftIn, range, leftSnapshot.snapshot),
+	right(rightIn, range, rightSnapshot.snapshot), inGroup(false), groupKey(0), groupPos(0)
+{
+	leftValid = left.next(leftKey, leftRid);
+	rightValid = right.next(rightKey, rightRid);
+}
+
+bool BTreeMergeJoin::nextBatch(std::vector<std::pair<RecordId, RecordId> > &pairs, size_t maxPairs)
+{
+	pairs.clear();
+	while(pairs.size() < maxPairs)
+	{
+		if(inGroup)
+		{
+			//pair the current left entry with the right entries of its key
+			while(groupPos < group.size() && pairs.size() < maxPairs)
+			{
+				pairs.push_back(std::make_pair(leftRid, group[groupPos++]));
+			}
+			if(groupPos < group.size())
+				break;
+			leftValid = left.next(leftKey, leftRid);
+			groupPos = 0;
+			inGroup = leftValid && leftKey == groupKey;
+			continue;
+		}
+		if(!leftValid || !rightValid)
+			break;
+
+		if(leftKey < rightKey)
+		{
+			leftValid = left.seek(rightKey, leftKey, leftRid);
+		}
+		else if(rightKey < leftKey)
+		{
+			rightValid = right.seek(leftKey, rightKey, rightRid);
+		}
+		else
+		{
+			//the right entries of the key, every left entry of the key is paired with all of them
+			groupKey = rightKey;
+			group.clear();
+			while(rightValid && rightKey == groupKey)
+			{
+				group.push_back(rightRid);
+				rightValid = right.next(rightKey, rightRid);
+			}
+			groupPos = 0;
+			inGroup = true;
+		}
+	}
+	return !pairs.empty();
+}
+
+int BTreeMergeJoin::getDescents() const
+{
+	return left.getDescents() + right.getDescents();
+}
+
+// -----------------------------------------------------------------------------
+// Forest
+// -----------------------------------------------------------------------------
+
+BTreeForest::BTreeForest(const std::string &relationNameIn, int attrByteOffsetIn, Datatype attrTypeIn,
+		const std::vector<int> &boundaries, int bufferPagesIn, const BTreeIndexOptions &optionsIn, NumaPlacement placementIn)
+	: relationName(relationNameIn), attrByteOffset(attrByteOffsetIn), attrType(attrTypeIn), bufferPages(bufferPagesIn),
+	options(optionsIn), placement(placementIn)
+{
+	bool exists = File::exists(partitionName(0));
+	if(!exists)
+	{
+		for(size_t i = 1; i < boundaries.size(); i++)
+		{
+			if(boundaries[i] <= boundaries[i - 1])
+				throw BadIndexInfoException("the boundaries of the forest partitions are not increasing");
+		}
+		if(!boundaries.empty() && boundaries[0] == INT_MIN)
+			throw BadIndexInfoException("the first forest partition would be empty");
+	}
+
+	try
+	{
+		if(exists)
+		{
+			//an existing forest is routed by the key ranges recorded in its partitions
+			for(int i = 0; File::exists(partitionName(i)); i++)
+			{
+				openPartition(i, 0, 0, false);
+				int low;
+				int high;
+				partitions[i]->getKeyRange(low, high);
+				lowKeys.push_back(low);
+			}
+		}
+		else
+		{
+			lowKeys.push_back(INT_MIN);
+			lowKeys.insert(lowKeys.end(), boundaries.begin(), boundaries.end());
+			for(size_t i = 0; i < lowKeys.size(); i++)
+			{
+				int high = i + 1 < lowKeys.size() ? lowKeys[i + 1] - 1 : INT_MAX;
+				openPartition(i, lowKeys[i], high, false);
+			}
+		}
+		//the partitions are opened empty of new records and filled from one read of the relation
+		BTreeIndex::indexAppendedRecords(relationName, partitions, [this](int key) { return route(key); });
+	}
+	catch(...)
+	{
+		for(size_t i = 0; i < partitions.size(); i++)
+		{
+			closePartition(i);
+		}
+		throw;
+	}
+}
+
+BTreeForest::~BTreeForest()
+{
+	for(size_t i = 0; i < partitions.size(); i++)
+	{
+		closePartition(i);
+	}
+}
+
+std::string BTreeForest::partitionName(int i) const
+{
+	std::ostringstream name;
+	name << relationName << '.' << attrByteOffset << '.' << i;
+	return name.str();
+}
+
+void BTreeForest::openPartition(int i, int low, int high, bool indexRelation)
+{
+	if(partitions.size() <= (size_t)i)
+	{
+		partitions.resize(i + 1, nullptr);
+		bufMgrs.resize(i + 1, nullptr);
+		indexNames.resize(i + 1);
+	}
+	BTreeIndexOptions partitionOptions = options;
+	partitionOptions.indexName = partitionName(i);
+	partitionOptions.hasKeyRange = true;
+	partitionOptions.keyRangeLow = low;
+	partitionOptions.keyRangeHigh = high;
+	partitionOptions.indexRelation = indexRelation;
+	//the buffer pool lives where the thread that allocates it runs
+	NumaTopology::system().runPlaced(i, placement, [this, i, &partitionOptions]()
+	{
+		bufMgrs[i] = new BufMgr(bufferPages);
+		try
+		{
+			partitions[i] = new BTreeIndex(relationName, indexNames[i], bufMgrs[i], attrByteOffset, attrType, partitionOptions);
+		}
+		catch(...)
+		{
+			delete bufMgrs[i];
+			bufMgrs[i] = nullptr;
+			throw;
+		}
+	});
+}
+
+void BTreeForest::closePartition(int i)
+{
+	//the index writes its pages before its buffer manager goes away
+	delete partitions[i];
+	partitions[i] = nullptr;
+	delete bufMgrs[i];
+	bufMgrs[i] = nullptr;
+}
+
+int BTreeForest::partitionCount() const
+{
+	return partitions.size();
+}
+
+int BTreeForest::route(int key) const
+{
+	return std::upper_bound(lowKeys.begin(), lowKeys.end(), key) - lowKeys.begin() - 1;
+}
+
+BTreeIndex &BTreeForest::partition(int i)
+{
+	return *partitions[i];
+}
+
+InsertStatus BTreeForest::insertEntry(const void *key, const RecordId rid, const char *payload)
+{
+	return partitions[route(*(int *)key)]->insertEntry(key, rid, payload);
+}
+
+InsertStatus BTreeForest::insertRecord(const std::string &record, const RecordId rid)
+{
+	int key = *((int *)(record.c_str() + attrByteOffset));
+	return partitions[route(key)]->insertRecord(record, rid);
+}
+
+void BTreeForest::scan(const BTreeScanRange &range, std::vector<RecordId> &rids)
+{
+	if(range.lowOp != GT && range.lowOp != GTE) throw BadOpcodesException();
+	if(range.highOp != LT && range.highOp != LTE) throw BadOpcodesException();
+	if(range.lowVal > range.highVal) throw BadScanrangeException();
+
+	rids.clear();
+	int last = route(range.highVal);
+	for(int i = route(range.lowVal); i <= last; i++)
+	{
+		BTreeIndex &index = *partitions[i];
+		BTreeSnapshot snapshot = index.takeSnapshot();
+		{
+			BTreeRangeCursor cursor(index, range, snapshot);
+			int key;
+			RecordId rid;
+			while(cursor.next(key, rid))
+			{
+				rids.push_back(rid);
+			}
+		}
+		index.releaseSnapshot(snapshot);
+	}
+}
+
+void BTreeForest::parallelFor(const std::function<void(int part, BTreeIndex &index)> &task)
+{
+	std::vector<std::thread> threads;
+	std::vector<std::exception_ptr> errors(partitions.size());
+	for(size_t i = 0; i < partitions.size(); i++)
+	{
+		threads.push_back(std::thread([this, &task, &errors, i]()
+		{
+			NumaTopology::system().placeThread(i, placement);
+			try
+			{
+				task(i, *partitions[i]);
+			}
+			catch(...)
+			{
+				errors[i] = std::current_exception();
+			}
+		}));
+	}
+	for(size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+	for(size_t i = 0; i < errors.size(); i++)
+	{
+		if(errors[i])
+			std::rethrow_exception(errors[i]);
+	}
+}
+
+void BTreeForest::flush()
+{
+	parallelFor([](int /*part*/, BTreeIndex &index)
+	{
+		index.flush();
+	});
+}
+
+void BTreeForest::compact(float fillFactor)
+{
+	parallelFor([fillFactor](int /*part*/, BTreeIndex &index)
+	{
+		index.compact(fillFactor);
+	});
+}
+
+void BTreeForest::rebuildPartition(int i)
+{
+	int low;
+	int high;
+	partitions[i]->getKeyRange(low, high);
+	closePartition(i);
+	File::remove(indexNames[i]);
+	openPartition(i, low, high, true);
+}
+
+int BTreeForest::dropPartition(int i)
+{
+	int low;
+	int high;
+	partitions[i]->getKeyRange(low, high);
+	return partitions[i]->deleteRange(&low, GTE, &high, LTE);
+}
+
+// -----------------------------------------------------------------------------
+// Sharded index
+// -----------------------------------------------------------------------------
+
+BTreeShardedIndex::BTreeShardedIndex(const std::string &relationNameIn, int attrByteOffsetIn, Datatype attrType,
+		int shardCountIn, int bufferPages, const BTreeIndexOptions &options, NumaPlacement placementIn)
+	: relationName(relationNameIn), attrByteOffset(attrByteOffsetIn), placement(placementIn)
+{
+	//an existing index keeps the number of shards it was created with
+	int count = 0;
+	while(File::exists(shardName(count)))
+		count++;
+	if(count == 0)
+		count = shardCountIn;
+	if(count < 1)
+		throw BadIndexInfoException("a sharded index needs at least one shard");
+	if(!options.includedColumns.empty())
+		throw BadIndexInfoException("a sharded index cannot have included columns");
+	//the writers insert with insertEntry(), which applies neither a predicate nor a key range
+	if(options.predicate.enabled || options.hasKeyRange)
+		throw BadIndexInfoException("a sharded index cannot have a predicate or a key range");
+
+	shards.resize(count, nullptr);
+	bufMgrs.resize(count, nullptr);
+	try
+	{
+		for(int i = 0; i < count; i++)
+		{
+			BTreeIndexOptions shardOptions = options;
+			shardOptions.indexName = shardName(i);
+			shardOptions.shardCount = count;
+			shardOptions.shardId = i;
+			shardOptions.indexRelation = false;
+			//the buffer pool lives where the thread that allocates it runs
+			NumaTopology::system().runPlaced(i, placement, [this, i, bufferPages, attrType, &shardOptions]()
+			{
+				bufMgrs[i] = new BufMgr(bufferPages);
+				std::string indexName;
+				shards[i] = new BTreeIndex(relationName, indexName, bufMgrs[i], attrByteOffset, attrType, shardOptions);
+			});
+			//the writers insert bare <key, record id> pairs, which would leave the included columns zero
+			if(shards[i]->getPayloadSize() > 0)
+				throw BadIndexInfoException("a sharded index cannot have included columns");
+		}
+		//the shards are opened empty of new records and filled from one read of the relation
+		BTreeIndex::indexAppendedRecords(relationName, shards, [count](int key) { return BTreeIndex::hashShard(key, count); });
+	}
+	catch(...)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			delete shards[i];
+			delete bufMgrs[i];
+		}
+		throw;
+	}
+	//the writers read the vectors, which must not grow anymore once they run
+	for(int i = 0; i < count; i++)
+	{
+		writers.push_back(new ShardWriter());
+	}
+	for(int i = 0; i < count; i++)
+	{
+		writers[i]->thread = std::thread(&BTreeShardedIndex::writeLoop, this, i);
+	}
+}
+
+BTreeShardedIndex::~BTreeShardedIndex()
+{
+	try
+	{
+		drain();
+	}
+	catch(...)
+	{
+	}
+	for(size_t i = 0; i < writers.size(); i++)
+	{
+		{
+			std::lock_guard<std::mutex> lock(writers[i]->latch);
+			writers[i]->stopping = true;
+		}
+		writers[i]->wake.notify_one();
+		writers[i]->thread.join();
+		delete writers[i];
+		//the index writes its pages before its buffer manager goes away
+		delete shards[i];
+		delete bufMgrs[i];
+	}
+}
+
+std::string BTreeShardedIndex::shardName(int i) const
+{
+	std::ostringstream name;
+	name << relationName << '.' << attrByteOffset << ".s" << i;
+	return name.str();
+}
+
+int BTreeShardedIndex::shardCount() const
+{
+	return shards.size();
+}
+
+BTreeIndex &BTreeShardedIndex::shard(int i)
+{
+	return *shards[i];
+}
+
+int BTreeShardedIndex::route(int key) const
+{
+	return BTreeIndex::hashShard(key, shards.size());
+}
+
+void BTreeShardedIndex::writeLoop(int i)
+{
+	NumaTopology::system().placeThread(i, placement);
+	ShardWriter &writer = *writers[i];
+	BTreeIndex &index = *shards[i];
+	std::unique_lock<std::mutex> lock(writer.latch);
+	while(true)
+	{
+		writer.wake.wait(lock, [&writer]() { return !writer.batches.empty() || writer.stopping; });
+		if(writer.batches.empty())
+			break;
+		std::vector<std::vector<RIDKeyPair<int> > > work;
+		work.swap(writer.batches);
+		writer.busy = true;
+		lock.unlock();
+		long long statuses[EXPIRED + 1] = {0};
+		try
+		{
+			for(size_t b = 0; b < work.size(); b++)
+			{
+				for(size_t e = 0; e < work[b].size(); e++)
+				{
+					statuses[index.insertEntry(&work[b][e].key, work[b][e].rid)]++;
+				}
+			}
+		}
+		catch(...)
+		{
+			lock.lock();
+			if(!writer.error)
+				writer.error = std::current_exception();
+			lock.unlock();
+		}
+		lock.lock();
+		writer.stats.inserted += statuses[INSERTED];
+		writer.stats.duplicateKeys += statuses[DUPLICATE_KEY];
+		writer.stats.expired += statuses[EXPIRED];
+		writer.busy = false;
+		if(writer.batches.empty())
+			writer.idle.notify_all();
+	}
+}
+
+void BTreeShardedIndex::submit(int i, std::vector<RIDKeyPair<int> > &batch)
+{
+	std::sort(batch.begin(), batch.end(), [](const RIDKeyPair<int> &a, const RIDKeyPair<int> &b) { return a.key < b.key; });
+	ShardWriter &writer = *writers[i];
+	{
+		std::lock_guard<std::mutex> lock(writer.latch);
+		writer.batches.push_back(std::vector<RIDKeyPair<int> >());
+		writer.batches.back().swap(batch);
+	}
+	writer.wake.notify_one();
+}
+
+void BTreeShardedIndex::insertEntry(int key, const RecordId rid)
+{
+	int i = route(key);
+	std::vector<RIDKeyPair<int> > &pending = writers[i]->pending;
+	RIDKeyPair<int> entry;
+	entry.set(rid, key);
+	pending.push_back(entry);
+	if(pending.size() == (size_t)SHARDBATCHSIZE)
+		submit(i, pending);
+}
+
+void BTreeShardedIndex::insertBatch(const std::vector<RIDKeyPair<int> > &entries)
+{
+	std::vector<std::vector<RIDKeyPair<int> > > parts(shards.size());
+	for(size_t e = 0; e < entries.size(); e++)
+	{
+		parts[route(entries[e].key)].push_back(entries[e]);
+	}
+	for(size_t i = 0; i < parts.size(); i++)
+	{
+		if(!parts[i].empty())
+			submit(i, parts[i]);
+	}
+}
+
+void BTreeShardedIndex::drain()
+{
+	BTreeShardedInsertStats stats;
+	drain(stats);
+}
+
+void BTreeShardedIndex::drain(BTreeShardedInsertStats &stats)
+{
+	stats = BTreeShardedInsertStats();
+	for(size_t i = 0; i < writers.size(); i++)
+	{
+		if(!writers[i]->pending.empty())
+			submit(i, writers[i]->pending);
+	}
+	std::exception_ptr error;
+	for(size_t i = 0; i < writers.size(); i++)
+	{
+		ShardWriter &writer = *writers[i];
+		std::unique_lock<std::mutex> lock(writer.latch);
+		writer.idle.wait(lock, [&writer]() { return writer.batches.empty() && !writer.busy; });
+		if(writer.error && !error)
+			error = writer.error;
+		writer.error = nullptr;
+		stats.inserted += writer.stats.inserted;
+		stats.duplicateKeys += writer.stats.duplicateKeys;
+		stats.expired += writer.stats.expired;
+		writer.stats = BTreeShardedInsertStats();
+	}
+	if(error)
+		std::rethrow_exception(error);
+}
+
+int BTreeShardedIndex::lookup(int key, std::vector<RecordId> &rids)
+{
+	BTreeIndex &index = *shards[route(key)];
+	BTreeSnapshot snapshot = index.takeSnapshot();
+	int found;
+	{
+		BTreeProbeCursor cursor(index, snapshot);
+		found = cursor.probe(key, rids);
+	}
+	index.releaseSnapshot(snapshot);
+	return found;
+}
+
+void BTreeShardedIndex::scan(const BTreeScanRange &range, std::vector<RecordId> &rids)
+{
+	if(range.lowOp != GT && range.lowOp != GTE) throw BadOpcodesException();
+	if(range.highOp != LT && range.highOp != LTE) throw BadOpcodesException();
+	if(range.lowVal > range.highVal) throw BadScanrangeException();
+
+	//fan out: every shard returns its entries of the range in key order
+	std::vector<std::vector<RIDKeyPair<int> > > parts(shards.size());
+	std::vector<std::exception_ptr> errors(shards.size());
+	std::vector<std::thread> threads;
+	for(size_t i = 0; i < shards.size(); i++)
+	{
+		threads.push_back(std::thread([this, &range, &parts, &errors, i]()
+		{
+			NumaTopology::system().placeThread(i, placement);
+			try
+			{
+				BTreeIndex &index = *shards[i];
+				BTreeSnapshot snapshot = index.takeSnapshot();
+				{
+					BTreeRangeCursor cursor(index, range, snapshot);
+					RIDKeyPair<int> entry;
+					while(cursor.next(entry.key, entry.rid))
+					{
+						parts[i].push_back(entry);
+					}
+				}
+				index.releaseSnapshot(snapshot);
+			}
+			catch(...)
+			{
+				errors[i] = std::current_exception();
+			}
+		}));
+	}
+	for(size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+	for(size_t i = 0; i < errors.size(); i++)
+	{
+		if(errors[i])
+			std::rethrow_exception(errors[i]);
+	}
+
+	//merge: a heap holds the next key of every shard that has entries left
+	typedef std::pair<int, size_t> HeadEntry;
+	std::priority_queue<HeadEntry, std::vector<HeadEntry>, std::greater<HeadEntry> > heads;
+	std::vector<size_t> positions(parts.size(), 0);
+	size_t total = 0;
+	for(size_t i = 0; i < parts.size(); i++)
+	{
+		total += parts[i].size();
+		if(!parts[i].empty())
+			heads.push(HeadEntry(parts[i][0].key, i));
+	}
+	rids.clear();
+	rids.reserve(total);
+	while(!heads.empty())
+	{
+		size_t i = heads.top().second;
+		heads.pop();
+		rids.push_back(parts[i][positions[i]].rid);
+		if(++positions[i] < parts[i].size())
+			heads.push(HeadEntry(parts[i][positions[i]].key, i));
+	}
 }
 
 }
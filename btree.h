@@ -11,11 +11,22 @@
 #include <string>
 #include "string.h"
 #include <sstream>
+#include <vector>
+#include <set>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <cstdint>
 
 #include "types.h"
 #include "page.h"
 #include "file.h"
 #include "buffer.h"
+#include "epoch.h"
+#include "numa.h"
 
 namespace badgerdb
 {
@@ -30,6 +41,15 @@ enum Datatype
     STRING = 2
 };
 
+/**
+ * @brief Leaf page formats. Chosen when the index file is created and recorded in the meta page.
+ */
+enum LeafFormat
+{
+    SORTED_LEAF = 0,    /* LeafNodeInt: keys and rids in sorted arrays */
+    SLOTTED_LEAF = 1    /* SlottedLeafNodeInt: sorted slot array over an unsorted entry heap */
+};
+
 /**
  * @brief Scan operations enumeration. Passed to BTreeIndex::startScan() method.
  */
@@ -41,6 +61,18 @@ enum Operator
     GT        /* Greater Than */
 };
 
+/**
+ * @brief Outcome of BTreeIndex::insertEntry(), insertRecord() and upsert().
+ */
+enum InsertStatus
+{
+    INSERTED = 0,       /* a new entry was added */
+    DUPLICATE_KEY = 1,  /* a unique index already holds the key, nothing was changed */
+    REPLACED = 2,       /* upsert() found the key and overwrote the record id of its entry */
+    EXCLUDED = 3,       /* the record does not satisfy the predicate of a partial index */
+    EXPIRED = 4         /* the key is below the expiry watermark, see BTreeIndex::setExpiryWatermark() */
+};
+
 
 /**
  * @brief Number of key slots in B+Tree leaf for INTEGER key.
@@ -54,6 +86,28 @@ const  int INTARRAYLEAFSIZE = ( Page::SIZE - sizeof( PageId ) ) / ( sizeof( int
 //                                                     level     extra pageNo                  key       pageNo
 const  int INTARRAYNONLEAFSIZE = ( Page::SIZE - sizeof( int ) - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( PageId ) );
 
+/**
+ * @brief Number of slots in a B+Tree slotted leaf for INTEGER key.
+ */
+//                                                       level            sibling ptr       numSlots, heapOffset, entrySize, deadBytes              slot                       key             rid
+const  int SLOTTEDLEAFSIZE = ( Page::SIZE - sizeof( int ) - sizeof( PageId ) - 4 * sizeof( std::uint16_t ) ) / ( sizeof( std::uint16_t ) + sizeof( int ) + sizeof( RecordId ) );
+
+/**
+ * @brief Value of the level member that marks a slotted leaf. Sorted leaves use -1.
+ */
+const  int SLOTTEDLEAFLEVEL = -2;
+
+/**
+ * @brief Value of the level member that marks a free page of the index file.
+ */
+const  int FREEPAGELEVEL = -3;
+
+/**
+ * @brief Number of page numbers held by one page of the free page list.
+ */
+//                                                  level            next page        numPages
+const  int FREELISTSIZE = ( Page::SIZE - sizeof( int ) - sizeof( PageId ) - sizeof( int ) ) / sizeof( PageId );
+
 /**
  * @brief Structure to store a key-rid pair. It is used to pass the pair to functions that
  * add to or make changes to the leaf node pages of the tree. Is templated for the key member.
@@ -100,6 +154,76 @@ bool operator<( const RIDKeyPair<T>& r1, const RIDKeyPair<T>& r2 )
         return r1.rid.page_number < r2.rid.page_number;
 }
 
+/**
+ * @brief Maximum number of included columns of a covering index.
+ */
+const int MAXINCLUDEDCOLUMNS = 4;
+
+/**
+ * @brief Maximum total size in bytes of the included columns of a covering index.
+ */
+const int MAXPAYLOADSIZE = 64;
+
+/**
+ * @brief A fixed-width attribute of the records stored in the leaf entries of a covering index.
+ */
+struct IncludedColumn{
+  /**
+   * Offset of the attribute inside the record.
+   */
+    int offset;
+
+  /**
+   * Size of the attribute in bytes.
+   */
+    int length;
+};
+
+/**
+ * @brief Predicate of a partial index: only the records whose attribute at offset compares to value
+ * with op are indexed.
+ */
+struct IndexPredicate{
+  /**
+   * False for an index of every record.
+   */
+    bool enabled;
+
+  /**
+   * Offset of the attribute inside the record.
+   */
+    int offset;
+
+  /**
+   * Type of the attribute, INTEGER or DOUBLE.
+   */
+    Datatype type;
+
+  /**
+   * Comparison of the attribute with value.
+   */
+    Operator op;
+
+  /**
+   * Value the attribute is compared to.
+   */
+    double value;
+
+    IndexPredicate() : enabled( false ), offset( 0 ), type( INTEGER ), op( GTE ), value( 0 ) {}
+};
+
+/**
+ * @brief Number of records of the relation collected, sorted by key and inserted together when building
+ * the index or catching up with records appended to the relation.
+ */
+const int CATCHUPBATCHSIZE = 10000;
+
+/**
+ * @brief Buffer frames the relation is read with when several indexes are filled from one read of it,
+ * one page is pinned at a time.
+ */
+const int CATCHUPSCANBUFFERPAGES = 2;
+
 /**
  * @brief The meta page, which holds metadata for Index file, is always first page of the btree index file and is cast
  * to the following structure to store or retrieve information from it.
@@ -128,6 +252,78 @@ struct IndexMetaInfo{
    * Page number of root page of the B+ Tree inside the file index file.
    */
     PageId rootPageNo;
+
+  /**
+   * Highest page number allocated in the index file. Lets tools read the file
+   * sequentially from the first page to this one without walking the tree.
+   */
+    PageId lastPageNo;
+
+  /**
+   * Format of the leaf pages.
+   */
+    LeafFormat leafFormat;
+
+  /**
+   * Page number of the first page of the free page list, 0 if no page is free.
+   */
+    PageId freeListPageNo;
+
+  /**
+   * Record id of the last record of the relation, in file scan order, that is in the index.
+   * Page number 0 if no record is. Records after it were appended since and are indexed on open.
+   */
+    RecordId lastIndexedRid;
+
+  /**
+   * Attributes stored in the leaf entries next to the record id, in payload order.
+   */
+    int numIncludedColumns;
+    IncludedColumn includedColumns[ MAXINCLUDEDCOLUMNS ];
+
+  /**
+   * Predicate of a partial index.
+   */
+    IndexPredicate predicate;
+
+  /**
+   * True if the index holds at most one entry per key.
+   */
+    bool unique;
+
+  /**
+   * Time to live of the keys, 0 for none.
+   */
+    int timeToLive;
+
+  /**
+   * True if expiryWatermark has been set. Index files written before the field existed read false.
+   */
+    bool hasExpiryWatermark;
+
+  /**
+   * Keys below this value are expired.
+   */
+    int expiryWatermark;
+
+  /**
+   * True if the index is a partition of a BTreeForest and holds the keys in [keyRangeLow, keyRangeHigh] only.
+   */
+    bool hasKeyRange;
+    int keyRangeLow;
+    int keyRangeHigh;
+
+  /**
+   * Number of shards of the BTreeShardedIndex the index belongs to, 0 for none, and the shard it is.
+   */
+    int shardCount;
+    int shardId;
+
+  /**
+   * True if lastIndexedRid is maintained. Index files written before the field existed read false, they predate
+   * the catch-up on open and are not caught up.
+   */
+    bool hasLastIndexedRid;
 };
 
 /*
@@ -183,291 +379,2051 @@ struct LeafNodeInt{
 
 
 /**
- * @brief BTreeIndex class. It implements a B+ Tree index on a single attribute of a
- * relation. This index supports only one scan at a time.
+ * @brief Structure for leaf nodes in the slotted format when the key is of INTEGER type.
+ * Entries are appended to a heap that grows down from the end of the page, in any key order.
+ * slotArray holds the byte offsets of the entries sorted by key, so an insert only shifts 2-byte slots.
+ * Removed entries leave dead bytes in the heap which are reclaimed by compacting the page when it runs out of room.
 */
-class BTreeIndex {
+struct SlottedLeafNodeInt{
+  /**
+   * Always SLOTTEDLEAFLEVEL.
+   */
+    int level;
 
- private:
+  /**
+   * Page number of the leaf on the right side.
+   */
+    PageId rightSibPageNo;
 
   /**
-   * File object for the index file.
+   * Number of entries in the leaf.
    */
-    File        *file;
+    std::uint16_t numSlots;
 
   /**
-   * Buffer Manager Instance.
+   * Byte offset in the page of the lowest entry of the heap.
    */
-    BufMgr    *bufMgr;
+    std::uint16_t heapOffset;
 
   /**
-   * Page number of meta page.
+   * Size in bytes of every heap entry.
    */
-    PageId    headerPageNum;
+    std::uint16_t entrySize;
 
   /**
-   * page number of root page of B+ tree inside index file.
+   * Bytes of the heap held by removed entries.
    */
-    PageId    rootPageNum;
+    std::uint16_t deadBytes;
 
   /**
-   * Datatype of attribute over which index is built.
+   * Byte offsets of the entries, sorted by key. The heap occupies the page after the used slots.
    */
-    Datatype    attributeType;
+    std::uint16_t slotArray[ SLOTTEDLEAFSIZE ];
+};
+
+/**
+ * @brief Layout of an entry in the heap of a SlottedLeafNodeInt.
+*/
+struct SlottedLeafEntry{
+    int key;
+    RecordId rid;
+};
 
+/**
+ * @brief Structure for the pages of the free page list. The list is a chain of free pages
+ * starting at IndexMetaInfo::freeListPageNo, each one holding the numbers of other free pages.
+*/
+struct FreePageList{
   /**
-   * Offset of attribute, over which index is built, inside records.
+   * Always FREEPAGELEVEL.
    */
-    int         attrByteOffset;
+    int level;
 
   /**
-   * Number of keys in leaf node, depending upon the type of key.
+   * Page number of the next page of the list, 0 at the end of the list.
    */
-    int            leafOccupancy;
+    PageId nextPageNo;
 
   /**
-   * Number of keys in non-leaf node, depending upon the type of key.
+   * Number of page numbers stored in this page.
    */
-    int            nodeOccupancy;
+    int numPages;
 
+  /**
+   * Free page numbers.
+   */
+    PageId pageNoArray[ FREELISTSIZE ];
+};
 
-    // MEMBERS SPECIFIC TO SCANNING
+/**
+ * @brief Write counters of an index, to measure write amplification. Multiplying the pages written back by the
+ * buffer manager by Page::SIZE and dividing by inserts gives the bytes written per logical insert.
+*/
+struct BTreeWriteStats{
+  /**
+   * Calls of insertEntry().
+   */
+    long long inserts;
 
   /**
-   * True if an index scan has been started.
+   * Pages unpinned as dirty, every one of them was modified. A page dirtied several times before it is
+   * written back is counted every time.
    */
-    bool        scanExecuting;
+    long long pagesDirtied;
 
   /**
-   * Index of next entry to be scanned in current leaf being scanned.
+   * Pages written to disk by the background writer.
    */
-    int            nextEntry;
+    long long pagesWrittenInBackground;
 
   /**
-   * Page number of current page being scanned.
+   * Pages written to disk by the index itself in the foreground: by flush(), when closing, or because the
+   * limit of dirty pages kept for the background writer was reached.
    */
-    PageId    currentPageNum;
+    long long pagesWrittenInForeground;
 
   /**
-   * Current Page being scanned.
+   * Expired entries removed from the leaves insertions went through.
    */
-    Page        *currentPageData;
+    long long entriesExpired;
 
   /**
-   * Low INTEGER value for scan.
+   * Pages of expired subtrees released after leaf splits, see BTreeIndex::setExpiryWatermark().
    */
-    int            lowValInt;
+    long long expiredPagesReleased;
+};
+
+/**
+ * @brief State of one BTreeIndex::deleteRange() pass over the tree, with the range made inclusive on both ends.
+*/
+struct RangeDeletion{
+    int low;
+    int high;
 
   /**
-   * Low DOUBLE value for scan.
+   * The first leaf reached, which holds every key below the range that is left. It is kept even when it
+   * becomes empty, so that it can be linked to nextLeaf.
    */
-    double    lowValDouble;
+    PageId firstLeaf;
 
   /**
-   * Low STRING value for scan.
+   * The first leaf after firstLeaf that is kept, 0 until one is found.
    */
-    std::string    lowValString;
+    PageId nextLeaf;
 
   /**
-   * High INTEGER value for scan.
+   * Pages taken out of the tree, released together at the end of the pass.
    */
-    int            highValInt;
+    std::vector<PageId> releasedPages;
+};
+
+/**
+ * @brief Interval in milliseconds between two rounds of the background writer.
+ */
+const int WRITEBACKINTERVAL = 10;
 
+/**
+ * @brief A modified page kept pinned until the background writer has written it to disk.
+*/
+struct DirtyIndexPage{
   /**
-   * High DOUBLE value for scan.
+   * The page in the buffer pool.
    */
-    double    highValDouble;
+    Page *page;
 
   /**
-   * High STRING value for scan.
+   * True once the page is on disk. It is unpinned by the next operation unless it was modified again.
    */
-    std::string highValString;
-    
+    bool written;
+};
+
+/**
+ * @brief Handle of a snapshot of the index, returned by BTreeIndex::takeSnapshot().
+ * A scan started on the snapshot sees the tree as it was when the snapshot was taken.
+*/
+struct BTreeSnapshot{
   /**
-   * Low Operator. Can only be GT(>) or GTE(>=).
+   * Snapshot epoch. Every snapshot starts a new epoch.
    */
-    Operator    lowOp;
+    int epoch;
 
   /**
-   * High Operator. Can only be LT(<) or LTE(<=).
+   * Page number of the root page when the snapshot was taken.
    */
-    Operator    highOp;
+    PageId rootPageNo;
+};
 
-    
- public:
+/**
+ * @brief A before-image of a page, saved by the first modification of the page after a snapshot.
+ * It is the content seen by the snapshots of the epochs up to epoch that are newer than the previous before-image.
+*/
+struct PageVersion{
+    int epoch;
+    PageId pageNo;
+};
 
+/**
+ * @brief Options of an index. The leaf format is recorded in the meta page of a new index file, an existing
+ * index file keeps its own; the write back options apply every time the index is opened.
+*/
+struct BTreeIndexOptions{
   /**
-   * BTreeIndex Constructor.
-     * Check to see if the corresponding index file exists. If so, open the file.
-     * If not, create it and insert entries for every tuple in the base relation using FileScan class.
-   *
-   * @param relationName        Name of file.
-   * @param outIndexName        Return the name of index file.
-   * @param bufMgrIn                        Buffer Manager Instance
-   * @param attrByteOffset            Offset of attribute, over which index is to be built, in the record
-   * @param attrType                        Datatype of attribute over which index is built
-   * @throws  BadIndexInfoException     If the index file already exists for the corresponding attribute, but values in metapage(relationName, attribute byte offset, attribute type etc.) do not match with values received through constructor parameters.
+   * Format of the leaf pages.
    */
-    BTreeIndex(const std::string & relationName, std::string & outIndexName,
-                        BufMgr *bufMgrIn,    const int attrByteOffset,    const Datatype attrType);
-    
+    LeafFormat leafFormat;
 
   /**
-   * BTreeIndex Destructor.
-     * End any initialized scan, flush index file, after unpinning any pinned pages, from the buffer manager
-     * and delete file instance thereby closing the index file.
-     * Destructor should not throw any exceptions. All exceptions should be caught in here itself.
-     * */
-    ~BTreeIndex();
+   * Pages per second the background writer writes to disk, in page number order. 0 leaves the dirty
+   * pages to the buffer manager, which writes them when they are evicted or the file is flushed.
+   */
+    int writeBackRate;
 
-    /**
-     *  BTreeIndex Internal Node Allocation function
-     *  @param &pageId the Page Id of the internal node
-     */
-    NonLeafNodeInt *allocNonLeaf(PageId &pageId);
-    
-    /**
-     * BtreeIndex Leaf Node Allocation function
-     * @param &pageId the Page Id of the leaf node
-     */
-    LeafNodeInt *allocLeaf(PageId &pageId);
-    
-    /**
-     * Insert a new node by using the key/rid pair
-     * Start from the root to recursively find the leaf to insert the node. If splitting occurs, we push up the midKey to its parents recursively and create a new Page.
-     *
-     * @param key the key to insert
-     * @param rid The record Id of the node to insert
-     * @param midKey the middle value to be pushed up if splitting needed
-     * @param pid the page Id of the node
-     * @param newSonPageId the page Id of the spllitting new node
-     * @return true if splitting happens, false otherwise
-     */
-    bool insertNode(int key, RecordId rid, int& midKey, PageId pid, PageId& newSonPageId);
-    
-    /**
-     * Inserts the < key,page number> pair into internal node
-     *
-     * @param key the key of the <key,page number> pair
-     * @param sonPid the page number of the <key,page number> pair
-     * @param pid the page Id of the node
-     * @param midKey the middle value to be pushed up if splitting needed
-     * @param newPid the page Id of the spllitting new node
-     * @return true if splitting happens, false otherwise
-     */
-    bool insertToNonLeafNode(int key, PageId sonPid, PageId pid, int& midKey, PageId& newPid);
-    
-    /**
-     * Inserts the <key,record id> pair into leaf node
-     *
-     * @param key the key of the <key,page number> pair
-     * @param rid the page number of the <key,page> number) pair
-     * @param pid the page Id of the node
-     * @param midKey the middle value to be pushed up if splitting needed
-     * @param newPid the page Id of the spllitting new node
-     * @return true if splitting happens, false otherwise
-     */
-    bool insertToLeaf(int key, RecordId rid, PageId pid, int& midKey, PageId& newPid);
-    
-    /**
-     * Split the internal node by the given index.
+  /**
+   * Maximum number of dirty pages kept pinned for the background writer. When it is reached the
+   * lowest numbered one is written in the foreground.
+   */
+    int maxDirtyPages;
+
+  /**
+   * Attributes to store in every leaf entry, so that scans can return them without reading the relation.
+   * An index with included columns always uses slotted leaves. Recorded in the meta page.
+   */
+    std::vector<IncludedColumn> includedColumns;
+
+  /**
+   * Predicate of a partial index, the records that do not satisfy it are left out when the index is built
+   * and by insertRecord(). Recorded in the meta page.
+   */
+    IndexPredicate predicate;
+
+  /**
+   * Reject the insertion of a key that the index already holds, see insertEntry(). Recorded in the meta page.
+   */
+    bool unique;
+
+  /**
+   * For keys that are timestamps: every insertion of a key k moves the expiry watermark up to k - timeToLive,
+   * see BTreeIndex::setExpiryWatermark(). 0 for no time to live. Recorded in the meta page.
+   */
+    int timeToLive;
+
+  /**
+   * Name of the index file, relationName.attrByteOffset if empty.
+   */
+    std::string indexName;
+
+  /**
+   * Restrict the index to the keys in [keyRangeLow, keyRangeHigh], as a partition of a BTreeForest. The records
+   * with other keys are left out when the index is built and by insertRecord(), like those a predicate rejects.
+   * Recorded in the meta page.
+   */
+    bool hasKeyRange;
+    int keyRangeLow;
+    int keyRangeHigh;
+
+  /**
+   * Mark the index as shard shardId out of shardCount of a BTreeShardedIndex, which routes to it the keys that
+   * BTreeIndex::hashShard() maps to shardId. 0 shards for none. Recorded in the meta page.
+   */
+    int shardCount;
+    int shardId;
+
+  /**
+   * Index the records of the relation when the index is created, and those appended since when it is opened.
+   * false leaves it to the caller: a BTreeForest or a BTreeShardedIndex reads the relation once for all its
+   * partitions or shards. Not recorded.
+   */
+    bool indexRelation;
+
+    BTreeIndexOptions() : leafFormat( SORTED_LEAF ), writeBackRate( 0 ), maxDirtyPages( 32 ), unique( false ), timeToLive( 0 ),
+        hasKeyRange( false ), keyRangeLow( 0 ), keyRangeHigh( 0 ), shardCount( 0 ), shardId( 0 ), indexRelation( true ) {}
+};
+
+/**
+ * @brief Number of buckets in the fill-factor histograms of BTreeShapeStats. Each bucket covers 10%,
+ * the last one also holds completely full nodes.
+ */
+const int FILLHISTOGRAMSIZE = 10;
+
+/**
+ * @brief Shape and space-utilization report of an index, filled in by BTreeIndex::analyzeShape().
+*/
+struct BTreeShapeStats{
+  /**
+   * Number of levels in the tree, counting the leaf level.
+   */
+    int height;
+
+  /**
+   * Number of nodes on each level, root level first.
+   */
+    std::vector<int> nodesPerLevel;
+
+  /**
+   * Number of leaf and non-leaf pages found in the file.
+   */
+    int leafCount;
+    int nonLeafCount;
+
+  /**
+   * Number of <key, rid> pairs stored in leaves and number of keys stored in non-leaf nodes.
+   */
+    long long leafEntries;
+    long long nonLeafKeys;
+
+  /**
+   * Fill-factor distributions of LeafNodeInt and NonLeafNodeInt pages.
+   */
+    int leafFillHistogram[ FILLHISTOGRAMSIZE ];
+    int nonLeafFillHistogram[ FILLHISTOGRAMSIZE ];
+
+  /**
+   * Number of rightSibPageNo links, how many of them point to the physically next page
+   * and how many point forward in the file at all.
+   */
+    int leafLinks;
+    int sequentialLeafLinks;
+    int forwardLeafLinks;
+
+  /**
+   * Bytes of index pages that hold no entry: unused slots plus padding at the end of each node.
+   */
+    long long wastedBytes;
+
+  /**
+   * Pages in the file that are not reachable from the root.
+   */
+    int unreachablePages;
+
+  /**
+   * Pages in the file that are on the free page list, waiting to be reused.
+   */
+    int freePages;
+
+  /**
+   * Pages kept for snapshots, before-images and old versions replaced by compaction,
+   * and pages retired while operations were in progress.
+   */
+    int snapshotPages;
+};
+
+
+/**
+ * @brief A key range to scan, with the same operators as BTreeIndex::startScan().
+*/
+struct BTreeScanRange{
+    int lowVal;
+    Operator lowOp;
+    int highVal;
+    Operator highOp;
+};
+
+/**
+ * @brief A predicate on the key evaluated inside the leaves by BTreeIndex::scanNextLeaf():
+ * key mod modulus == remainder, where mod is the non-negative remainder, and key not in excluded.
+*/
+struct KeyPredicate{
+  /**
+   * Modulus of the key, 0 or 1 to accept every key. A power of two is evaluated with SIMD instructions.
+   */
+    int modulus;
+
+  /**
+   * Remainder the keys must have, in [0, modulus).
+   */
+    int remainder;
+
+  /**
+   * Keys that are rejected, meant to be a small set.
+   */
+    std::vector<int> excluded;
+
+    KeyPredicate() : modulus( 0 ), remainder( 0 ) {}
+};
+
+/**
+ * @brief Largest number of entries of a leaf page in either format.
+ */
+const int MAXLEAFENTRIES = SLOTTEDLEAFSIZE > INTARRAYLEAFSIZE ? SLOTTEDLEAFSIZE : INTARRAYLEAFSIZE;
+
+/**
+ * @brief Number of separators splitRange() looks for per requested part before it stops descending, so that
+ * the parts it picks among them are balanced.
+ */
+const int SEPARATORSPERPART = 4;
+
+/**
+ * @brief BTreeIndex class. It implements a B+ Tree index on a single attribute of a
+ * relation. This index supports only one startScan() scan at a time, and any number of
+ * BTreeRangeCursor cursors besides.
+*/
+class BTreeIndex {
+
+    friend class BTreeRangeCursor;
+    friend class BTreeProbeCursor;
+
+ private:
+
+  /**
+   * File object for the index file.
+   */
+    File        *file;
+
+  /**
+   * Buffer Manager Instance.
+   */
+    BufMgr    *bufMgr;
+
+  /**
+   * Page number of meta page.
+   */
+    PageId    headerPageNum;
+
+  /**
+   * page number of root page of B+ tree inside index file.
+   */
+    PageId    rootPageNum;
+
+  /**
+   * Highest page number allocated in the index file.
+   */
+    PageId    lastPageNum;
+
+  /**
+   * Pages of the index file that are not used by the tree. Node allocation reuses them
+   * before growing the file. Written to the free page list pages by updateMetaPage().
+   */
+    std::set<PageId> freePages;
+
+  /**
+   * True if freePages changed since the free page list was last written.
+   */
+    bool freeListChanged;
+
+  /**
+   * Last record of the relation that is in the index, and whether the index file maintains it, see IndexMetaInfo.
+   */
+    RecordId lastIndexedRid;
+    bool hasLastIndexedRid;
+
+  /**
+   * Write counters.
+   */
+    BTreeWriteStats writeStats;
+
+  /**
+   * Pages of an old version of the tree replaced by compact() while snapshots could still read them.
+   * They are freed when the last snapshot is released.
+   */
+    std::vector<PageId> retiredPages;
+
+  /**
+   * Format of the leaf pages.
+   */
+    LeafFormat    leafFormat;
+
+  /**
+   * Attributes stored in the leaf entries, and the size of the payload they make up.
+   */
+    std::vector<IncludedColumn> includedColumns;
+    int         payloadSize;
+
+  /**
+   * Size of the heap entries of slotted leaves, the payload included.
+   */
+    int         slottedEntrySize;
+
+  /**
+   * Predicate of a partial index.
+   */
+    IndexPredicate predicate;
+
+  /**
+   * True if the index holds at most one entry per key.
+   */
+    bool        unique;
+
+  /**
+   * Time to live of the keys, 0 for none.
+   */
+    int         timeToLive;
+
+  /**
+   * Keys below this value are treated as deleted, INT_MIN if none is. Guarded by writeBackLatch.
+   */
+    int         expiryWatermark;
+
+  /**
+   * Watermark up to which the expired subtrees have been dropped.
+   */
+    int         purgedWatermark;
+
+  /**
+   * Set by a leaf split while the watermark is above purgedWatermark, the insertion then drops the expired subtrees.
+   */
+    bool        expiredPurgePending;
+
+  /**
+   * Key range of a partition of a BTreeForest, see BTreeIndexOptions::hasKeyRange.
+   */
+    bool        hasKeyRange;
+    int         keyRangeLow;
+    int         keyRangeHigh;
+
+  /**
+   * Shard of a BTreeShardedIndex, see BTreeIndexOptions::shardCount.
+   */
+    int         shardCount;
+    int         shardId;
+
+  /**
+   * Datatype of attribute over which index is built.
+   */
+    Datatype    attributeType;
+
+  /**
+   * Offset of attribute, over which index is built, inside records.
+   */
+    int         attrByteOffset;
+
+  /**
+   * Number of keys in leaf node, depending upon the type of key.
+   */
+    int            leafOccupancy;
+
+  /**
+   * Number of keys in non-leaf node, depending upon the type of key.
+   */
+    int            nodeOccupancy;
+
+
+    // MEMBERS SPECIFIC TO SCANNING
+
+  /**
+   * True if an index scan has been started.
+   */
+    bool        scanExecuting;
+
+  /**
+   * Index of next entry to be scanned in current leaf being scanned.
+   */
+    int            nextEntry;
+
+  /**
+   * Page number of current page being scanned.
+   */
+    PageId    currentPageNum;
+
+  /**
+   * Current Page being scanned.
+   */
+    Page        *currentPageData;
+
+  /**
+   * Low INTEGER value for scan.
+   */
+    int            lowValInt;
+
+  /**
+   * Low DOUBLE value for scan.
+   */
+    double    lowValDouble;
+
+  /**
+   * Low STRING value for scan.
+   */
+    std::string    lowValString;
+
+  /**
+   * High INTEGER value for scan.
+   */
+    int            highValInt;
+
+  /**
+   * High DOUBLE value for scan.
+   */
+    double    highValDouble;
+
+  /**
+   * High STRING value for scan.
+   */
+    std::string highValString;
+    
+  /**
+   * Low Operator. Can only be GT(>) or GTE(>=).
+   */
+    Operator    lowOp;
+
+  /**
+   * High Operator. Can only be LT(<) or LTE(<=).
+   */
+    Operator    highOp;
+
+  /**
+   * Snapshot the current scan reads. currentPageNum is the page of this snapshot that is pinned.
+   */
+    BTreeSnapshot scanSnapshot;
+
+  /**
+   * True if startScan() took scanSnapshot itself and endScan() has to release it.
+   */
+    bool        scanOwnsSnapshot;
+
+  /**
+   * Epoch of the newest snapshot taken.
+   */
+    int         snapshotEpoch;
+
+  /**
+   * Epochs of the snapshots that are not released yet.
+   */
+    std::set<int> liveSnapshots;
+
+  /**
+   * Before-images of the pages modified while snapshots were live, oldest first for every page.
+   */
+    std::map<PageId, std::vector<PageVersion> > pageVersions;
+
+  /**
+   * Pages retired through the epoch manager that no operation can read anymore, waiting to be put
+   * on the free page list by the thread running the next allocation. Protected by reclaimedLatch.
+   */
+    std::vector<PageId> reclaimedPages;
+    std::mutex reclaimedLatch;
+
+  /**
+   * Epoch manager of the operations on this index. Pages unlinked from the tree are retired to it
+   * instead of being freed, so that a reader that got to them before they were unlinked can finish.
+   */
+    EpochManager epochs;
+
+  /**
+   * Background writer settings, see BTreeIndexOptions.
+   */
+    int writeBackRate;
+    int maxDirtyPages;
+
+  /**
+   * Modified pages not written to disk yet, by page number, each pinned once for the background writer.
+   * Only used if writeBackRate is not 0.
+   */
+    std::map<PageId, DirtyIndexPage> dirtyPages;
+
+  /**
+   * Held by every operation on the index and by the background writer while it writes, so that it never
+   * writes a page that is being modified. The writer does not call the buffer manager, the pages it wrote
+   * are unpinned by the next operation.
+   */
+    std::recursive_mutex writeBackLatch;
+
+  /**
+   * Background writer.
+   */
+    std::thread writer;
+    std::mutex writerLatch;
+    std::condition_variable writerWakeup;
+    bool writerStopping;
+
+  /**
+   * Page number the background writer continues from, it sweeps the dirty pages in page number order.
+   */
+    PageId writeBackCursor;
+
+    void writeBackLoop();
+
+  /**
+   * Stop the background writer if it runs.
+   */
+    void stopWriter();
+
+  /**
+   * Compute payloadSize and slottedEntrySize from includedColumns.
+   */
+    void setPayloadLayout();
+
+    
+ public:
+
+  /**
+   * BTreeIndex Constructor.
+     * Check to see if the corresponding index file exists. If so, open the file.
+     * If not, create it and insert entries for every tuple in the base relation read along its page chain.
+   *
+   * @param relationName        Name of file.
+   * @param outIndexName        Return the name of index file, see BTreeIndexOptions::indexName.
+   * @param bufMgrIn                        Buffer Manager Instance
+   * @param attrByteOffset            Offset of attribute, over which index is to be built, in the record
+   * @param attrType                        Datatype of attribute over which index is built
+   * @param options                         Options of the index file if it has to be created
+   * @throws  BadIndexInfoException     If the index file already exists for the corresponding attribute, but values in metapage(relationName, attribute byte offset, attribute type etc.) do not match with values received through constructor parameters.
+   *                                   Also if the relation does not contain the last record indexed anymore.
+   */
+    BTreeIndex(const std::string & relationName, std::string & outIndexName,
+                        BufMgr *bufMgrIn,    const int attrByteOffset,    const Datatype attrType,
+                        const BTreeIndexOptions & options = BTreeIndexOptions());
+    
+
+  /**
+   * BTreeIndex Destructor.
+     * End any initialized scan, flush index file, after unpinning any pinned pages, from the buffer manager
+     * and delete file instance thereby closing the index file.
+     * Destructor should not throw any exceptions. All exceptions should be caught in here itself.
+     * */
+    ~BTreeIndex();
+
+    /**
+     * Index the records of the relation that come after lastIndexedRid in file scan order: all of them for a
+     * new index, the ones appended since the last build or open otherwise. The pages of the relation are read
+     * along their chain from the page of lastIndexedRid on, so reopening costs the appended pages only. The
+     * records are inserted in batches of CATCHUPBATCHSIZE sorted by key, and the meta page records the new
+     * last indexed record.
+     * @param relationName name of the relation
+     * @return false if the relation does not contain lastIndexedRid
+     */
+    bool indexAppendedRecords(const std::string & relationName);
+
+    /**
+     * Call visit for every record of a relation that comes after a given one in file scan order, reading the
+     * pages along their chain from the page of that record on. The page of the record is pinned during the call.
+     * @param bufMgr       buffer manager to read the relation with
+     * @param relationName name of the relation
+     * @param after        the last record not to visit, page number 0 to visit every record
+     * @param visit        called with the record id and the record
+     * @return false if the relation does not contain after
+     */
+    static bool readRelationAfter(BufMgr *bufMgr, const std::string &relationName, RecordId after,
+                                  const std::function<void(RecordId rid, const std::string &record)> &visit);
+
+    /**
+     * Read a relation once for several indexes over it, from the last record they hold on, and insert every
+     * record with insertRecord() into the index route picks for its key, in batches of CATCHUPBATCHSIZE sorted
+     * by key. Indexes that do not hold the relation up to the same record are caught up from the start of the
+     * relation, each one skipping the records up to its own last one.
+     * @param relationName name of the relation
+     * @param indexes      the indexes, opened with BTreeIndexOptions::indexRelation false
+     * @param route        position in indexes of the index of a key
+     * @throws  BadIndexInfoException If the relation does not contain the last record of an index
+     */
+    static void indexAppendedRecords(const std::string &relationName, const std::vector<BTreeIndex *> &indexes,
+                                     const std::function<int(int key)> &route);
+
+    /**
+     *  BTreeIndex Internal Node Allocation function
+     *  @param &pageId the Page Id of the internal node
+     *  @param nearPageId preferred neighbourhood of the new page, 0 for no preference
+     */
+    NonLeafNodeInt *allocNonLeaf(PageId &pageId, PageId nearPageId = 0);
+    
+    /**
+     * BtreeIndex Leaf Node Allocation function
+     * @param &pageId the Page Id of the leaf node
+     * @param nearPageId preferred neighbourhood of the new page, 0 for no preference
+     */
+    LeafNodeInt *allocLeaf(PageId &pageId, PageId nearPageId = 0);
+
+    /**
+     * BtreeIndex Slotted Leaf Node Allocation function
+     * @param &pageId the Page Id of the leaf node
+     * @param nearPageId preferred neighbourhood of the new page, 0 for no preference
+     */
+    SlottedLeafNodeInt *allocSlottedLeaf(PageId &pageId, PageId nearPageId = 0);
+
+    /**
+     * Allocate a zeroed, pinned page for a node. The free page closest to nearPageId is reused
+     * if there is one, so that a split keeps the new node next to its sibling; otherwise the file grows.
+     * @param &pageId the Page Id of the new page
+     * @param &page the new page
+     * @param nearPageId preferred neighbourhood of the new page, 0 for no preference
+     */
+    void allocIndexPage(PageId &pageId, Page *&page, PageId nearPageId);
+
+    /**
+     * Return a page that is no longer used by the tree to the free page list.
+     * The page must not be pinned and no node may point to it anymore.
+     * @param pageId the Page Id of the page
+     */
+    void freePage(PageId pageId);
+
+    /**
+     * Read the free page list starting at the given page into freePages.
+     * @param listPageNo first page of the list, 0 for an empty list
+     */
+    void readFreeList(PageId listPageNo);
+
+    /**
+     * Find the highest page number used by the tree or the free page list, for index files
+     * written before IndexMetaInfo::lastPageNo was recorded.
+     * @return the highest page number in use
+     */
+    PageId findLastPage();
+
+    /**
+     * Write freePages to a free page list. The list is stored in the free pages themselves.
+     * @return first page of the list, 0 for an empty list
+     */
+    PageId writeFreeList();
+
+    /**
+     * Allocate count pages with consecutive page numbers. A run of free pages is reused if there is one
+     * long enough, otherwise the pages are appended to the file. The pages are not pinned.
+     * @param count number of pages
+     * @param &pageIds the page numbers, in increasing order
+     */
+    void allocIndexRun(int count, std::vector<PageId> &pageIds);
+
+    /**
+     * Free the pages retired by compact() once no scan can read them anymore.
+     */
+    void releaseRetiredPages();
+
+    /**
+     * Release pages taken out of the tree: they are retired right away, or kept in retiredPages until the
+     * last snapshot is released if a snapshot could still read them.
+     * @param pageIds the pages
+     */
+    void releaseTreePages(const std::vector<PageId> &pageIds);
+
+    /**
+     * Delete the entries of the range from the subtree of a node, whose keys lie between the given bounds.
+     * Children whose keys all fall inside the range are dropped without being read, the others that overlap
+     * it are visited.
+     * @param pid the page of the node
+     * @param hasLow false if the subtree has no lower bound
+     * @param lowBound lowest key the subtree may hold
+     * @param hasHigh false if the subtree has no upper bound
+     * @param highBound highest key the subtree may hold
+     * @param deletion the state of the pass
+     * @return true if the subtree became empty and its page was released, the parent then drops it
+     */
+    bool deleteRangeNode(PageId pid, bool hasLow, int lowBound, bool hasHigh, int highBound, RangeDeletion &deletion);
+
+    /**
+     * Add the pages of a subtree to the released pages of a deletion. Leaves are not read.
+     * @param pid the page of the root of the subtree
+     * @param leaf true if the page is a leaf
+     * @param deletion the state of the pass
+     */
+    void releaseSubtree(PageId pid, bool leaf, RangeDeletion &deletion);
+
+    /**
+     * Return the leftmost leaf of a subtree.
+     * @param pid the page of the root of the subtree
+     * @param leaf true if the page is a leaf
+     */
+    PageId leftmostLeaf(PageId pid, bool leaf);
+
+    /**
+     * Rewrite the index into a new, compact version of the tree and switch to it.
+     * The leaves are written in key order to consecutive pages, each filled to the fill factor, and the
+     * internal levels are rebuilt on top of them. Until the root and meta page are switched to the new
+     * version the old one is left untouched, so a scan that is executing keeps reading the old leaves;
+     * their pages are freed when the last snapshot is released, otherwise right after the switch.
+     * @param fillFactor fraction of every node to fill, clamped to [0.1, 1]
+     */
+    void compact(float fillFactor = 1.0);
+
+    /**
+     * Take a snapshot of the index. Until it is released, every page modified by an insert is first copied,
+     * so that scans started on the snapshot keep seeing the tree as it is now.
+     * @return the snapshot handle
+     */
+    BTreeSnapshot takeSnapshot();
+
+    /**
+     * Release a snapshot. Before-images that no live snapshot can read anymore are freed.
+     * @param snapshot the snapshot handle
+     */
+    void releaseSnapshot(const BTreeSnapshot &snapshot);
+
+    /**
+     * Return the page that holds the given page of the tree as the snapshot sees it.
+     * @param pageId page number in the tree
+     * @param snapshot the snapshot
+     */
+    PageId snapshotPage(PageId pageId, const BTreeSnapshot &snapshot);
+
+    /**
+     * Save a before-image of the page if a live snapshot may read it, to be called before modifying the page.
+     * If the scan is pinned on the page it moves to the before-image.
+     * @param pageId the Page Id of the page about to be modified
+     */
+    void savePageVersion(PageId pageId);
+
+    /**
+     * Free the before-images that no live snapshot can read.
+     */
+    void reclaimPageVersions();
+
+    /**
+     * Free a page once every operation in progress has ended.
+     * @param pageId the Page Id of a page no node points to anymore
+     */
+    void retirePage(PageId pageId);
+
+    /**
+     * Put the pages reclaimed by the epoch manager on the free page list.
+     */
+    void collectReclaimedPages();
+
+    /**
+     * Register the calling thread with the epoch manager of the index. Threads are also registered by their first operation.
+     */
+    void registerThread();
+
+    /**
+     * Unregister the calling thread, which must not be in the middle of an operation.
+     */
+    void unregisterThread();
+    
+    /**
+     * Insert a new node by using the key/rid pair
+     * Start from the root to recursively find the leaf to insert the node. If splitting occurs, we push up the midKey to its parents recursively and create a new Page.
+     *
+     * @param key the key to insert
+     * @param rid The record Id of the node to insert
+     * @param midKey the middle value to be pushed up if splitting needed
+     * @param pid the page Id of the node
+     * @param newSonPageId the page Id of the spllitting new node
+     * @param payload the included columns of the entry, nullptr for none
+     * @param replace overwrite the entry of the key if the index already holds it, see upsert()
+     * @param atSeparator true if the key is equal to the separator on the right of pid in its parent,
+     * so that an entry of the key may also start the next leaf
+     * @param status set to the outcome of the insertion
+     * @return true if splitting happens, false otherwise
+     */
+    bool insertNode(int key, RecordId rid, int& midKey, PageId pid, PageId& newSonPageId, const char *payload,
+                    bool replace, bool atSeparator, InsertStatus &status);
+
+    /**
+     * Common body of insertEntry() and upsert().
+     * @param replace overwrite the entry of the key if the index already holds it
+     */
+    InsertStatus insertKey(int key, RecordId rid, const char *payload, bool replace);
+
+    /**
+     * Look for an entry of the key in the leaf an insertion of the key reached, without another descent.
+     * The key is binary searched in the leaf; if it is missing and the leaf ends at a separator equal to
+     * the key, the first entry of the next non-empty leaf is checked as well.
+     * @param key the key
+     * @param pid the leaf reached by the insertion
+     * @param page the leaf, pinned by the insertion; it stays pinned
+     * @param atSeparator see insertNode()
+     * @param foundPid set to the leaf holding the entry
+     * @param foundIdx set to the index of the entry in that leaf
+     * @return true if an entry of the key was found
+     */
+    bool findExistingEntry(int key, PageId pid, Page *page, bool atSeparator, PageId &foundPid, int &foundIdx);
+
+    /**
+     * Overwrite the record id and the included columns of entry idx of a leaf, in place.
+     */
+    void replaceLeafEntry(PageId pid, int idx, RecordId rid, const char *payload);
+
+    /**
+     * Raise the low end of a range to the expiry watermark. The range may end up empty.
+     */
+    void clipExpired(BTreeScanRange &range);
+
+    /**
+     * Drop every entry below the expiry watermark with deleteRange(), called by an insertion that split a leaf.
+     */
+    void purgeExpiredSubtrees();
+    
+    /**
+     * Inserts the < key,page number> pair into internal node
+     *
+     * @param key the key of the <key,page number> pair
+     * @param sonPid the page number of the <key,page number> pair
+     * @param sonIdx index in the node of the child that was split, the pair goes right after it
+     * @param pid the page Id of the node
+     * @param midKey the middle value to be pushed up if splitting needed
+     * @param newPid the page Id of the spllitting new node
+     * @return true if splitting happens, false otherwise
+     */
+    bool insertToNonLeafNode(int key, PageId sonPid, int sonIdx, PageId pid, int& midKey, PageId& newPid);
+    
+    /**
+     * Inserts the <key,record id> pair into leaf node
+     *
+     * @param key the key of the <key,page number> pair
+     * @param rid the page number of the <key,page> number) pair
+     * @param pid the page Id of the node
+     * @param curPage the node, pinned by the descent that reached it; it is unpinned
+     * @param midKey the middle value to be pushed up if splitting needed
+     * @param newPid the page Id of the spllitting new node
+     * @param payload the included columns of the entry, nullptr for none
+     * @return true if splitting happens, false otherwise
+     */
+    bool insertToLeaf(int key, RecordId rid, PageId pid, Page *curPage, int& midKey, PageId& newPid, const char *payload);
+    
+    /**
+     * Split the internal node by the given index.
      * It moves the values stored in the given node after the split index into a new internal node.
      *
      * @param key the key where the split occurs
      * @param sonPid  the page Id of the splitted page
+     * @param sonIdx  index in the node of the child that was split
+     * @param node  the node that is getting splitted
+     * @param newPid  the page Id of the new splitting node
+     */
+    int splitNonLeafNode(int key, PageId sonPid, int sonIdx, PageId pid, PageId& newPid);
+    
+    /**
+     * Splits a leaf node into two.
+     * It moves the records after the given index in the node into the new node.
+     *
+     * @param key the key where the split occurs
+     * @param rid  the record id where the split occurs
      * @param node  the node that is getting splitted
      * @param newPid  the page Id of the new splitting node
+     * @param payload the included columns of the entry, nullptr for none
+    */
+    int splitLeafNode(int key, RecordId rid, PageId pid, PageId& newPid, const char *payload);
+
+    
+    /**
+     * Update the root page number, the last allocated page number and the free page list within the header page.
+     * The header page and the free page list are rewritten only if they changed
+     */
+    void updateMetaPage();
+
+    /**
+     * Unpin a page that was modified, marking it dirty. Pages that were only read are unpinned clean
+     * so that flushing the file writes back only what changed.
+     * @param pageId the Page Id of the modified page
+     */
+    void unPinDirtyPage(PageId pageId);
+
+    /**
+     * Write a dirty page kept for the background writer to disk and unpin it, in the foreground.
+     * @param it the page in dirtyPages, erased
+     */
+    void writeDirtyPage(std::map<PageId, DirtyIndexPage>::iterator it);
+
+    /**
+     * Unpin the pages the background writer has written and that were not modified again since.
+     */
+    void collectWrittenPages();
+
+    /**
+     * Write every dirty page of the index to disk. With a background writer only the pages it has not
+     * written yet are left, otherwise the buffer manager flushes the file and no page may be pinned.
+     */
+    void flush();
+
+    /**
+     * Return the write counters of the index.
+     * @param stats the counters to fill in
+     */
+    void getWriteStats(BTreeWriteStats &stats);
+
+    /**
+     * Reset the write counters of the index.
+     */
+    void clearWriteStats();
+
+    /**
+     * Expire every key below the watermark. Scans, cursors and probes no longer return the entries of expired
+     * keys, and insertions of them are refused. The entries are not purged right away: an insertion removes the
+     * expired entries of the leaf it goes to, before checking whether the leaf has to be split. Leaves that hold
+     * only expired keys are not reached by insertions, so the first leaf split after the watermark moved drops
+     * the expired subtrees as deleteRange() does.
+     * The watermark only moves up, a lower value is ignored. Recorded in the meta page.
+     * @param watermark the smallest key that is not expired
+     */
+    void setExpiryWatermark(int watermark);
+
+    /**
+     * Return the smallest key that is not expired, INT_MIN if no key is.
+     */
+    int getExpiryWatermark();
+    
+	/**
+     * Insert a new entry using the pair <value,rid>.
+     * Start from root to recursively find out the leaf to insert the entry in. The insertion may cause splitting of leaf node.
+     * This splitting will require addition of new leaf page number entry into the parent non-leaf, which may in-turn get split.
+     * This may continue all the way upto the root causing the root to get split. If root gets split, metapage needs to be changed accordingly.
+     * Make sure to unpin pages as soon as you can.
+     * @param key            Key to insert, pointer to integer/double/char string
+     * @param rid            Record ID of a record whose entry is getting inserted into the index.
+     * @param payload        Included columns of the record for a covering index, see getPayloadSize(). Zeros if nullptr.
+     * The predicate of a partial index is not checked, see insertRecord().
+     * A unique index checks for the key in the leaf the descent reaches, so the check costs no extra descent.
+     * @return INSERTED, DUPLICATE_KEY if the index is unique and already holds the key, or EXPIRED
+     **/
+    InsertStatus insertEntry(const void* key, const RecordId rid, const char *payload = nullptr);
+
+    /**
+     * Insert the entry, or overwrite the record id and included columns of the entry of the key in place
+     * if the index already holds it. The existing entry is found during the descent of the insertion.
+     * In a non-unique index the first entry of the key is overwritten.
+     * @param key            Key to insert, pointer to integer/double/char string
+     * @param rid            Record ID of the record.
+     * @param payload        Included columns of the record, zeros if nullptr.
+     * @return INSERTED, REPLACED or EXPIRED
+     **/
+    InsertStatus upsert(const void* key, const RecordId rid, const char *payload = nullptr);
+
+    /**
+     * Return true if the index holds at most one entry per key.
+     */
+    bool isUnique() const;
+
+    /**
+     * Insert the entry of a record, taking the key and the included columns from the record itself.
+     * A record that does not satisfy the predicate of a partial index is not inserted.
+     * @param record         The record, as returned by FileScan::getRecord()
+     * @param rid            Record ID of the record.
+     * @return the status of insertEntry(), or EXCLUDED if the record does not satisfy the predicate
+     **/
+    InsertStatus insertRecord(const std::string &record, const RecordId rid);
+
+    /**
+     * Delete every entry whose key is inside a range, in one pass from the root. Subtrees whose keys all fall
+     * inside the range are dropped without reading their leaves; only the nodes on the paths to the two ends
+     * of the range are read and rewritten, and the leaf before the range is linked to the leaf after it.
+     * The released pages are freed together once no snapshot can read them. Nodes left underfull are not
+     * merged, compact() rebalances the tree.
+     * @param lowVal   Low value of range, pointer to integer / double / char string
+     * @param lowOp    Low operator (GT/GTE)
+     * @param highVal  High value of range, pointer to integer / double / char string
+     * @param highOp   High operator (LT/LTE)
+     * @return number of index pages released
+     * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+     * @throws  BadScanrangeException If lowVal > highval
+     **/
+    int deleteRange(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+    /**
+     * Return true if the record belongs in the index: it satisfies the predicate of a partial index, its key is
+     * inside the key range of a partition and hashes to the shard. Always true for other indexes.
+     * @param record the record
+     */
+    bool matchesPredicate(const char *record);
+
+    /**
+     * Return the key range of a partition of a BTreeForest.
+     * @param low set to the smallest key of the range
+     * @param high set to the largest key of the range
+     * @return false if the index is not restricted to a key range
+     */
+    bool getKeyRange(int &low, int &high) const;
+
+    /**
+     * Return the shard of a BTreeShardedIndex the index is, and the number of shards.
+     * @param count set to the number of shards, 0 if the index is not a shard
+     * @return the shard number
+     */
+    int getShard(int &count) const;
+
+    /**
+     * Map a key to one of count shards. The key is multiplied by a large odd constant and its high bits are
+     * folded in, so that consecutive keys are spread evenly.
+     */
+    static int hashShard(int key, int count);
+
+    /**
+     * Copy the included columns of a record one after the other into payload.
+     * @param record the record
+     * @param payload getPayloadSize() bytes
+     */
+    void extractPayload(const char *record, char *payload);
+
+    /**
+     * Size in bytes of the included columns stored in every leaf entry, 0 if the index is not covering.
      */
-    int splitNonLeafNode(int key, PageId sonPid, PageId pid, PageId& newPid);
+    int getPayloadSize() const;
+
+    /**
+     * Included columns stored in every leaf entry, in payload order.
+     */
+    const std::vector<IncludedColumn> &getIncludedColumns() const;
     
     /**
-     * Splits a leaf node into two.
-     * It moves the records after the given index in the node into the new node.
+     * Determine whether the node passed in is a leafnode, in either leaf format
+     * @param page Page/Node to be determined is leaf or not
+     * @return True if it's a leaf node, false otherwise
+     */
+    static bool isLeaf(Page *page);
+
+    /**
+     * Determine whether the node passed in is a leafnode in the slotted format
+     * @param page Page/Node to be determined
+     * @return True if it's a slotted leaf node, false otherwise
+     */
+    static bool isSlottedLeaf(Page *page);
+
+    /**
+     * Leaf accessors that work for both leaf formats.
+     * Number of entries, key and record id of entry i in key order, and right sibling of a leaf page.
+     */
+    static int leafSize(Page *page);
+    static int leafKeyAt(Page *page, int i);
+    static RecordId leafRidAt(Page *page, int i);
+    static PageId leafRightSib(Page *page);
+
+    /**
+     * Return the included columns stored with entry i of a leaf page, nullptr if the leaf has none.
+     * @param page a leaf page in either format
+     */
+    static const char *leafPayloadAt(Page *page, int i);
+
+    /**
+     * Return true if the <key,record id> pair cannot be inserted in the leaf page without a split
+     * @param page a leaf page in either format
+     */
+    static bool leafIsFull(Page *page);
+    
+    /**
+     * Recursively find the Page Id of the first element larger than or equal to the given lower bound
+     */
+    void recursiveScanPageId();
+    
+    /**
+     * Find the index of the page that the key is located in
+     * @param node an internal node
+     * @param key the key we need to find
+     * @return the index of the first key that is smaller than the given key
+     */
+    static int findNonLeafIndex(NonLeafNodeInt *node, int key);
+
+    /**
+     * Node kernel: number of <key, record id> pairs in a leaf node.
+     * Like the other node kernels it works on a node in memory and does not touch the buffer manager.
+     */
+    static int leafEntryCount(LeafNodeInt *node);
+
+    /**
+     * Node kernel: number of keys in an internal node, which has one more child than keys.
+     */
+    static int nonLeafKeyCount(NonLeafNodeInt *node);
+
+    /**
+     * Node kernel: inserts the <key, page number> pair into an internal node that is not full.
+     * Only the occupied entries after the insertion point are moved.
      *
-     * @param key the key where the split occurs
-     * @param rid  the record id where the split occurs
-     * @param node  the node that is getting splitted
-     * @param newPid  the page Id of the new splitting node
-    */
-    int splitLeafNode(int key, RecordId rid, PageId pid, PageId& newPid);
+     * @param node the internal node
+     * @param key the key of the <key,page number> pair
+     * @param sonPid the page number of the <key,page number> pair, stored to the right of the key
+     * @param pos index of the key in the node, -1 to insert it after all keys smaller than or equal to it.
+     * Separators equal to the key can only be told apart by position, so a split child passes its own index.
+     */
+    static void insertNonLeafEntry(NonLeafNodeInt *node, int key, PageId sonPid, int pos = -1);
+
+    /**
+     * Node kernel: inserts the <key, record id> pair into a leaf node that is not full.
+     *
+     * @param node the leaf node
+     * @param key the key of the <key,record id> pair
+     * @param rid the record id of the <key,record id> pair
+     */
+    static void insertLeafEntry(LeafNodeInt *node, int key, RecordId rid);
+
+    /**
+     * Node kernel: removes the entries [first, end) of a leaf page in either format. A sorted leaf moves the
+     * entries after them down, a slotted leaf only its slots and leaves the heap entries as dead space.
+     *
+     * @param page the leaf page
+     * @param first index of the first entry to remove
+     * @param end index after the last entry to remove
+     */
+    static void removeLeafEntries(Page *page, int first, int end);
+
+    /**
+     * Node kernel: number of entries of a leaf page in either format with a key below the watermark,
+     * which are the first ones.
+     */
+    static int leafEntriesBelow(Page *page, int watermark);
+
+    /**
+     * Node kernel: splits a full internal node while inserting the <key, page number> pair.
+     * The lower half stays in node, the upper half moves directly to newNode without a temporary copy.
+     *
+     * @param node the full internal node
+     * @param newNode the empty internal node receiving the upper half
+     * @param key the key of the <key,page number> pair
+     * @param sonPid the page number of the <key,page number> pair
+     * @param pos index of the key in the node, -1 to insert it after all keys smaller than or equal to it
+     * @return the middle key, to be pushed up to the parent
+     */
+    static int splitNonLeafEntries(NonLeafNodeInt *node, NonLeafNodeInt *newNode, int key, PageId sonPid, int pos = -1);
+
+    /**
+     * Node kernel: splits a full leaf node while inserting the <key, record id> pair.
+     * The lower half stays in node, the upper half moves directly to newNode without a temporary copy.
+     * Sibling links are left to the caller.
+     *
+     * @param node the full leaf node
+     * @param newNode the empty leaf node receiving the upper half
+     * @param key the key of the <key,record id> pair
+     * @param rid the record id of the <key,record id> pair
+     * @return the first key of newNode, to be pushed up to the parent
+     */
+    static int splitLeafEntries(LeafNodeInt *node, LeafNodeInt *newNode, int key, RecordId rid);
+
+    /**
+     * Node kernel: evaluates a key predicate over an array of keys, four keys at a time with SSE2 when the
+     * modulus is a power of two, and writes the positions of the keys that satisfy it to a selection vector.
+     *
+     * @param keys the keys
+     * @param n number of keys
+     * @param predicate the predicate
+     * @param selection receives the positions of the matching keys, in increasing order, room for n
+     * @return the number of matching keys
+     */
+    static int filterKeys(const int *keys, int n, const KeyPredicate &predicate, int *selection);
+
+    /**
+     * Node kernel: makes an empty slotted leaf.
+     *
+     * @param node the page to format
+     * @param entrySize the size of the heap entries in bytes
+     */
+    static void initSlottedLeaf(SlottedLeafNodeInt *node, int entrySize);
+
+    /**
+     * Node kernel: return the heap entry of the i-th slot of a slotted leaf.
+     */
+    static SlottedLeafEntry *slottedEntry(SlottedLeafNodeInt *node, int i);
+
+    /**
+     * Node kernel: return true if a new entry fits in the slotted leaf, possibly after compaction.
+     */
+    static bool slottedLeafHasRoom(SlottedLeafNodeInt *node);
+
+    /**
+     * Node kernel: rewrites the heap of a slotted leaf so that the live entries are contiguous
+     * at the end of the page, which frees the dead bytes.
+     */
+    static void compactSlottedLeaf(SlottedLeafNodeInt *node);
+
+    /**
+     * Node kernel: inserts the <key, record id> pair into a slotted leaf that has room for it.
+     * The entry is appended to the heap and only the slots after the insertion point are moved.
+     *
+     * @param node the slotted leaf node
+     * @param key the key of the <key,record id> pair
+     * @param rid the record id of the <key,record id> pair
+     * @param payload bytes stored after the pair, zeros if nullptr
+     * @param payloadSize number of bytes of payload, the rest of the entry up to its aligned size is zeroed
+     */
+    static void insertSlottedLeafEntry(SlottedLeafNodeInt *node, int key, RecordId rid, const char *payload = nullptr,
+                                       int payloadSize = 0);
+
+    /**
+     * Node kernel: splits a full slotted leaf while inserting the <key, record id> pair.
+     * The upper half of the slots moves to newNode, the heap space it used becomes dead bytes of node.
+     * Sibling links are left to the caller.
+     *
+     * @param node the full slotted leaf node
+     * @param newNode the empty slotted leaf node receiving the upper half
+     * @param key the key of the <key,record id> pair
+     * @param rid the record id of the <key,record id> pair
+     * @param payload bytes stored after the pair, zeros if nullptr
+     * @param payloadSize number of bytes of payload
+     * @return the first key of newNode, to be pushed up to the parent
+     */
+    static int splitSlottedLeafEntries(SlottedLeafNodeInt *node, SlottedLeafNodeInt *newNode, int key, RecordId rid,
+                                       const char *payload = nullptr, int payloadSize = 0);
+  /**
+     * Begin a filtered scan of the index.  For instance, if the method is called
+     * using ("a",GT,"d",LTE) then we should seek all entries with a value
+     * greater than "a" and less than or equal to "d".
+     * If another scan is already executing, that needs to be ended here.
+     * Set up all the variables for scan. Start from root to find out the leaf page that contains the first RecordID
+     * that satisfies the scan parameters. Keep that page pinned in the buffer pool.
+     * The scan reads a snapshot of the index, so entries inserted while it is executing are not returned
+     * and do not move the entries it has not returned yet.
+   * @param lowVal    Low value of range, pointer to integer / double / char string
+   * @param lowOp        Low operator (GT/GTE)
+   * @param highVal    High value of range, pointer to integer / double / char string
+   * @param highOp    High operator (LT/LTE)
+   * @param snapshot  Snapshot to scan, taken by takeSnapshot(). If null the scan takes its own snapshot of the index.
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+   * @throws  BadScanrangeException If lowVal > highval
+     * @throws  NoSuchKeyFoundException If there is no key in the B+ tree that satisfies the scan criteria.
+    **/
+    
+    const void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp,
+                         const BTreeSnapshot *snapshot = nullptr);
+
+
+  /**
+     * Fetch the record id of the next index entry that matches the scan.
+     * Return the next record from current page being scanned. If current page has been scanned to its entirety, move on to the right sibling of current page, if any exists, to start scanning that page. Make sure to unpin any pages that are no longer required.
+   * @param outRid    RecordId of next record found that satisfies the scan criteria returned in this
+     * @throws ScanNotInitializedException If no scan has been initialized.
+     * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
+    **/
+    const void scanNext(RecordId& outRid);  // returned record id
+
+  /**
+     * Fetch the record id and the included columns of the next index entry that matches the scan, so that
+     * an index-only scan of a covering index does not read the relation.
+   * @param outRid    RecordId of next record found that satisfies the scan criteria returned in this
+   * @param outPayload getPayloadSize() bytes receiving the included columns of the entry, may be nullptr
+     * @throws ScanNotInitializedException If no scan has been initialized.
+     * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
+    **/
+    const void scanNext(RecordId& outRid, char *outPayload);
+
+  /**
+     * Fetch the record ids of the entries matching the scan and a key predicate, a leaf at a time. The keys of
+     * the rest of the current leaf that are in the range are filtered together by filterKeys(), and the record
+     * ids of the matching ones are returned as a selection vector; leaves without any match are skipped.
+   * @param outRids   the matching record ids, in key order, never empty
+   * @param predicate the key predicate
+     * @throws ScanNotInitializedException If no scan has been initialized.
+     * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
+    **/
+    const void scanNextLeaf(std::vector<RecordId> &outRids, const KeyPredicate &predicate);
+
+
+  /**
+     * Terminate the current scan. Unpin any pinned pages. Reset scan specific variables.
+     * @throws ScanNotInitializedException If no scan has been initialized.
+    **/
+    const void endScan();
+    
+    /**
+     * Split a key range into at most parts sub-ranges holding about the same number of entries, at separator
+     * keys of the internal nodes. The tree is descended only as far as needed to find enough separators
+     * inside the range. The sub-ranges are disjoint and in key order.
+     * @param range the range to split
+     * @param parts number of sub-ranges wanted
+     * @param ranges the sub-ranges, fewer than parts if the range covers too few separators
+     * @throws  BadOpcodesException If the operators of range are not valid scan operators
+     * @throws  BadScanrangeException If range.lowVal > range.highVal
+     */
+    void splitRange(const BTreeScanRange &range, int parts, std::vector<BTreeScanRange> &ranges);
+
+    /**
+     * Scan a key range with several threads, each running a BTreeRangeCursor over one part of the range
+     * returned by splitRange(). Every part is read from the same snapshot of the index.
+     * @param range the range to scan
+     * @param workers number of threads
+     * @param visit called for every entry, from the thread of its part, with the part number, key and record id.
+     *              Calls for one part come in key order.
+     */
+    void parallelScan(const BTreeScanRange &range, int workers,
+                      const std::function<void(int part, int key, RecordId rid)> &visit);
+
+    /**
+     * Scan a key range with several threads and return the record ids in key order. The parts are disjoint
+     * key ranges, so the results of the threads are merged by concatenating them.
+     * @param range the range to scan
+     * @param workers number of threads
+     * @param rids the record ids of the entries in the range
+     */
+    void parallelScan(const BTreeScanRange &range, int workers, std::vector<RecordId> &rids);
+
+    /**
+     * This is a helper function that can be used for debug.
+     * We print all the nodes in the given page ID
+     * @param pid the Page Id given to print our
+     */
+    void printNode(PageId pid);
+
+    /**
+     * Walk the whole index file and report the shape of the tree: height, nodes per level,
+     * fill factors, leaf chain order and wasted space.
+     * Pages are read sequentially from the file without going through the buffer pool, so the
+     * index file is flushed first and no scan may be executing.
+     * @param stats the report to fill in
+     */
+    void analyzeShape(BTreeShapeStats &stats);
+
+    /**
+     * This is a helper function for capacity planning.
+     * We print the report of analyzeShape() for the whole index
+     */
+    void printShape();
+};
+
+/**
+ * @brief A scan cursor over a key range of a snapshot of the index that keeps no page pinned between calls:
+ * each leaf it reaches is copied under the latch of the index, so that several cursors can run on different
+ * threads next to each other and next to startScan().
+*/
+class BTreeRangeCursor {
+
+    BTreeIndex &index;
+    BTreeScanRange range;
+    BTreeSnapshot snapshot;
+
+  /**
+   * Entries of the current leaf inside the range, and the next one to return.
+   */
+    std::vector<RIDKeyPair<int> > entries;
+    size_t nextEntry;
+
+  /**
+   * Page number in the tree of the next leaf to read, 0 once the range has been read to its end.
+   */
+    PageId nextPageNo;
+
+  /**
+   * Number of descents from the root, the first one included.
+   */
+    int descents;
+
+  /**
+   * Copy the entries of the leaf nextPageNo that are inside the range, and move nextPageNo to its right sibling.
+   */
+    void readLeaf();
+
+  /**
+   * Descend from the root of the snapshot to the leaf that may hold the key, and make it the next leaf to read.
+   */
+    void descend(int key);
+
+ public:
+
+  /**
+   * Position the cursor on the first entry of the range.
+   * @param indexIn the index
+   * @param rangeIn the range to scan
+   * @param snapshotIn the snapshot to read, which must stay live while the cursor is used
+   */
+    BTreeRangeCursor(BTreeIndex &indexIn, const BTreeScanRange &rangeIn, const BTreeSnapshot &snapshotIn);
+
+  /**
+   * Return the next entry of the range.
+   * @param key the key of the entry
+   * @param rid the record id of the entry
+   * @return false if the range has no entry left
+   */
+    bool next(int &key, RecordId &rid);
+
+  /**
+   * Skip to the next entry whose key is at least target and return it. A target inside the current or the next
+   * leaf is found in the entries of that leaf, one further ahead by descending again from the root.
+   * @param target the key to skip to
+   * @param key the key of the entry
+   * @param rid the record id of the entry
+   * @return false if the range has no such entry
+   */
+    bool seek(int target, int &key, RecordId &rid);
+
+  /**
+   * Number of times the cursor descended from the root, the positioning of the constructor included.
+   */
+    int getDescents() const;
+};
+
+/**
+ * @brief A cursor for the inner side of an index nested-loop join: looks up keys one after the other in a snapshot
+ * of the index. The cursor keeps a copy of the last leaf it reached together with the key range the separators of
+ * its ancestors assign to it, so a key inside that range is looked up without reading a page and a key just past it
+ * in the right sibling of the leaf; only other keys descend from the root. Probes in key order thus read every leaf
+ * at most once, like a scan. No page stays pinned between probes.
+*/
+class BTreeProbeCursor {
+
+    BTreeIndex &index;
+    BTreeSnapshot snapshot;
+
+  /**
+   * Entries of the current leaf, its page number in the tree (0 before the first probe) and its right sibling.
+   */
+    std::vector<RIDKeyPair<int> > entries;
+    PageId leafPageNo;
+    PageId rightSibPageNo;
+
+  /**
+   * Keys that belong to the current leaf: greater than lowBound if hasLow, and at most highBound if hasHigh.
+   * Taken from the separators on the path of a descent; after a move to the right sibling the high bound is
+   * the last key of the sibling, which is narrower than its real range but never wider.
+   */
+    bool hasLow;
+    int lowBound;
+    bool hasHigh;
+    int highBound;
+
+  /**
+   * Number of descents from the root and of leaves read.
+   */
+    int descents;
+    int leafReads;
+
+  /**
+   * Copy the entries of a leaf of the tree.
+   */
+    void readLeaf(PageId pageNo);
+
+  /**
+   * Descend from the root to the leaf that holds the key, and read it with its bounds.
+   */
+    void descend(int key);
+
+  /**
+   * True if the key belongs to the current leaf.
+   */
+    bool covers(int key) const;
+
+  /**
+   * Make the right sibling the current leaf.
+   */
+    void moveRight();
+
+  /**
+   * Append the record ids of the entries of the current leaf with the key.
+   */
+    void collect(int key, std::vector<RecordId> &rids);
+
+ public:
+
+  /**
+   * Constructor.
+   * @param indexIn the index
+   * @param snapshotIn the snapshot to read, which must stay live while the cursor is used
+   */
+    BTreeProbeCursor(BTreeIndex &indexIn, const BTreeSnapshot &snapshotIn);
+
+  /**
+   * Look up a key.
+   * @param key the key to look up
+   * @param rids filled with the record ids of the entries with this key, cleared first
+   * @return number of entries found
+   */
+    int probe(int key, std::vector<RecordId> &rids);
+
+  /**
+   * Number of descents from the root since the cursor was created.
+   */
+    int getDescents() const;
+
+  /**
+   * Number of leaves read since the cursor was created.
+   */
+    int getLeafReads() const;
+};
+
+/**
+ * @brief Default number of pairs returned by one BTreeMergeJoin::nextBatch() call.
+ */
+const int MERGEJOINBATCHSIZE = 1024;
+
+/**
+ * @brief Guard of a snapshot: takes a snapshot of the index when constructed and releases it when destroyed.
+ */
+class SnapshotGuard {
+    BTreeIndex &index;
+
+ public:
+    const BTreeSnapshot snapshot;
+
+    explicit SnapshotGuard(BTreeIndex &indexIn) : index(indexIn), snapshot(indexIn.takeSnapshot())
+    {
+    }
+
+    ~SnapshotGuard()
+    {
+        index.releaseSnapshot(snapshot);
+    }
+
+    SnapshotGuard(const SnapshotGuard &) = delete;
+    SnapshotGuard &operator=(const SnapshotGuard &) = delete;
+};
+
+/**
+ * @brief Merge join of two integer indexes on equal keys. The leaf chains of both indexes are walked in key order by
+ * a BTreeRangeCursor each, over snapshots taken when the join is created; the side that is behind skips to the key
+ * of the other with BTreeRangeCursor::seek(). Keys that occur several times on both sides produce every pair.
+*/
+class BTreeMergeJoin {
 
-    
-    /**
-     * Update the root page number within the header page
-     */
-    void updateRootPageNo();
-    
-	/**
-     * Insert a new entry using the pair <value,rid>.
-     * Start from root to recursively find out the leaf to insert the entry in. The insertion may cause splitting of leaf node.
-     * This splitting will require addition of new leaf page number entry into the parent non-leaf, which may in-turn get split.
-     * This may continue all the way upto the root causing the root to get split. If root gets split, metapage needs to be changed accordingly.
-     * Make sure to unpin pages as soon as you can.
-     * @param key            Key to insert, pointer to integer/double/char string
-     * @param rid            Record ID of a record whose entry is getting inserted into the index.
-     **/
-    const void insertEntry(const void* key, const RecordId rid);
-    
-    /**
-     * Determine whether the node passed in is a leafnode
-     * @param page Page/Node to be determined is leaf or not
-     * @return True if it's a leaf node, false otherwise
-     */
-    bool isLeaf(Page *page);
-    
-    /**
-     * Recursively find the Page Id of the first element larger than or equal to the given lower bound
-     */
-    void recursiveScanPageId();
-    
-    /**
-     * Find the index of the page that the key is located in
-     * @param node an internal node
-     * @param key the key we need to find
-     * @return the index of the first key that is smaller than the given key
-     */
-    int findNonLeafIndex(NonLeafNodeInt *node, int key);
   /**
-     * Begin a filtered scan of the index.  For instance, if the method is called
-     * using ("a",GT,"d",LTE) then we should seek all entries with a value
-     * greater than "a" and less than or equal to "d".
-     * If another scan is already executing, that needs to be ended here.
-     * Set up all the variables for scan. Start from root to find out the leaf page that contains the first RecordID
-     * that satisfies the scan parameters. Keep that page pinned in the buffer pool.
-   * @param lowVal    Low value of range, pointer to integer / double / char string
-   * @param lowOp        Low operator (GT/GTE)
-   * @param highVal    High value of range, pointer to integer / double / char string
-   * @param highOp    High operator (LT/LTE)
-   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
-   * @throws  BadScanrangeException If lowVal > highval
-     * @throws  NoSuchKeyFoundException If there is no key in the B+ tree that satisfies the scan criteria.
-    **/
-    
-    const void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+   * Snapshots of both sides, declared before the cursors so that they are released if a cursor throws.
+   */
+    SnapshotGuard leftSnapshot;
+    SnapshotGuard rightSnapshot;
+    BTreeRangeCursor left;
+    BTreeRangeCursor right;
+
+  /**
+   * Current entry of each side, valid is false once the side is exhausted.
+   */
+    bool leftValid;
+    int leftKey;
+    RecordId leftRid;
+    bool rightValid;
+    int rightKey;
+    RecordId rightRid;
+
+  /**
+   * Record ids of the right entries with the key being joined, and the next one to pair with leftRid.
+   */
+    bool inGroup;
+    int groupKey;
+    std::vector<RecordId> group;
+    size_t groupPos;
 
+ public:
 
   /**
-     * Fetch the record id of the next index entry that matches the scan.
-     * Return the next record from current page being scanned. If current page has been scanned to its entirety, move on to the right sibling of current page, if any exists, to start scanning that page. Make sure to unpin any pages that are no longer required.
-   * @param outRid    RecordId of next record found that satisfies the scan criteria returned in this
-     * @throws ScanNotInitializedException If no scan has been initialized.
-     * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
-    **/
-    const void scanNext(RecordId& outRid);  // returned record id
+   * Start a join of the entries of both indexes inside a key range.
+   * @param leftIn the index of the left side
+   * @param rightIn the index of the right side
+   * @param range the key range to join
+   */
+    BTreeMergeJoin(BTreeIndex &leftIn, BTreeIndex &rightIn, const BTreeScanRange &range);
 
+  /**
+   * Return the next pairs of record ids whose keys are equal, in key order.
+   * @param pairs filled with (left, right) record id pairs, cleared first
+   * @param maxPairs largest number of pairs to return
+   * @return false once the join is complete, pairs is then empty
+   */
+    bool nextBatch(std::vector<std::pair<RecordId, RecordId> > &pairs, size_t maxPairs = MERGEJOINBATCHSIZE);
 
   /**
-     * Terminate the current scan. Unpin any pinned pages. Reset scan specific variables.
-     * @throws ScanNotInitializedException If no scan has been initialized.
-    **/
-    const void endScan();
-    
-    /**
-     * This is a helper function that can be used for debug.
-     * We print all the nodes in the given page ID
-     * @param pid the Page Id given to print our
-     */
-    void printNode(PageId pid);
+   * Number of descents from the root made by the cursors of both sides.
+   */
+    int getDescents() const;
+};
+
+/**
+ * @brief Default number of buffer frames of every partition of a BTreeForest.
+ */
+const int FORESTBUFFERPAGES = 64;
+
+/**
+ * @brief An integer index split into BTreeIndex partitions over disjoint key ranges, each one in its own file
+ * (relationName.attrByteOffset.i) with its own buffer manager, so that partitions can be flushed, compacted,
+ * rebuilt and emptied independently, and flushed and compacted all at once in parallel. The routing table is
+ * the sorted list of the smallest key of every partition; it is not stored separately, since the meta page of
+ * every partition records its key range.
+ *
+ * Partitions are opened one after the other, because the files are opened and the relation is read then.
+ * A forest is not thread safe, except for the work parallelFor() spreads over its partitions.
+ *
+ * With NUMA_LOCAL placement, every partition is opened by a thread pinned to its node, so that its buffer pool is
+ * allocated there, and parallelFor() runs the task of a partition on that node too.
+*/
+class BTreeForest {
+
+    std::string relationName;
+    int attrByteOffset;
+    Datatype attrType;
+    int bufferPages;
+    BTreeIndexOptions options;
+    NumaPlacement placement;
+
+  /**
+   * Routing table: smallest key of every partition, in increasing order, INT_MIN first.
+   */
+    std::vector<int> lowKeys;
+
+  /**
+   * Every partition with its buffer manager and file name.
+   */
+    std::vector<BTreeIndex *> partitions;
+    std::vector<BufMgr *> bufMgrs;
+    std::vector<std::string> indexNames;
+
+  /**
+   * Name of the file of partition i: relationName.attrByteOffset.i
+   */
+    std::string partitionName(int i) const;
+
+  /**
+   * Open or create partition i over [low, high].
+   * @param indexRelation build the partition from the relation, or leave it to BTreeIndex::indexAppendedRecords()
+   */
+    void openPartition(int i, int low, int high, bool indexRelation);
+
+  /**
+   * Close partition i, writing its pages to its file.
+   */
+    void closePartition(int i);
+
+ public:
+
+  /**
+   * Open the partitions of the forest on an attribute of a relation, or create them if the first partition file
+   * does not exist. The relation must be on disk; it is read once, and every record goes to the partition of its
+   * key. If a partition cannot be opened, those opened before it are closed again.
+   * @param relationName   Name of the relation
+   * @param attrByteOffset Offset of the integer attribute inside the records
+   * @param attrType       Datatype of the attribute, INTEGER
+   * @param boundaries     Smallest key of every partition but the first, increasing. Ignored if the forest exists,
+   *                       the key ranges recorded in the partitions are used then.
+   * @param bufferPagesIn  Buffer frames of every partition
+   * @param optionsIn      Options of the partitions if they have to be created, the file name and key range aside
+   * @param placementIn    Placement of the partitions and their threads on the NUMA nodes
+   * @throws  BadIndexInfoException If the boundaries are not increasing
+   */
+    BTreeForest(const std::string &relationName, int attrByteOffset, Datatype attrType, const std::vector<int> &boundaries,
+                int bufferPagesIn = FORESTBUFFERPAGES, const BTreeIndexOptions &optionsIn = BTreeIndexOptions(),
+                NumaPlacement placementIn = NUMA_LOCAL);
+
+  /**
+   * Destructor. Closes every partition.
+   */
+    ~BTreeForest();
+
+  /**
+   * Number of partitions.
+   */
+    int partitionCount() const;
+
+  /**
+   * Return the partition whose key range holds the key.
+   */
+    int route(int key) const;
+
+  /**
+   * Return partition i.
+   */
+    BTreeIndex &partition(int i);
+
+  /**
+   * Insert an entry into the partition of its key, see BTreeIndex::insertEntry().
+   */
+    InsertStatus insertEntry(const void *key, const RecordId rid, const char *payload = nullptr);
+
+  /**
+   * Insert the entry of a record into the partition of its key, see BTreeIndex::insertRecord().
+   */
+    InsertStatus insertRecord(const std::string &record, const RecordId rid);
+
+  /**
+   * Return the record ids of the entries inside a key range in key order, reading only the partitions that
+   * overlap the range, one after the other.
+   * @param range the key range
+   * @param rids filled with the record ids, cleared first
+   * @throws  BadOpcodesException If the operators of the range are not GT/GTE and LT/LTE
+   * @throws  BadScanrangeException If the low value is above the high value
+   */
+    void scan(const BTreeScanRange &range, std::vector<RecordId> &rids);
+
+  /**
+   * Run a task on every partition, each one in its own thread. The partitions share no file and no buffer
+   * manager, so the task may modify its partition.
+   * @param task called with the partition number and the partition
+   * @throws  the first exception thrown by a task, once every thread is done
+   */
+    void parallelFor(const std::function<void(int part, BTreeIndex &index)> &task);
+
+  /**
+   * Write the dirty pages of every partition to disk, in parallel.
+   */
+    void flush();
+
+  /**
+   * Compact every partition in parallel, see BTreeIndex::compact().
+   */
+    void compact(float fillFactor = 1.0f);
+
+  /**
+   * Drop the file of partition i and build it again from the relation.
+   */
+    void rebuildPartition(int i);
+
+  /**
+   * Delete every entry of partition i, as deleteRange() over its key range does. The other partitions are not read.
+   * @return number of index pages released
+   */
+    int dropPartition(int i);
+};
+
+/**
+ * @brief Number of entries a BTreeShardedIndex collects for one shard before handing them to its writer.
+ */
+const int SHARDBATCHSIZE = 256;
+
+/**
+ * @brief Outcome of the insertions applied by the writers of a BTreeShardedIndex, counted by InsertStatus.
+ */
+struct BTreeShardedInsertStats{
+  /**
+   * Entries added.
+   */
+    long long inserted;
+
+  /**
+   * Entries refused because a unique shard already holds their key.
+   */
+    long long duplicateKeys;
+
+  /**
+   * Entries refused because their key is below the expiry watermark of their shard.
+   */
+    long long expired;
+};
+
+/**
+ * @brief State of the writer thread of one shard of a BTreeShardedIndex.
+ */
+struct ShardWriter{
+  /**
+   * Guards everything below.
+   */
+    std::mutex latch;
+
+  /**
+   * Signalled when a batch is queued or the writer has to stop, and when the writer becomes idle.
+   */
+    std::condition_variable wake;
+    std::condition_variable idle;
+
+  /**
+   * Batches waiting to be inserted, in the order they were handed over.
+   */
+    std::vector<std::vector<RIDKeyPair<int> > > batches;
+
+  /**
+   * Entries collected by BTreeShardedIndex::insertEntry() that do not make a batch yet. Used by the caller only.
+   */
+    std::vector<RIDKeyPair<int> > pending;
+
+  /**
+   * True while the writer inserts a batch it took from the queue.
+   */
+    bool busy;
+    bool stopping;
+
+  /**
+   * First exception thrown by an insertion, rethrown by BTreeShardedIndex::drain().
+   */
+    std::exception_ptr error;
+
+  /**
+   * Statuses of the insertions since the last BTreeShardedIndex::drain().
+   */
+    BTreeShardedInsertStats stats;
+
+    std::thread thread;
+
+    ShardWriter() : busy( false ), stopping( false ), stats() {}
+};
+
+/**
+ * @brief An integer index hash-partitioned into BTreeIndex shards, each one in its own file
+ * (relationName.attrByteOffset.s0, .s1, ...) with its own buffer manager and a writer thread that is the only one to insert
+ * into it, so that insertions on different shards never meet on a root or a latch. Insertions are routed to the
+ * shards in batches and applied asynchronously; drain() waits for them. Point lookups read one shard, range scans
+ * read every shard in parallel and merge the results by key.
+ *
+ * Shards are opened one after the other, then the relation is read once and every record goes to the shard of its
+ * key. Insertions and drain() are meant to be called from one thread; lookups and scans may come from several. The
+ * queued entries are inserted with BTreeIndex::insertEntry(), so the shards can be neither covering nor partial
+ * indexes.
+ *
+ * With NUMA_LOCAL placement, every shard is opened by a thread pinned to its node, so that its buffer pool is
+ * allocated there, and its writer and scan threads run on that node too.
+*/
+class BTreeShardedIndex {
+
+    std::string relationName;
+    int attrByteOffset;
+    NumaPlacement placement;
+
+  /**
+   * Every shard with its buffer manager and writer.
+   */
+    std::vector<BTreeIndex *> shards;
+    std::vector<BufMgr *> bufMgrs;
+    std::vector<ShardWriter *> writers;
+
+  /**
+   * Name of the file of shard i: relationName.attrByteOffset.s followed by i
+   */
+    std::string shardName(int i) const;
+
+  /**
+   * Insert the batches queued for shard i until the writer is stopped.
+   */
+    void writeLoop(int i);
+
+  /**
+   * Queue a batch for the writer of shard i, sorted by key so that consecutive insertions reach the same leaves.
+   */
+    void submit(int i, std::vector<RIDKeyPair<int> > &batch);
+
+ public:
+
+  /**
+   * Open the shards of the index on an attribute of a relation, or create them if the first shard file does not
+   * exist, and start their writers. The relation must be on disk, every shard reads it with its own buffer manager.
+   * @param relationName   Name of the relation
+   * @param attrByteOffset Offset of the integer attribute inside the records
+   * @param attrType       Datatype of the attribute, INTEGER
+   * @param shardCount     Number of shards if they have to be created, typically one per core. Ignored if the
+   *                       index exists, the shards recorded in the meta pages are used then.
+   * @param bufferPages    Buffer frames of every shard
+   * @param options        Options of the shards if they have to be created, the file name and shard aside
+   * @param placementIn    Placement of the shards and their threads on the NUMA nodes
+   * @throws  BadIndexInfoException If there are no shards, or if they have included columns
+   */
+    BTreeShardedIndex(const std::string &relationName, int attrByteOffset, Datatype attrType, int shardCount,
+                      int bufferPages = FORESTBUFFERPAGES, const BTreeIndexOptions &options = BTreeIndexOptions(),
+                      NumaPlacement placementIn = NUMA_LOCAL);
+
+  /**
+   * Destructor. Applies the pending insertions, stops the writers and closes every shard.
+   */
+    ~BTreeShardedIndex();
+
+  /**
+   * Number of shards.
+   */
+    int shardCount() const;
+
+  /**
+   * Return shard i. Only safe to modify once drain() returned and before the next insertion.
+   */
+    BTreeIndex &shard(int i);
+
+  /**
+   * Return the shard of a key.
+   */
+    int route(int key) const;
+
+  /**
+   * Collect an entry for the shard of its key. A full batch goes to the writer of the shard, the rest waits for
+   * the next drain().
+   */
+    void insertEntry(int key, const RecordId rid);
+
+  /**
+   * Split a batch of entries by shard and hand every part to the writer of its shard at once.
+   */
+    void insertBatch(const std::vector<RIDKeyPair<int> > &entries);
+
+  /**
+   * Hand the collected entries over and wait until every writer has inserted everything it was given.
+   * @throws  the first exception an insertion threw
+   */
+    void drain();
+
+  /**
+   * Same as drain(), and report how the insertions applied since the previous drain went: on unique or
+   * expiring shards some entries may have been refused.
+   * @param stats receives the statuses of the insertions
+   * @throws  the first exception an insertion threw
+   */
+    void drain(BTreeShardedInsertStats &stats);
+
+  /**
+   * Return the record ids of the entries of a key. Only the entries inserted before the last drain() are
+   * certain to be seen.
+   * @param key the key
+   * @param rids filled with the record ids, cleared first
+   * @return the number of record ids
+   */
+    int lookup(int key, std::vector<RecordId> &rids);
+
+  /**
+   * Return the record ids of the entries inside a key range in key order. Every shard is read by a thread of its
+   * own over a snapshot, and the sorted results are merged.
+   * @param range the key range
+   * @param rids filled with the record ids, cleared first
+   * @throws  BadOpcodesException If the operators of the range are not GT/GTE and LT/LTE
+   * @throws  BadScanrangeException If the low value is above the high value
+   */
+    void scan(const BTreeScanRange &range, std::vector<RecordId> &rids);
 };
 
 }
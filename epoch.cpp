@@ -0,0 +1,224 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <chrono>
+#include <map>
+#include <stdexcept>
+#include "epoch.h"
+
+namespace badgerdb
+{
+
+// ids of managers are never reused, so a stale entry of a thread never matches a new manager
+static std::atomic<unsigned long> nextManagerId(1);
+// managers alive, so that a thread that exits can give its slots back
+static std::mutex managersLatch;
+static std::map<unsigned long, EpochManager *> managers;
+
+/**
+ * Slot of the calling thread in every manager it is registered with. The slots are released when the thread exits.
+ */
+struct EpochThreadRegistrations {
+	std::map<unsigned long, int> slots;
+
+	~EpochThreadRegistrations()
+	{
+		std::lock_guard<std::mutex> lock(managersLatch);
+		for(std::map<unsigned long, int>::iterator it = slots.begin(); it != slots.end(); ++it)
+		{
+			std::map<unsigned long, EpochManager *>::iterator manager = managers.find(it->first);
+			if(manager != managers.end())
+				manager->second->releaseSlot(it->second);
+		}
+	}
+};
+
+static thread_local EpochThreadRegistrations registrations;
+
+EpochManager::EpochManager(int drainIntervalMs)
+{
+	static_assert(sizeof(ThreadSlot) == EPOCHCACHELINESIZE, "a thread slot must fill one cache line");
+	id = nextManagerId.fetch_add(1);
+	globalEpoch.store(1);
+	//new[] does not honor extended alignment before C++17
+	size_t space = MAXEPOCHTHREADS * sizeof(ThreadSlot) + EPOCHCACHELINESIZE;
+	slotStorage.reset(new char[space]);
+	void *start = slotStorage.get();
+	slots = (ThreadSlot *)std::align(EPOCHCACHELINESIZE, MAXEPOCHTHREADS * sizeof(ThreadSlot), start, space);
+	for(int i = 0; i < MAXEPOCHTHREADS; i++)
+	{
+		new (&slots[i]) ThreadSlot();
+		slots[i].epoch.store(0);
+		slots[i].used.store(false);
+		slots[i].depth = 0;
+	}
+	stopping = false;
+	drainInterval = drainIntervalMs;
+	{
+		std::lock_guard<std::mutex> lock(managersLatch);
+		managers[id] = this;
+	}
+	if(drainInterval > 0)
+	{
+		drainer = std::thread(&EpochManager::drainLoop, this);
+	}
+}
+
+EpochManager::~EpochManager()
+{
+	{
+		std::lock_guard<std::mutex> lock(managersLatch);
+		managers.erase(id);
+	}
+	if(drainer.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(drainerLatch);
+			stopping = true;
+		}
+		drainerWakeup.notify_all();
+		drainer.join();
+	}
+	//nobody is inside an operation anymore
+	std::vector<Retired> remaining;
+	{
+		std::lock_guard<std::mutex> lock(retiredLatch);
+		remaining.swap(retired);
+	}
+	for(size_t i = 0; i < remaining.size(); i++)
+	{
+		remaining[i].reclaim();
+	}
+}
+
+EpochManager::ThreadSlot &EpochManager::threadSlot()
+{
+	std::map<unsigned long, int>::iterator it = registrations.slots.find(id);
+	if(it != registrations.slots.end())
+	{
+		return slots[it->second];
+	}
+	for(int i = 0; i < MAXEPOCHTHREADS; i++)
+	{
+		bool expected = false;
+		if(slots[i].used.compare_exchange_strong(expected, true))
+		{
+			slots[i].epoch.store(0);
+			slots[i].depth = 0;
+			registrations.slots[id] = i;
+			return slots[i];
+		}
+	}
+	throw std::runtime_error("too many threads registered with the epoch manager");
+}
+
+void EpochManager::registerThread()
+{
+	threadSlot();
+}
+
+void EpochManager::unregisterThread()
+{
+	std::map<unsigned long, int>::iterator it = registrations.slots.find(id);
+	if(it == registrations.slots.end())
+	{
+		return;
+	}
+	releaseSlot(it->second);
+	registrations.slots.erase(it);
+}
+
+void EpochManager::releaseSlot(int i)
+{
+	slots[i].epoch.store(0);
+	slots[i].used.store(false);
+}
+
+void EpochManager::enter()
+{
+	ThreadSlot &slot = threadSlot();
+	if(slot.depth++ == 0)
+	{
+		//publish the epoch before reading any shared pointer
+		slot.epoch.store(globalEpoch.load());
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+}
+
+void EpochManager::exit()
+{
+	ThreadSlot &slot = threadSlot();
+	if(--slot.depth == 0)
+	{
+		slot.epoch.store(0, std::memory_order_release);
+	}
+}
+
+void EpochManager::retire(const std::function<void()> &reclaim)
+{
+	Retired entry;
+	entry.reclaim = reclaim;
+	std::lock_guard<std::mutex> lock(retiredLatch);
+	//operations that enter from now on cannot reach the object
+	entry.epoch = globalEpoch.fetch_add(1);
+	retired.push_back(entry);
+}
+
+int EpochManager::drain()
+{
+	std::lock_guard<std::mutex> reclaiming(reclaimLatch);
+	//the oldest epoch an operation in progress entered in
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	uint64_t oldest = UINT64_MAX;
+	for(int i = 0; i < MAXEPOCHTHREADS; i++)
+	{
+		uint64_t epoch = slots[i].epoch.load();
+		if(epoch != 0 && epoch < oldest)
+			oldest = epoch;
+	}
+
+	std::vector<Retired> reclaimable;
+	{
+		std::lock_guard<std::mutex> lock(retiredLatch);
+		//objects are retired in epoch order, so the reclaimable ones form a prefix
+		size_t n = 0;
+		while(n < retired.size() && retired[n].epoch < oldest)
+			n++;
+		reclaimable.assign(retired.begin(), retired.begin() + n);
+		retired.erase(retired.begin(), retired.begin() + n);
+	}
+	for(size_t i = 0; i < reclaimable.size(); i++)
+	{
+		reclaimable[i].reclaim();
+	}
+	return reclaimable.size();
+}
+
+size_t EpochManager::pendingCount()
+{
+	std::lock_guard<std::mutex> lock(retiredLatch);
+	return retired.size();
+}
+
+uint64_t EpochManager::currentEpoch() const
+{
+	return globalEpoch.load();
+}
+
+void EpochManager::drainLoop()
+{
+	std::unique_lock<std::mutex> lock(drainerLatch);
+	while(!stopping)
+	{
+		drainerWakeup.wait_for(lock, std::chrono::milliseconds(drainInterval));
+		lock.unlock();
+		drain();
+		lock.lock();
+	}
+}
+
+}
@@ -0,0 +1,192 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace badgerdb
+{
+
+/**
+ * @brief Maximum number of threads registered with one EpochManager at the same time.
+ */
+const int MAXEPOCHTHREADS = 128;
+
+/**
+ * @brief Default interval in milliseconds between two drains of the background reclaimer.
+ */
+const int EPOCHDRAININTERVAL = 10;
+
+/**
+ * @brief Size of a cache line, the alignment of the per thread slots of an EpochManager.
+ */
+const int EPOCHCACHELINESIZE = 64;
+
+/**
+ * @brief Epoch based reclamation. Readers that follow pointers to shared objects without latches
+ * run every operation inside an epoch guard; writers that unlink an object retire it instead of
+ * freeing it, and it is reclaimed once every thread that was inside an operation at that time has left it.
+ *
+ * The global epoch advances on every retire. A registered thread publishes the epoch it entered in, or 0
+ * while it is outside any operation; an object retired in epoch e is safe to reclaim when every thread
+ * inside an operation entered after e. Retired objects are drained by a background thread or by drain().
+ */
+class EpochManager {
+
+ private:
+
+  /**
+   * Per thread state, padded to a cache line so that readers do not share lines. The slots are allocated apart
+   * and aligned by hand, so that the manager itself, embedded in every BTreeIndex, needs no extended alignment.
+   */
+    struct ThreadSlot {
+        std::atomic<uint64_t> epoch;
+        int depth;
+        std::atomic<bool> used;
+        char padding[EPOCHCACHELINESIZE - sizeof(std::atomic<uint64_t>) - sizeof(int) - sizeof(std::atomic<bool>)];
+    };
+
+  /**
+   * An object waiting for reclamation.
+   */
+    struct Retired {
+        uint64_t epoch;
+        std::function<void()> reclaim;
+    };
+
+  /**
+   * Unique id of this manager, used to find the slot of the calling thread.
+   */
+    unsigned long id;
+
+    std::atomic<uint64_t> globalEpoch;
+
+  /**
+   * MAXEPOCHTHREADS slots starting on a cache line boundary inside slotStorage.
+   */
+    std::unique_ptr<char[]> slotStorage;
+    ThreadSlot *slots;
+
+  /**
+   * Retired objects in retire order, and the latch protecting them.
+   */
+    std::vector<Retired> retired;
+    std::mutex retiredLatch;
+
+  /**
+   * Held while retired objects are reclaimed, so that drain() returns only after a drain of the background
+   * reclaimer that took objects out of the list has reclaimed them.
+   */
+    std::mutex reclaimLatch;
+
+  /**
+   * Background reclaimer.
+   */
+    std::thread drainer;
+    std::mutex drainerLatch;
+    std::condition_variable drainerWakeup;
+    bool stopping;
+    int drainInterval;
+
+  /**
+   * Return the slot of the calling thread, registering it first if needed.
+   */
+    ThreadSlot &threadSlot();
+
+    void drainLoop();
+
+  /**
+   * Give back a slot, when its thread unregisters or exits.
+   */
+    void releaseSlot(int i);
+
+    friend struct EpochThreadRegistrations;
+
+ public:
+
+  /**
+   * Constructor.
+   * @param drainIntervalMs interval between two drains of the background reclaimer, 0 to drain only in drain()
+   */
+    explicit EpochManager(int drainIntervalMs = EPOCHDRAININTERVAL);
+
+  /**
+   * Destructor. Stops the background reclaimer and reclaims every retired object, no thread may be inside an operation.
+   */
+    ~EpochManager();
+
+  /**
+   * Register the calling thread. Threads are also registered by their first enter().
+   * @throws std::runtime_error If MAXEPOCHTHREADS threads are already registered.
+   */
+    void registerThread();
+
+  /**
+   * Unregister the calling thread, which must not be inside an operation.
+   */
+    void unregisterThread();
+
+  /**
+   * Start an operation of the calling thread. Operations may nest, only the outermost one publishes an epoch.
+   */
+    void enter();
+
+  /**
+   * End an operation of the calling thread.
+   */
+    void exit();
+
+  /**
+   * Retire an object that no new operation can reach anymore.
+   * @param reclaim called once no operation can hold a reference to the object, on any thread
+   */
+    void retire(const std::function<void()> &reclaim);
+
+  /**
+   * Reclaim the retired objects that are safe to reclaim.
+   * @return number of objects reclaimed
+   */
+    int drain();
+
+  /**
+   * Number of retired objects not reclaimed yet.
+   */
+    size_t pendingCount();
+
+  /**
+   * Current global epoch.
+   */
+    uint64_t currentEpoch() const;
+};
+
+/**
+ * @brief Guard of one operation: enters the epoch manager when constructed and exits it when destroyed.
+ */
+class EpochGuard {
+    EpochManager &manager;
+
+ public:
+    explicit EpochGuard(EpochManager &managerIn) : manager(managerIn)
+    {
+        manager.enter();
+    }
+
+    ~EpochGuard()
+    {
+        manager.exit();
+    }
+};
+
+}
@@ -6,6 +6,14 @@
  */
 
 #include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <chrono>
+#include <mutex>
+#include <thread>
 #include "btree.h"
 #include "page.h"
 #include "filescan.h"
@@ -19,6 +27,8 @@
 #include "exceptions/bad_opcodes_exception.h"
 #include "exceptions/scan_not_initialized_exception.h"
 #include "exceptions/end_of_file_exception.h"
+#include "exceptions/bad_index_info_exception.h"
+#include "exceptions/buffer_exceeded_exception.h"
 
 #define checkPassFail(a, b) 																				\
 {																																		\
@@ -68,15 +78,56 @@ void createRelationForward();
 void createRelationBackward();
 void createRelationRandom();
 void createRelationSize(int size);
-void intTests();
+void appendRelation(int from, int to);
+void intTests(const BTreeIndexOptions & options = BTreeIndexOptions());
 void testEmpty();
 int intScan(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp);
+int orderedScan(BTreeIndex *index, int size);
+int coveringScan(BTreeIndex *index, int size);
+int filteredScan(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp, const KeyPredicate &predicate);
+int forestScan(BTreeForest *forest, int lowVal, Operator lowOp, int highVal, Operator highOp);
+int shardedScan(BTreeShardedIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp);
+void compactionTests(BTreeIndex *index, int size);
+void freeListTests();
+void snapshotTests();
+void epochTests();
+void writeBackTests();
+void catchUpTests();
+void coveringTests();
+void partialTests();
+void parallelScanTests();
+void keyFilterTests();
+void mergeJoinTests();
+void probeTests();
+void deleteRangeTests();
+void uniqueTests();
+void expiryTests();
+void forestTests();
+void shardedTests();
+void numaTests();
 void indexTests();
 void test1();
 void test2();
 void test3();
 void test4();
 void test5();
+void test6();
+void test7();
+void test8();
+void test9();
+void test10();
+void test11();
+void test12();
+void test13();
+void test14();
+void test15();
+void test16();
+void test17();
+void test18();
+void test19();
+void test20();
+void test21();
+void test22();
 void errorTests();
 void deleteRelation();
 
@@ -146,6 +197,23 @@ int main(int argc, char **argv)
 	test3();
 	test4();
 	test5();
+	test6();
+	test7();
+	test8();
+	test9();
+	test10();
+	test11();
+	test12();
+	test13();
+	test14();
+	test15();
+	test16();
+	test17();
+	test18();
+	test19();
+	test20();
+	test21();
+	test22();
 	errorTests();
 
   return 1;
@@ -212,6 +280,210 @@ void test5()
 	deleteRelation();
 }
 
+void test6()
+{
+	// Create a relation with tuples valued 0 to relationSize in random order and perform index tests
+	// on an index built with slotted leaf nodes
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for slotted leaf nodes" << std::endl;
+	createRelationRandom();
+	testNum = 6;
+	indexTests();
+	deleteRelation();
+}
+
+void test7()
+{
+	// Create a relation with tuples valued 0 to relationSize and scan snapshots of the index
+	// while entries are inserted into it
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for snapshot scans" << std::endl;
+	createRelationForward();
+	testNum = 7;
+	indexTests();
+	deleteRelation();
+}
+
+void test8()
+{
+	// Create a relation with tuples valued 0 to relationSize and insert, scan and compact
+	// the index from several threads while retired pages are reclaimed in the background
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for epoch based reclamation" << std::endl;
+	createRelationForward();
+	testNum = 8;
+	indexTests();
+	deleteRelation();
+}
+
+void test9()
+{
+	// Create a relation with tuples valued 0 to relationSize in random order and perform index tests
+	// on an index whose dirty pages are written by a background writer
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for background write back" << std::endl;
+	createRelationRandom();
+	testNum = 9;
+	indexTests();
+	deleteRelation();
+}
+
+void test10()
+{
+	// Create a relation with tuples valued 0 to relationSize, build the index, then append tuples
+	// to the relation and reopen the index, which indexes only the appended ones
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for incremental catch-up" << std::endl;
+	createRelationForward();
+	testNum = 10;
+	indexTests();
+	deleteRelation();
+}
+
+void test11()
+{
+	// Create a relation with tuples valued 0 to relationSize in random order and scan an index
+	// that stores the double and string attributes with its entries, without reading the relation
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for covering index" << std::endl;
+	createRelationRandom();
+	testNum = 11;
+	indexTests();
+	deleteRelation();
+}
+
+void test12()
+{
+	// Create a relation with tuples valued 0 to relationSize in random order and index only
+	// the tuples whose double attribute satisfies a predicate
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for partial index" << std::endl;
+	createRelationRandom();
+	testNum = 12;
+	indexTests();
+	deleteRelation();
+}
+
+void test13()
+{
+	// Create a relation with tuples valued 0 to relationSize in random order and scan
+	// parts of the index range from several threads
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for parallel range scans" << std::endl;
+	createRelationRandom();
+	testNum = 13;
+	indexTests();
+	deleteRelation();
+}
+
+void test14()
+{
+	// Create a relation with tuples valued 0 to relationSize in random order and scan
+	// the index a leaf at a time with a predicate on the keys
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for key filtering in leaves" << std::endl;
+	createRelationRandom();
+	testNum = 14;
+	indexTests();
+	deleteRelation();
+}
+
+void test15()
+{
+	// Create a relation with tuples valued 0 to relationSize in random order and join
+	// its index with a sparse index on equal keys
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for merge join" << std::endl;
+	createRelationRandom();
+	testNum = 15;
+	indexTests();
+	deleteRelation();
+}
+
+void test16()
+{
+	// Create a relation with tuples valued 0 to relationSize in random order and look up
+	// keys one at a time with a probe cursor
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for probe cursors" << std::endl;
+	createRelationRandom();
+	testNum = 16;
+	indexTests();
+	deleteRelation();
+}
+
+void test17()
+{
+	// Create a relation with tuples valued 0 to relationSize in random order and delete
+	// ranges of keys from the index
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for range deletion" << std::endl;
+	createRelationRandom();
+	testNum = 17;
+	indexTests();
+	deleteRelation();
+}
+
+void test18()
+{
+	// Create a relation with tuples valued 0 to relationSize in random order and build a
+	// unique index on it
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for unique indexes and upserts" << std::endl;
+	createRelationRandom();
+	testNum = 18;
+	indexTests();
+	deleteRelation();
+}
+
+void test19()
+{
+	// Create a relation with tuples valued 0 to relationSize in random order and expire
+	// the keys below a watermark
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for key expiry" << std::endl;
+	createRelationRandom();
+	testNum = 19;
+	indexTests();
+	deleteRelation();
+}
+
+void test20()
+{
+	// Create a relation with tuples valued 0 to relationSize in random order and build a
+	// forest of range partitions on it
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for range-partitioned forests" << std::endl;
+	createRelationRandom();
+	testNum = 20;
+	indexTests();
+	deleteRelation();
+}
+
+void test21()
+{
+	// Create a relation with tuples valued 0 to relationSize in random order and build a
+	// hash-sharded index on it
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for hash-sharded indexes" << std::endl;
+	createRelationRandom();
+	testNum = 21;
+	indexTests();
+	deleteRelation();
+}
+
+void test22()
+{
+	// Create a relation with tuples valued 0 to relationSize in random order and build a
+	// forest and a sharded index on it with every NUMA placement
+	std::cout << "--------------------" << std::endl;
+	std::cout << "self test for NUMA placement" << std::endl;
+	createRelationRandom();
+	testNum = 22;
+	indexTests();
+	deleteRelation();
+}
+
 
 
 
@@ -426,6 +698,42 @@ void createRelationSize(int size)
 	file1->writePage(new_page_number, new_page);
 }
 
+// -----------------------------------------------------------------------------
+// appendRelation
+// -----------------------------------------------------------------------------
+
+void appendRelation(int from, int to)
+{
+  // append tuples valued from to to - 1 on new pages at the end of the relation
+  memset(record1.s, ' ', sizeof(record1.s));
+	PageId new_page_number;
+  Page new_page = file1->allocatePage(new_page_number);
+
+  for(int i = from; i < to; i++ )
+	{
+    sprintf(record1.s, "%05d string record", i);
+    record1.i = i;
+    record1.d = (double)i;
+    std::string new_data(reinterpret_cast<char*>(&record1), sizeof(record1));
+
+		while(1)
+		{
+			try
+			{
+    		new_page.insertRecord(new_data);
+				break;
+			}
+			catch(InsufficientSpaceException e)
+			{
+				file1->writePage(new_page_number, new_page);
+  			new_page = file1->allocatePage(new_page_number);
+			}
+		}
+  }
+
+	file1->writePage(new_page_number, new_page);
+}
+
 // -----------------------------------------------------------------------------
 // indexTests
 // -----------------------------------------------------------------------------
@@ -435,6 +743,7 @@ void indexTests()
   if(testNum == 1)
   {
     intTests();
+	freeListTests();
 		try
 		{
 			File::remove(intIndexName);
@@ -468,95 +777,289 @@ void indexTests()
 	}
 	
   }
-  else if(testNum == 6)
+  else if(testNum == 8)
   {
-	  
-  }
-
-}
-
-// -----------------------------------------------------------------------------
-// intTests
-// -----------------------------------------------------------------------------
-
-void intTests()
-{
-  std::cout << "Create a B+ Tree index on the integer field" << std::endl;
-  BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
-
-	// run some tests
-	checkPassFail(intScan(&index,25,GT,40,LT), 14)
-	checkPassFail(intScan(&index,20,GTE,35,LTE), 16)
-	checkPassFail(intScan(&index,-3,GT,3,LT), 3)
-	checkPassFail(intScan(&index,996,GT,1001,LT), 4)
-	checkPassFail(intScan(&index,0,GT,1,LT), 0)
-	checkPassFail(intScan(&index,300,GT,400,LT), 99)
-	checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
-}
-
-void testEmpty()
-{
-   std::cout << "Create a B+ Tree index on the integer field" << std::endl;
-   BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
-
-	// run some tests
-	checkPassFail(intScan(&index,25,GT,40,LT), 0)
-	checkPassFail(intScan(&index,20,GTE,35,LTE), 0)
-	checkPassFail(intScan(&index,-3,GT,3,LT), 0)
-	checkPassFail(intScan(&index,996,GT,1001,LT), 0)
-	checkPassFail(intScan(&index,0,GT,1,LT), 0)
-	checkPassFail(intScan(&index,300,GT,400,LT), 0)
-	checkPassFail(intScan(&index,3000,GTE,4000,LT), 0)
-}
-
-
-int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp)
-{
-  RecordId scanRid;
-	Page *curPage;
-
-  std::cout << "Scan for ";
-  if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
-  std::cout << lowVal << "," << highVal;
-  if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
-  std::cout << std::endl;
-
-  int numResults = 0;
-	
-	try
+	epochTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+	catch(FileNotFoundException e)
 	{
-  	index->startScan(&lowVal, lowOp, &highVal, highOp);
 	}
-	catch(NoSuchKeyFoundException e)
+  }
+  else if(testNum == 22)
+  {
+	numaTests();
+  }
+  else if(testNum == 21)
+  {
+	shardedTests();
+  }
+  else if(testNum == 20)
+  {
+	forestTests();
+  }
+  else if(testNum == 19)
+  {
+	expiryTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+	catch(FileNotFoundException e)
 	{
-    std::cout << "No Key Found satisfying the scan criteria." << std::endl;
-		return 0;
 	}
-
-	while(1)
-	{
+  }
+  else if(testNum == 18)
+  {
+	uniqueTests();
 		try
 		{
-			index->scanNext(scanRid);
-			bufMgr->readPage(file1, scanRid.page_number, curPage);
-			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(scanRid).data()));
-			bufMgr->unPinPage(file1, scanRid.page_number, false);
-
-			if( numResults < 5 )
-			{
-				std::cout << "at:" << scanRid.page_number << "," << scanRid.slot_number;
-				std::cout << " -->:" << myRec.i << ":" << myRec.d << ":" << myRec.s << ":" <<std::endl;
-			}
-			else if( numResults == 5 )
-			{
-				std::cout << "..." << std::endl;
-			}
+			File::remove(intIndexName);
 		}
-		catch(IndexScanCompletedException e)
+	catch(FileNotFoundException e)
+	{
+	}
+  }
+  else if(testNum == 17)
+  {
+	deleteRangeTests();
+		try
 		{
-			break;
+			File::remove(intIndexName);
 		}
-
+	catch(FileNotFoundException e)
+	{
+	}
+  }
+  else if(testNum == 16)
+  {
+	probeTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+	catch(FileNotFoundException e)
+	{
+	}
+  }
+  else if(testNum == 15)
+  {
+	mergeJoinTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+	catch(FileNotFoundException e)
+	{
+	}
+  }
+  else if(testNum == 14)
+  {
+	keyFilterTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+	catch(FileNotFoundException e)
+	{
+	}
+  }
+  else if(testNum == 13)
+  {
+	parallelScanTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+	catch(FileNotFoundException e)
+	{
+	}
+  }
+  else if(testNum == 12)
+  {
+	partialTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+	catch(FileNotFoundException e)
+	{
+	}
+  }
+  else if(testNum == 11)
+  {
+	coveringTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+	catch(FileNotFoundException e)
+	{
+	}
+  }
+  else if(testNum == 10)
+  {
+	catchUpTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+	catch(FileNotFoundException e)
+	{
+	}
+  }
+  else if(testNum == 9)
+  {
+	writeBackTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+	catch(FileNotFoundException e)
+	{
+	}
+  }
+  else if(testNum == 7)
+  {
+	snapshotTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+	catch(FileNotFoundException e)
+	{
+	}
+  }
+  else if(testNum == 6)
+  {
+	BTreeIndexOptions options;
+	options.leafFormat = SLOTTED_LEAF;
+	intTests(options);
+
+	// reopening the index keeps the leaf format recorded in its meta page
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(orderedScan(&index, relationSize), relationSize)
+	}
+		try
+		{
+			File::remove(intIndexName);
+		}
+	catch(FileNotFoundException e)
+	{
+	}
+  }
+
+}
+
+// -----------------------------------------------------------------------------
+// intTests
+// -----------------------------------------------------------------------------
+
+void intTests(const BTreeIndexOptions & options)
+{
+  std::cout << "Create a B+ Tree index on the integer field" << std::endl;
+  BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, options);
+
+	// run some tests
+	checkPassFail(intScan(&index,25,GT,40,LT), 14)
+	checkPassFail(intScan(&index,20,GTE,35,LTE), 16)
+	checkPassFail(intScan(&index,-3,GT,3,LT), 3)
+	checkPassFail(intScan(&index,996,GT,1001,LT), 4)
+	checkPassFail(intScan(&index,0,GT,1,LT), 0)
+	checkPassFail(intScan(&index,300,GT,400,LT), 99)
+	checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+
+	// a full scan must return every key exactly once and in order
+	checkPassFail(orderedScan(&index, (testNum == 5 ? 300000 : relationSize)), (testNum == 5 ? 300000 : relationSize))
+
+	// the shape report must account for every record and every page
+	BTreeShapeStats stats;
+	index.analyzeShape(stats);
+	checkPassFail(stats.leafEntries, (testNum == 5 ? 300000 : relationSize))
+	checkPassFail(stats.unreachablePages, 0)
+
+	compactionTests(&index, (testNum == 5 ? 300000 : relationSize));
+
+	// an insert that does not split dirties only its leaf, the pages read on the way down stay clean
+	BTreeWriteStats writeStats;
+	RecordId outsideRid;
+	outsideRid.page_number = 1;
+	outsideRid.slot_number = 1;
+	int outsideKey = (testNum == 5 ? 300000 : relationSize);
+	index.clearWriteStats();
+	index.insertEntry(&outsideKey, outsideRid);
+	index.getWriteStats(writeStats);
+	checkPassFail(writeStats.inserts, 1)
+	checkPassFail(writeStats.pagesDirtied, 1)
+}
+
+void testEmpty()
+{
+   std::cout << "Create a B+ Tree index on the integer field" << std::endl;
+   BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+
+	// run some tests
+	checkPassFail(intScan(&index,25,GT,40,LT), 0)
+	checkPassFail(intScan(&index,20,GTE,35,LTE), 0)
+	checkPassFail(intScan(&index,-3,GT,3,LT), 0)
+	checkPassFail(intScan(&index,996,GT,1001,LT), 0)
+	checkPassFail(intScan(&index,0,GT,1,LT), 0)
+	checkPassFail(intScan(&index,300,GT,400,LT), 0)
+	checkPassFail(intScan(&index,3000,GTE,4000,LT), 0)
+}
+
+
+int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp)
+{
+  RecordId scanRid;
+	Page *curPage;
+
+  std::cout << "Scan for ";
+  if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
+  std::cout << lowVal << "," << highVal;
+  if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
+  std::cout << std::endl;
+
+  int numResults = 0;
+	
+	try
+	{
+  	index->startScan(&lowVal, lowOp, &highVal, highOp);
+	}
+	catch(NoSuchKeyFoundException e)
+	{
+    std::cout << "No Key Found satisfying the scan criteria." << std::endl;
+		return 0;
+	}
+
+	while(1)
+	{
+		try
+		{
+			index->scanNext(scanRid);
+			bufMgr->readPage(file1, scanRid.page_number, curPage);
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(scanRid).data()));
+			bufMgr->unPinPage(file1, scanRid.page_number, false);
+
+			if( numResults < 5 )
+			{
+				std::cout << "at:" << scanRid.page_number << "," << scanRid.slot_number;
+				std::cout << " -->:" << myRec.i << ":" << myRec.d << ":" << myRec.s << ":" <<std::endl;
+			}
+			else if( numResults == 5 )
+			{
+				std::cout << "..." << std::endl;
+			}
+		}
+		catch(IndexScanCompletedException e)
+		{
+			break;
+		}
+
 		numResults++;
 	}
 
@@ -571,6 +1074,1771 @@ int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operato
 }
 
 
+// return how many entries of a full scan carry the keys 0, 1, 2, ... size-1 in that order
+int orderedScan(BTreeIndex * index, int size)
+{
+	RecordId scanRid;
+	Page *curPage;
+	int lowVal = 0;
+	int highVal = size - 1;
+	int numResults = 0;
+
+	std::cout << "Ordered scan for [" << lowVal << "," << highVal << "]" << std::endl;
+	try
+	{
+		index->startScan(&lowVal, GTE, &highVal, LTE);
+	}
+	catch(NoSuchKeyFoundException e)
+	{
+		return 0;
+	}
+
+	try
+	{
+		while(1)
+		{
+			index->scanNext(scanRid);
+			bufMgr->readPage(file1, scanRid.page_number, curPage);
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(scanRid).data()));
+			bufMgr->unPinPage(file1, scanRid.page_number, false);
+			if(myRec.i != numResults)
+				break;
+			numResults++;
+		}
+	}
+	catch(IndexScanCompletedException e)
+	{
+	}
+	index->endScan();
+
+	return numResults;
+}
+
+// -----------------------------------------------------------------------------
+// coveringScan
+// -----------------------------------------------------------------------------
+
+int coveringScan(BTreeIndex * index, int size)
+{
+	RecordId scanRid;
+	char payload[MAXPAYLOADSIZE];
+	int lowVal = 0;
+	int highVal = size - 1;
+	int numResults = 0;
+
+	// the double and the first 5 characters of the string come from the index, the relation is not read
+	std::cout << "Index-only scan for [" << lowVal << "," << highVal << "]" << std::endl;
+	try
+	{
+		index->startScan(&lowVal, GTE, &highVal, LTE);
+	}
+	catch(NoSuchKeyFoundException e)
+	{
+		return 0;
+	}
+
+	try
+	{
+		while(1)
+		{
+			index->scanNext(scanRid, payload);
+			double d;
+			memcpy(&d, payload, sizeof(double));
+			char s[12];
+			snprintf(s, sizeof(s), "%05d", numResults);
+			if(d != (double)numResults || memcmp(payload + sizeof(double), s, 5) != 0)
+				break;
+			numResults++;
+		}
+	}
+	catch(IndexScanCompletedException e)
+	{
+	}
+	index->endScan();
+
+	return numResults;
+}
+
+// -----------------------------------------------------------------------------
+// compactionTests
+// -----------------------------------------------------------------------------
+
+void compactionTests(BTreeIndex * index, int size)
+{
+	std::cout << "Compact the index while a scan is executing" << std::endl;
+	RecordId scanRid;
+	Page *curPage;
+	int lowVal = 0;
+	int highVal = size - 1;
+	int numResults = 0;
+
+	// the scan started on the old version must see all of it after the switch
+	index->startScan(&lowVal, GTE, &highVal, LTE);
+	try
+	{
+		while(1)
+		{
+			if(numResults == size / 2)
+				index->compact();
+			index->scanNext(scanRid);
+			bufMgr->readPage(file1, scanRid.page_number, curPage);
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(scanRid).data()));
+			bufMgr->unPinPage(file1, scanRid.page_number, false);
+			if(myRec.i != numResults)
+				break;
+			numResults++;
+		}
+	}
+	catch(IndexScanCompletedException e)
+	{
+	}
+	index->endScan();
+	checkPassFail(numResults, size)
+
+	// the new leaves follow each other in the file and the old pages are free
+	BTreeShapeStats stats;
+	index->analyzeShape(stats);
+	checkPassFail(stats.leafEntries, size)
+	checkPassFail(stats.sequentialLeafLinks, stats.leafLinks)
+	checkPassFail(stats.unreachablePages, 0)
+	checkPassFail((stats.freePages > 0), true)
+
+	// a sparser version reuses the freed pages
+	index->compact(0.5);
+	checkPassFail(intScan(index,25,GT,40,LT), 14)
+	checkPassFail(orderedScan(index, size), size)
+	index->analyzeShape(stats);
+	checkPassFail(stats.leafEntries, size)
+	checkPassFail(stats.unreachablePages, 0)
+}
+
+// -----------------------------------------------------------------------------
+// freeListTests
+// -----------------------------------------------------------------------------
+
+void freeListTests()
+{
+	std::cout << "Reopen an index with free pages" << std::endl;
+	// full leaves, so that the next insertion into one splits it
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		index.compact();
+	}
+
+	// the free pages in the file, and the pages of the free page list among them
+	std::set<PageId> freePages;
+	std::set<PageId> listPages;
+	{
+		BlobFile indexFile = BlobFile::open(intIndexName);
+		Page headerPage = indexFile.readPage(indexFile.getFirstPageNo());
+		IndexMetaInfo *meta = (IndexMetaInfo *)&headerPage;
+		for(PageId pid = indexFile.getFirstPageNo() + 1; pid <= meta->lastPageNo; pid++)
+		{
+			Page page = indexFile.readPage(pid);
+			if(((FreePageList *)&page)->level == FREEPAGELEVEL)
+				freePages.insert(pid);
+		}
+		for(PageId pid = meta->freeListPageNo; pid != 0; )
+		{
+			listPages.insert(pid);
+			Page page = indexFile.readPage(pid);
+			pid = ((FreePageList *)&page)->nextPageNo;
+		}
+	}
+	checkPassFail(listPages.empty(), false)
+	checkPassFail(std::includes(freePages.begin(), freePages.end(), listPages.begin(), listPages.end()), true)
+
+	// a leaf split takes the free page closest to the leaf
+	RecordId splitRid;
+	splitRid.page_number = 1;
+	splitRid.slot_number = 0;
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		BTreeShapeStats stats;
+		index.analyzeShape(stats);
+		int leafCount = stats.leafCount;
+		int key = relationSize / 2;
+		while(stats.leafCount == leafCount)
+		{
+			index.insertEntry(&key, splitRid);
+			index.analyzeShape(stats);
+		}
+	}
+	PageId newLeaf = 0;
+	PageId splitLeaf = 0;
+	{
+		BlobFile indexFile = BlobFile::open(intIndexName);
+		for(std::set<PageId>::iterator it = freePages.begin(); it != freePages.end(); ++it)
+		{
+			Page page = indexFile.readPage(*it);
+			if(((LeafNodeInt *)&page)->level == -1)
+				newLeaf = *it;
+		}
+		Page headerPage = indexFile.readPage(indexFile.getFirstPageNo());
+		PageId lastPageNo = ((IndexMetaInfo *)&headerPage)->lastPageNo;
+		for(PageId pid = indexFile.getFirstPageNo() + 1; pid <= lastPageNo; pid++)
+		{
+			Page page = indexFile.readPage(pid);
+			if(((LeafNodeInt *)&page)->level == -1 && ((LeafNodeInt *)&page)->rightSibPageNo == newLeaf)
+				splitLeaf = pid;
+		}
+	}
+	checkPassFail((newLeaf != 0 && splitLeaf != 0), true)
+	int closer = 0;
+	for(std::set<PageId>::iterator it = freePages.begin(); it != freePages.end(); ++it)
+	{
+		if(std::abs((long long)*it - splitLeaf) < std::abs((long long)newLeaf - splitLeaf))
+			closer++;
+	}
+	checkPassFail(closer, 0)
+
+	// every free page is reused before the file grows, the pages that held the list as well
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		BTreeShapeStats stats;
+		for(int round = 0; round < 20; round++)
+		{
+			for(int key = 0; key < relationSize; key++)
+			{
+				index.insertEntry(&key, splitRid);
+			}
+			index.analyzeShape(stats);
+			if(stats.freePages == 0)
+				break;
+		}
+		checkPassFail(stats.freePages, 0)
+		checkPassFail(stats.unreachablePages, 0)
+	}
+}
+
+// -----------------------------------------------------------------------------
+// snapshotTests
+// -----------------------------------------------------------------------------
+
+void snapshotTests()
+{
+	std::cout << "Create a B+ Tree index on the integer field" << std::endl;
+	BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+	BTreeSnapshot snapshot = index.takeSnapshot();
+
+	RecordId scanRid;
+	Page *curPage;
+	std::vector<RecordId> rids;
+	int lowVal = 0;
+	int highVal = relationSize - 1;
+	int half = relationSize / 2;
+	int numResults = 0;
+
+	// insert entries ahead of the scan, enough to split the leaves it has not read yet.
+	// They point to the records already scanned, so the scan would see keys out of order if it read them
+	std::cout << "Insert into the index while a scan is executing" << std::endl;
+	index.startScan(&lowVal, GTE, &highVal, LTE);
+	try
+	{
+		while(1)
+		{
+			if(numResults == half)
+			{
+				for(int i = 0; i < half; i++)
+				{
+					int key = half + i;
+					index.insertEntry(&key, rids[i]);
+				}
+			}
+			index.scanNext(scanRid);
+			bufMgr->readPage(file1, scanRid.page_number, curPage);
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(scanRid).data()));
+			bufMgr->unPinPage(file1, scanRid.page_number, false);
+			if(myRec.i != numResults)
+				break;
+			rids.push_back(scanRid);
+			numResults++;
+		}
+	}
+	catch(IndexScanCompletedException e)
+	{
+	}
+	index.endScan();
+	checkPassFail(numResults, relationSize)
+
+	// the index has the new entries, the snapshot taken before does not
+	checkPassFail(intScan(&index, half, GTE, relationSize, LT), relationSize)
+	numResults = 0;
+	index.startScan(&half, GTE, &highVal, LTE, &snapshot);
+	try
+	{
+		while(1)
+		{
+			index.scanNext(scanRid);
+			numResults++;
+		}
+	}
+	catch(IndexScanCompletedException e)
+	{
+	}
+	index.endScan();
+	checkPassFail(numResults, relationSize - half)
+
+	// releasing the snapshot frees every before-image
+	index.releaseSnapshot(snapshot);
+	BTreeShapeStats stats;
+	index.analyzeShape(stats);
+	checkPassFail(stats.snapshotPages, 0)
+	checkPassFail(stats.unreachablePages, 0)
+	checkPassFail(stats.leafEntries, relationSize + half)
+}
+
+// -----------------------------------------------------------------------------
+// epochTests
+// -----------------------------------------------------------------------------
+
+struct EpochTestNode {
+	std::atomic<bool> reclaimed;
+};
+
+void epochTests()
+{
+	// readers hold the current node inside an epoch guard while a writer keeps replacing and retiring it.
+	// A reader must never see a node that has been reclaimed
+	std::cout << "Replace and retire nodes under concurrent readers" << std::endl;
+	{
+		EpochManager epochs(1);
+		const int nodeCount = 20000;
+		std::vector<EpochTestNode> nodes(nodeCount);
+		for(int i = 0; i < nodeCount; i++)
+			nodes[i].reclaimed.store(false);
+		std::atomic<EpochTestNode *> current(&nodes[0]);
+		std::atomic<bool> done(false);
+		std::atomic<int> violations(0);
+		std::vector<std::thread> readers;
+		for(int t = 0; t < 4; t++)
+		{
+			readers.push_back(std::thread([&]()
+			{
+				while(!done.load())
+				{
+					EpochGuard guard(epochs);
+					EpochTestNode *node = current.load();
+					for(int k = 0; k < 100; k++)
+					{
+						if(node->reclaimed.load())
+						{
+							violations++;
+							break;
+						}
+					}
+				}
+				epochs.unregisterThread();
+			}));
+		}
+		for(int i = 1; i < nodeCount; i++)
+		{
+			EpochTestNode *old = current.exchange(&nodes[i]);
+			epochs.retire([old]() { old->reclaimed.store(true); });
+		}
+		done.store(true);
+		for(size_t t = 0; t < readers.size(); t++)
+			readers[t].join();
+		epochs.drain();
+		checkPassFail(violations.load(), 0)
+		checkPassFail((int)epochs.pendingCount(), 0)
+		checkPassFail(nodes[nodeCount/2].reclaimed.load(), true)
+	}
+
+	// insert, scan and compact the index from several threads. The buffer manager is not thread safe,
+	// so every call takes a latch, but the calls of the scan interleave with the others
+	std::cout << "Insert, scan and compact the index from several threads" << std::endl;
+	BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+	std::mutex latch;
+	std::vector<RecordId> rids(relationSize);
+	{
+		RecordId scanRid;
+		Page *curPage;
+		int lowVal = 0;
+		int highVal = relationSize - 1;
+		index.startScan(&lowVal, GTE, &highVal, LTE);
+		try
+		{
+			while(1)
+			{
+				index.scanNext(scanRid);
+				bufMgr->readPage(file1, scanRid.page_number, curPage);
+				RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(scanRid).data()));
+				bufMgr->unPinPage(file1, scanRid.page_number, false);
+				rids[myRec.i] = scanRid;
+			}
+		}
+		catch(IndexScanCompletedException e)
+		{
+		}
+		index.endScan();
+	}
+
+	const int insertsPerThread = 2000;
+	std::atomic<bool> stop(false);
+	std::atomic<int> scanErrors(0);
+	std::atomic<int> scansDone(0);
+	std::vector<std::thread> inserters;
+	for(int t = 0; t < 2; t++)
+	{
+		inserters.push_back(std::thread([&, t]()
+		{
+			for(int i = 0; i < insertsPerThread; i++)
+			{
+				int key = (i * 7919 + t) % relationSize;
+				std::lock_guard<std::mutex> lock(latch);
+				index.insertEntry(&key, rids[key]);
+				if(t == 0 && i % 500 == 499)
+					index.compact();
+			}
+		}));
+	}
+	std::thread scanner([&]()
+	{
+		while(!stop.load() || scansDone.load() == 0)
+		{
+			RecordId scanRid;
+			Page *curPage;
+			int lowVal = 0;
+			int highVal = relationSize - 1;
+			int previous = -1;
+			int count = 0;
+			{
+				std::lock_guard<std::mutex> lock(latch);
+				index.startScan(&lowVal, GTE, &highVal, LTE);
+			}
+			while(1)
+			{
+				std::lock_guard<std::mutex> lock(latch);
+				try
+				{
+					index.scanNext(scanRid);
+				}
+				catch(IndexScanCompletedException e)
+				{
+					break;
+				}
+				bufMgr->readPage(file1, scanRid.page_number, curPage);
+				RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(scanRid).data()));
+				bufMgr->unPinPage(file1, scanRid.page_number, false);
+				if(myRec.i < previous)
+					scanErrors++;
+				previous = myRec.i;
+				count++;
+			}
+			{
+				std::lock_guard<std::mutex> lock(latch);
+				index.endScan();
+			}
+			if(count < relationSize)
+				scanErrors++;
+			scansDone++;
+		}
+	});
+	for(size_t t = 0; t < inserters.size(); t++)
+		inserters[t].join();
+	stop.store(true);
+	scanner.join();
+
+	checkPassFail(scanErrors.load(), 0)
+	BTreeShapeStats stats;
+	index.analyzeShape(stats);
+	checkPassFail(stats.leafEntries, relationSize + 2 * insertsPerThread)
+	checkPassFail(stats.unreachablePages, 0)
+	checkPassFail(stats.snapshotPages, 0)
+}
+
+// -----------------------------------------------------------------------------
+// writeBackTests
+// -----------------------------------------------------------------------------
+
+void writeBackTests()
+{
+	BTreeIndexOptions options;
+	options.writeBackRate = 100000;
+	options.maxDirtyPages = 16;
+	intTests(options);
+
+	// rewriting the whole tree leaves more dirty pages than the writer keeps, it writes them while the index is open
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, options);
+		index.compact(0.5);
+		BTreeWriteStats writeStats;
+		for(int i = 0; i < 100; i++)
+		{
+			index.getWriteStats(writeStats);
+			if(writeStats.pagesWrittenInBackground > 0)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(WRITEBACKINTERVAL));
+		}
+		checkPassFail((writeStats.pagesWrittenInBackground > 0), true)
+		checkPassFail((writeStats.pagesWrittenInForeground > 0), true)
+	}
+
+	// every page the writer wrote, and the tail written when closing, is on disk
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(orderedScan(&index, relationSize), relationSize)
+		BTreeShapeStats stats;
+		index.analyzeShape(stats);
+		checkPassFail(stats.leafEntries, relationSize + 1)
+		checkPassFail(stats.unreachablePages, 0)
+	}
+
+	// a build that fails stops the writer before the exception leaves the constructor
+	try
+	{
+		std::string missingIndexName;
+		BTreeIndex index("relMissing", missingIndexName, bufMgr, offsetof(tuple,i), INTEGER, options);
+		std::cout << "an index over a missing relation was built" << std::endl;
+		exit(1);
+	}
+	catch(FileNotFoundException e)
+	{
+		std::cout << "Build over a missing relation failed as expected" << std::endl;
+	}
+	File::remove("relMissing." + std::to_string(offsetof(tuple,i)));
+}
+
+// -----------------------------------------------------------------------------
+// catchUpTests
+// -----------------------------------------------------------------------------
+
+void catchUpTests()
+{
+	int appended = 3000;
+	{
+		std::cout << "Create a B+ Tree index on the integer field" << std::endl;
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(orderedScan(&index, relationSize), relationSize)
+	}
+
+	// the appended records are indexed when the index is opened again, the others are not inserted twice
+	appendRelation(relationSize, relationSize + appended);
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		BTreeWriteStats writeStats;
+		index.getWriteStats(writeStats);
+		checkPassFail(writeStats.inserts, appended)
+		checkPassFail(intScan(&index,relationSize - 5,GTE,relationSize + 5,LT), 10)
+		checkPassFail(orderedScan(&index, relationSize + appended), relationSize + appended)
+	}
+
+	// nothing was appended since, only the last page of the relation is read
+	{
+		bufMgr->clearBufStats();
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail((bufMgr->getBufStats().accesses < 10), true)
+		BTreeWriteStats writeStats;
+		index.getWriteStats(writeStats);
+		checkPassFail(writeStats.inserts, 0)
+		BTreeShapeStats stats;
+		index.analyzeShape(stats);
+		checkPassFail(stats.leafEntries, relationSize + appended)
+		checkPassFail(stats.unreachablePages, 0)
+	}
+
+	// an index file written before the last indexed record was kept reads it as unset, and is not caught up;
+	// one written before the last page was kept finds it from the tree
+	{
+		BlobFile indexFile = BlobFile::open(intIndexName);
+		Page *headerPage;
+		bufMgr->readPage(&indexFile, indexFile.getFirstPageNo(), headerPage);
+		IndexMetaInfo *meta = (IndexMetaInfo *)headerPage;
+		meta->hasLastIndexedRid = false;
+		meta->lastPageNo = 0;
+		meta->lastIndexedRid.page_number = 0;
+		meta->lastIndexedRid.slot_number = 0;
+		bufMgr->unPinPage(&indexFile, indexFile.getFirstPageNo(), true);
+		bufMgr->flushFile(&indexFile);
+	}
+	for(int i = 0; i < 2; i++)
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		BTreeWriteStats writeStats;
+		index.getWriteStats(writeStats);
+		checkPassFail(writeStats.inserts, 0)
+		BTreeShapeStats stats;
+		index.analyzeShape(stats);
+		checkPassFail(stats.leafEntries, relationSize + appended)
+	}
+}
+
+// -----------------------------------------------------------------------------
+// coveringTests
+// -----------------------------------------------------------------------------
+
+void coveringTests()
+{
+	BTreeIndexOptions options;
+	IncludedColumn column;
+	column.offset = offsetof(tuple,d);
+	column.length = sizeof(double);
+	options.includedColumns.push_back(column);
+	column.offset = offsetof(tuple,s);
+	column.length = 5;
+	options.includedColumns.push_back(column);
+
+	{
+		std::cout << "Create a covering B+ Tree index on the integer field" << std::endl;
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, options);
+		checkPassFail(index.getPayloadSize(), (int)sizeof(double) + 5)
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(coveringScan(&index, relationSize), relationSize)
+
+		// a record inserted later carries its columns, and compaction moves them with the entries
+		RECORD extra;
+		memset(&extra, ' ', sizeof(extra));
+		extra.i = relationSize;
+		extra.d = (double)relationSize;
+		sprintf(extra.s, "%05d string record", relationSize);
+		RecordId extraRid;
+		extraRid.page_number = 1;
+		extraRid.slot_number = 1;
+		index.insertRecord(std::string(reinterpret_cast<char*>(&extra), sizeof(extra)), extraRid);
+		index.compact(0.5);
+		checkPassFail(coveringScan(&index, relationSize + 1), relationSize + 1)
+	}
+
+	// the included columns are recorded in the meta page
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(index.getPayloadSize(), (int)sizeof(double) + 5)
+		checkPassFail(coveringScan(&index, relationSize + 1), relationSize + 1)
+		BTreeShapeStats stats;
+		index.analyzeShape(stats);
+		checkPassFail(stats.leafEntries, relationSize + 1)
+		checkPassFail(stats.unreachablePages, 0)
+	}
+	File::remove(intIndexName);
+
+	// a one byte column leaves padding in every entry, only the byte given is read
+	{
+		BTreeIndexOptions narrow;
+		column.offset = offsetof(tuple,s);
+		column.length = 1;
+		narrow.includedColumns.push_back(column);
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, narrow);
+		checkPassFail(index.getPayloadSize(), 1)
+		RecordId extraRid;
+		extraRid.page_number = 1;
+		extraRid.slot_number = 1;
+		char *payload = new char[1];
+		payload[0] = 'x';
+		for(int key = relationSize; key < relationSize + 2 * SLOTTEDLEAFSIZE; key++)
+		{
+			index.insertEntry(&key, extraRid, payload);
+		}
+		int lowVal = relationSize;
+		payload[0] = 'y';
+		checkPassFail(index.upsert(&lowVal, extraRid, payload), REPLACED)
+		delete[] payload;
+		char scanned[MAXPAYLOADSIZE];
+		int matching = 0;
+		index.startScan(&lowVal, GTE, &lowVal, LTE);
+		index.scanNext(extraRid, scanned);
+		index.endScan();
+		matching += scanned[0] == 'y';
+		lowVal = 0;
+		index.startScan(&lowVal, GTE, &lowVal, LTE);
+		index.scanNext(extraRid, scanned);
+		index.endScan();
+		matching += scanned[0] == '0';
+		checkPassFail(matching, 2)
+	}
+}
+
+// -----------------------------------------------------------------------------
+// partialTests
+// -----------------------------------------------------------------------------
+
+void partialTests()
+{
+	// only the last tenth of the tuples is indexed
+	int active = relationSize - relationSize / 10;
+	BTreeIndexOptions options;
+	options.predicate.enabled = true;
+	options.predicate.offset = offsetof(tuple,d);
+	options.predicate.type = DOUBLE;
+	options.predicate.op = GTE;
+	options.predicate.value = active;
+
+	{
+		std::cout << "Create a partial B+ Tree index on the integer field" << std::endl;
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, options);
+		checkPassFail(intScan(&index,25,GT,40,LT), 0)
+		checkPassFail(intScan(&index,active - 10,GTE,active + 10,LT), 10)
+		BTreeWriteStats writeStats;
+		index.getWriteStats(writeStats);
+		checkPassFail(writeStats.inserts, relationSize / 10)
+
+		// insertRecord() applies the predicate as well
+		RECORD extra;
+		memset(&extra, ' ', sizeof(extra));
+		RecordId extraRid;
+		extraRid.page_number = 1;
+		extraRid.slot_number = 1;
+		extra.i = -1;
+		extra.d = -1;
+		index.insertRecord(std::string(reinterpret_cast<char*>(&extra), sizeof(extra)), extraRid);
+		extra.i = relationSize;
+		extra.d = relationSize;
+		index.insertRecord(std::string(reinterpret_cast<char*>(&extra), sizeof(extra)), extraRid);
+		index.getWriteStats(writeStats);
+		checkPassFail(writeStats.inserts, relationSize / 10 + 1)
+	}
+
+	// the predicate is recorded in the meta page
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		RECORD extra;
+		memset(&extra, ' ', sizeof(extra));
+		extra.i = 0;
+		extra.d = 0;
+		RecordId extraRid;
+		extraRid.page_number = 1;
+		extraRid.slot_number = 1;
+		index.insertRecord(std::string(reinterpret_cast<char*>(&extra), sizeof(extra)), extraRid);
+		BTreeShapeStats stats;
+		index.analyzeShape(stats);
+		checkPassFail(stats.leafEntries, relationSize / 10 + 1)
+		checkPassFail(stats.unreachablePages, 0)
+	}
+}
+
+// -----------------------------------------------------------------------------
+// parallelScanTests
+// -----------------------------------------------------------------------------
+
+void parallelScanTests()
+{
+	std::cout << "Create a B+ Tree index on the integer field" << std::endl;
+	BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+
+	// the parts follow each other without gaps
+	BTreeScanRange range;
+	range.lowVal = 0;
+	range.lowOp = GTE;
+	range.highVal = relationSize - 1;
+	range.highOp = LTE;
+	std::vector<BTreeScanRange> ranges;
+	index.splitRange(range, 4, ranges);
+	checkPassFail((int)ranges.size(), 4)
+	int gaps = 0;
+	for(size_t i = 1; i < ranges.size(); i++)
+	{
+		if(ranges[i].lowVal != ranges[i-1].highVal || ranges[i].lowOp != GTE || ranges[i-1].highOp != LT)
+			gaps++;
+	}
+	checkPassFail(gaps, 0)
+
+	// the merged result is the whole range in key order
+	std::cout << "Parallel scan for [" << range.lowVal << "," << range.highVal << "]" << std::endl;
+	std::vector<RecordId> rids;
+	index.parallelScan(range, 4, rids);
+	int numResults = 0;
+	for(size_t i = 0; i < rids.size(); i++)
+	{
+		Page *curPage;
+		bufMgr->readPage(file1, rids[i].page_number, curPage);
+		RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(rids[i]).data()));
+		bufMgr->unPinPage(file1, rids[i].page_number, false);
+		if(myRec.i != numResults)
+			break;
+		numResults++;
+	}
+	checkPassFail(numResults, relationSize)
+
+	// every part is visited in key order by its own thread
+	range.lowVal = 25;
+	range.lowOp = GT;
+	range.highVal = 3000;
+	range.highOp = LT;
+	std::vector<int> lastKeys(3, INT_MIN);
+	std::atomic<int> visited(0);
+	std::atomic<int> outOfOrder(0);
+	index.parallelScan(range, 3, [&](int part, int key, RecordId /*rid*/)
+	{
+		if(key <= lastKeys[part] || key <= 25 || key >= 3000)
+			outOfOrder++;
+		lastKeys[part] = key;
+		visited++;
+	});
+	checkPassFail(visited.load(), 2974)
+	checkPassFail(outOfOrder.load(), 0)
+}
+
+// -----------------------------------------------------------------------------
+// keyFilterTests
+// -----------------------------------------------------------------------------
+
+int filteredScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp, const KeyPredicate &predicate)
+{
+	int numResults = 0;
+	int lastKey = INT_MIN;
+	std::vector<RecordId> rids;
+
+	index->startScan(&lowVal, lowOp, &highVal, highOp);
+	while(1)
+	{
+		try
+		{
+			index->scanNextLeaf(rids, predicate);
+		}
+		catch(IndexScanCompletedException e)
+		{
+			break;
+		}
+
+		// every record returned satisfies the predicate and the keys are in order
+		for(size_t i = 0; i < rids.size(); i++)
+		{
+			Page *curPage;
+			bufMgr->readPage(file1, rids[i].page_number, curPage);
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(rids[i]).data()));
+			bufMgr->unPinPage(file1, rids[i].page_number, false);
+			int rest = ((myRec.i % predicate.modulus) + predicate.modulus) % predicate.modulus;
+			bool excluded = std::find(predicate.excluded.begin(), predicate.excluded.end(), myRec.i) != predicate.excluded.end();
+			if(rest != predicate.remainder || excluded || myRec.i <= lastKey)
+			{
+				index->endScan();
+				return -1;
+			}
+			lastKey = myRec.i;
+			numResults++;
+		}
+	}
+	index->endScan();
+	return numResults;
+}
+
+void keyFilterTests()
+{
+	// the kernel, with negative keys and a tail shorter than a vector
+	int keys[] = {-33, -32, -16, -1, 0, 5, 16, 17, 31, 32, 48, 64, 80};
+	int selection[13];
+	KeyPredicate predicate;
+	predicate.modulus = 16;
+	predicate.remainder = 0;
+	predicate.excluded.push_back(48);
+	checkPassFail(BTreeIndex::filterKeys(keys, 13, predicate, selection), 7)
+	checkPassFail((selection[0] == 1 && selection[1] == 2 && selection[6] == 12), true)
+	predicate.modulus = 3;
+	predicate.remainder = 2;
+	checkPassFail(BTreeIndex::filterKeys(keys, 13, predicate, selection), 6)
+	checkPassFail((selection[0] == 2 && selection[1] == 3 && selection[5] == 12), true)
+
+	for(int format = 0; format < 2; format++)
+	{
+		BTreeIndexOptions options;
+		options.leafFormat = (format == 0 ? SORTED_LEAF : SLOTTED_LEAF);
+		std::cout << "Create a B+ Tree index on the integer field" << (format == 0 ? "" : " with slotted leaves") << std::endl;
+		{
+			BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, options);
+
+			// multiples of 16 in [100,5000) except two of them
+			predicate.modulus = 16;
+			predicate.remainder = 0;
+			predicate.excluded.clear();
+			predicate.excluded.push_back(160);
+			predicate.excluded.push_back(4000);
+			checkPassFail(filteredScan(&index, 100, GTE, 5000, LT, predicate), 304)
+
+			// one in three keys of the whole relation, the range ends on the last key
+			predicate.modulus = 3;
+			predicate.remainder = 1;
+			predicate.excluded.clear();
+			checkPassFail(filteredScan(&index, 0, GTE, relationSize - 1, LTE, predicate), 1667)
+
+			// no key in range matches
+			predicate.modulus = 64;
+			predicate.remainder = 7;
+			checkPassFail(filteredScan(&index, 10, GT, 60, LTE, predicate), 0)
+		}
+		File::remove(intIndexName);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// mergeJoinTests
+// -----------------------------------------------------------------------------
+
+void mergeJoinTests()
+{
+	const std::string sparseRelationName = "relB";
+	std::string sparseIndexName;
+	std::cout << "Create a B+ Tree index on the integer field" << std::endl;
+	BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+
+	// a second relation with two tuples for every 1500th value, far enough apart that
+	// the side of the first relation descends again to reach them
+	std::map<PageId, std::map<SlotId, int> > sparseKeys;
+	try
+	{
+		File::remove(sparseRelationName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+	{
+		PageFile sparseFile = PageFile::create(sparseRelationName);
+		PageId pageNo;
+		Page page = sparseFile.allocatePage(pageNo);
+		for(int key = 0; key < relationSize; key += 1500)
+		{
+			for(int copy = 0; copy < 2; copy++)
+			{
+				RECORD sparseRec;
+				memset(&sparseRec, ' ', sizeof(sparseRec));
+				sparseRec.i = key;
+				sparseRec.d = key;
+				RecordId rid = page.insertRecord(std::string(reinterpret_cast<char*>(&sparseRec), sizeof(sparseRec)));
+				sparseKeys[pageNo][rid.slot_number] = key;
+			}
+		}
+		sparseFile.writePage(pageNo, page);
+	}
+
+	{
+		// a buffer pool of its own, that the last test fills with pinned pages
+		BufMgr sparseBufMgr(10);
+		BTreeIndex sparse(sparseRelationName, sparseIndexName, &sparseBufMgr, offsetof(tuple,i), INTEGER);
+
+		// whole key range, in batches smaller than the pairs of a key
+		BTreeScanRange range;
+		range.lowVal = 0;
+		range.lowOp = GTE;
+		range.highVal = relationSize;
+		range.highOp = LT;
+		int numPairs = 0;
+		int mismatches = 0;
+		int descents;
+		{
+			BTreeMergeJoin join(index, sparse, range);
+			std::vector<std::pair<RecordId, RecordId> > pairs;
+			while(join.nextBatch(pairs, 3))
+			{
+				for(size_t i = 0; i < pairs.size(); i++)
+				{
+					Page *curPage;
+					bufMgr->readPage(file1, pairs[i].first.page_number, curPage);
+					RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(pairs[i].first).data()));
+					bufMgr->unPinPage(file1, pairs[i].first.page_number, false);
+					if(sparseKeys[pairs[i].second.page_number][pairs[i].second.slot_number] != myRec.i || myRec.i % 1500 != 0)
+						mismatches++;
+					numPairs++;
+				}
+			}
+			descents = join.getDescents();
+		}
+		checkPassFail(numPairs, 8)
+		checkPassFail(mismatches, 0)
+		checkPassFail((descents > 2), true)
+
+		// part of the range, the join of the full index with itself
+		range.lowVal = 1000;
+		range.highVal = 3000;
+		range.highOp = LTE;
+		{
+			BTreeMergeJoin join(sparse, index, range);
+			std::vector<std::pair<RecordId, RecordId> > pairs;
+			numPairs = 0;
+			while(join.nextBatch(pairs))
+				numPairs += pairs.size();
+		}
+		checkPassFail(numPairs, 4)
+		{
+			BTreeMergeJoin join(index, index, range);
+			std::vector<std::pair<RecordId, RecordId> > pairs;
+			numPairs = 0;
+			mismatches = 0;
+			while(join.nextBatch(pairs))
+			{
+				for(size_t i = 0; i < pairs.size(); i++)
+				{
+					if(!(pairs[i].first == pairs[i].second))
+						mismatches++;
+				}
+				numPairs += pairs.size();
+			}
+		}
+		checkPassFail(numPairs, 2001)
+		checkPassFail(mismatches, 0)
+
+		// a join whose cursor cannot read its first leaf releases the snapshots of both sides
+		std::vector<PageId> pinned;
+		for(PageId pid = file1->getFirstPageNo(); pinned.size() < 10; pid++)
+		{
+			Page *page;
+			sparseBufMgr.readPage(file1, pid, page);
+			pinned.push_back(pid);
+		}
+		try
+		{
+			BTreeMergeJoin join(index, sparse, range);
+			std::cout << "a join was started without a free buffer" << std::endl;
+			exit(1);
+		}
+		catch(BufferExceededException e)
+		{
+		}
+		for(size_t i = 0; i < pinned.size(); i++)
+		{
+			sparseBufMgr.unPinPage(file1, pinned[i], false);
+		}
+		int key = relationSize;
+		index.insertEntry(&key, rid);
+		sparse.insertEntry(&key, rid);
+		BTreeShapeStats stats;
+		index.analyzeShape(stats);
+		checkPassFail(stats.snapshotPages, 0)
+		sparse.analyzeShape(stats);
+		checkPassFail(stats.snapshotPages, 0)
+	}
+	File::remove(sparseIndexName);
+	File::remove(sparseRelationName);
+}
+
+// -----------------------------------------------------------------------------
+// probeTests
+// -----------------------------------------------------------------------------
+
+void probeTests()
+{
+	std::cout << "Create a B+ Tree index on the integer field" << std::endl;
+	BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+
+	// more copies of one key than a leaf holds, so that they span several leaves
+	int duplicateKey = relationSize / 2;
+	int copies = INTARRAYLEAFSIZE + 10;
+	for(int i = 0; i < copies; i++)
+	{
+		RecordId rid;
+		rid.page_number = 1;
+		rid.slot_number = i + 1;
+		index.insertEntry(&duplicateKey, rid);
+	}
+	BTreeShapeStats stats;
+	index.analyzeShape(stats);
+	BTreeSnapshot snapshot = index.takeSnapshot();
+
+	{
+		// probes in key order read every leaf once and descend only for the first key
+		BTreeProbeCursor cursor(index, snapshot);
+		std::vector<RecordId> rids;
+		int found = 0;
+		int mismatches = 0;
+		for(int key = 0; key < relationSize; key++)
+		{
+			int n = cursor.probe(key, rids);
+			if(key == duplicateKey)
+			{
+				if(n != copies + 1)
+					mismatches++;
+				continue;
+			}
+			if(n != 1)
+			{
+				mismatches++;
+				continue;
+			}
+			Page *curPage;
+			bufMgr->readPage(file1, rids[0].page_number, curPage);
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(rids[0]).data()));
+			bufMgr->unPinPage(file1, rids[0].page_number, false);
+			if(myRec.i != key)
+				mismatches++;
+			found++;
+		}
+		checkPassFail(found, relationSize - 1)
+		checkPassFail(mismatches, 0)
+		checkPassFail(cursor.getDescents(), 1)
+		checkPassFail((cursor.getLeafReads() <= stats.leafCount), true)
+		checkPassFail(cursor.probe(relationSize + 3, rids), 0)
+	}
+
+	{
+		// keys out of order and missing keys fall back to descents
+		BTreeProbeCursor cursor(index, snapshot);
+		std::vector<RecordId> rids;
+		int mismatches = 0;
+		for(int key = relationSize + 10; key > -10; key -= 7)
+		{
+			int expected = (key < 0 || key >= relationSize) ? 0 : (key == duplicateKey ? copies + 1 : 1);
+			if(cursor.probe(key, rids) != expected)
+				mismatches++;
+		}
+		checkPassFail(mismatches, 0)
+		checkPassFail(cursor.probe(duplicateKey, rids), copies + 1)
+	}
+	index.releaseSnapshot(snapshot);
+}
+
+// -----------------------------------------------------------------------------
+// deleteRangeTests
+// -----------------------------------------------------------------------------
+
+void deleteRangeTests()
+{
+	std::cout << "Create a B+ Tree index on the integer field" << std::endl;
+	BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+	BTreeShapeStats stats;
+	index.analyzeShape(stats);
+	int leafCount = stats.leafCount;
+
+	// the middle of the key range, a snapshot taken before still sees it
+	BTreeSnapshot snapshot = index.takeSnapshot();
+	int lowVal = 1000;
+	int highVal = 4000;
+	int released = index.deleteRange(&lowVal, GTE, &highVal, LT);
+	checkPassFail((released > 0), true)
+	int numResults = 0;
+	RecordId scanRid;
+	lowVal = 0;
+	highVal = relationSize - 1;
+	index.startScan(&lowVal, GTE, &highVal, LTE, &snapshot);
+	try
+	{
+		while(1)
+		{
+			index.scanNext(scanRid);
+			numResults++;
+		}
+	}
+	catch(IndexScanCompletedException e)
+	{
+	}
+	index.endScan();
+	index.releaseSnapshot(snapshot);
+	checkPassFail(numResults, relationSize)
+
+	checkPassFail(intScan(&index,0,GTE,relationSize - 1,LTE), relationSize - 3000)
+	checkPassFail(intScan(&index,990,GTE,4010,LT), 20)
+	index.analyzeShape(stats);
+	checkPassFail(stats.leafEntries, relationSize - 3000)
+	checkPassFail((stats.leafCount < leafCount), true)
+	checkPassFail(stats.unreachablePages, 0)
+
+	// a few keys inside one leaf, with exclusive ends
+	lowVal = 4500;
+	highVal = 4510;
+	index.deleteRange(&lowVal, GT, &highVal, LT);
+	checkPassFail(intScan(&index,4495,GTE,4515,LT), 11)
+
+	// everything, then the index is used again
+	lowVal = INT_MIN;
+	highVal = INT_MAX;
+	index.deleteRange(&lowVal, GTE, &highVal, LTE);
+	checkPassFail(intScan(&index,0,GTE,relationSize - 1,LTE), 0)
+	index.analyzeShape(stats);
+	checkPassFail(stats.height, 1)
+	checkPassFail(stats.leafEntries, 0)
+	checkPassFail(stats.unreachablePages, 0)
+	for(int key = 0; key < 100; key++)
+	{
+		RecordId rid;
+		rid.page_number = 1;
+		rid.slot_number = key + 1;
+		index.insertEntry(&key, rid);
+	}
+	index.analyzeShape(stats);
+	checkPassFail(stats.leafEntries, 100)
+
+	try
+	{
+		lowVal = 10;
+		highVal = 5;
+		index.deleteRange(&lowVal, GTE, &highVal, LTE);
+		std::cout << "deleteRange with a bad range did not throw" << std::endl;
+		exit(1);
+	}
+	catch(BadScanrangeException e)
+	{
+	}
+}
+
+// -----------------------------------------------------------------------------
+// uniqueTests
+// -----------------------------------------------------------------------------
+
+void uniqueTests()
+{
+	BTreeIndexOptions options;
+	options.unique = true;
+	std::vector<RecordId> rids;
+	{
+		std::cout << "Create a unique B+ Tree index on the integer field" << std::endl;
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, options);
+		checkPassFail(index.isUnique(), true)
+		checkPassFail(intScan(&index,0,GTE,relationSize - 1,LTE), relationSize)
+
+		// the record ids in key order
+		int lowVal = 0;
+		int highVal = relationSize - 1;
+		RecordId scanRid;
+		index.startScan(&lowVal, GTE, &highVal, LTE);
+		for(int key = 0; key < relationSize; key++)
+		{
+			index.scanNext(scanRid);
+			rids.push_back(scanRid);
+		}
+		index.endScan();
+
+		// every key is already there, the first key of each leaf included, which sits at a separator
+		int duplicates = 0;
+		for(int key = 0; key < relationSize; key++)
+		{
+			if(index.insertEntry(&key, rids[key]) == DUPLICATE_KEY)
+				duplicates++;
+		}
+		checkPassFail(duplicates, relationSize)
+		checkPassFail(intScan(&index,0,GTE,relationSize - 1,LTE), relationSize)
+		int key = relationSize;
+		checkPassFail(index.insertEntry(&key, rids[0]), INSERTED)
+		checkPassFail(index.insertEntry(&key, rids[0]), DUPLICATE_KEY)
+
+		// upserts overwrite the record ids in place, here with the record ids in reverse order
+		int replaced = 0;
+		for(key = 0; key < relationSize; key++)
+		{
+			if(index.upsert(&key, rids[relationSize - 1 - key]) == REPLACED)
+				replaced++;
+		}
+		checkPassFail(replaced, relationSize)
+		key = -1;
+		checkPassFail(index.upsert(&key, rids[0]), INSERTED)
+		checkPassFail(intScan(&index,-1,GTE,relationSize,LTE), relationSize + 2)
+
+		int matches = 0;
+		index.startScan(&lowVal, GTE, &highVal, LTE);
+		for(key = 0; key < relationSize; key++)
+		{
+			index.scanNext(scanRid);
+			if(scanRid == rids[relationSize - 1 - key])
+				matches++;
+		}
+		index.endScan();
+		checkPassFail(matches, relationSize)
+		BTreeShapeStats stats;
+		index.analyzeShape(stats);
+		checkPassFail(stats.leafEntries, relationSize + 2)
+
+		// the duplicate check and the insertion read no page besides those of the descent, which
+		// reads the root once more to tell whether it is a leaf
+		key = relationSize / 2;
+		bufMgr->clearBufStats();
+		checkPassFail(index.insertEntry(&key, rids[key]), DUPLICATE_KEY)
+		checkPassFail(bufMgr->getBufStats().accesses, stats.height + 1)
+		key = -2;
+		bufMgr->clearBufStats();
+		checkPassFail(index.insertEntry(&key, rids[0]), INSERTED)
+		checkPassFail(bufMgr->getBufStats().accesses, stats.height + 1)
+	}
+
+	// the flag is recorded in the meta page
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(index.isUnique(), true)
+		int key = relationSize / 2;
+		checkPassFail(index.insertEntry(&key, rids[key]), DUPLICATE_KEY)
+	}
+	File::remove(intIndexName);
+
+	// a non-unique index takes duplicates, an upsert overwrites the first entry of the key
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(index.isUnique(), false)
+		int key = 5;
+		checkPassFail(index.insertEntry(&key, rids[5]), INSERTED)
+		checkPassFail(index.upsert(&key, rids[5]), REPLACED)
+		checkPassFail(intScan(&index,5,GTE,5,LTE), 2)
+	}
+}
+
+// -----------------------------------------------------------------------------
+// expiryTests
+// -----------------------------------------------------------------------------
+
+void expiryTests()
+{
+	// the new keys share the record of the last key, intScan() reads the records
+	RecordId rid;
+	{
+		std::cout << "Create a B+ Tree index on the integer field" << std::endl;
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(index.getExpiryWatermark(), INT_MIN)
+		int lowVal = relationSize - 1;
+		int highVal = relationSize - 1;
+		index.startScan(&lowVal, GTE, &highVal, LTE);
+		index.scanNext(rid);
+		index.endScan();
+
+		// expired keys are hidden from scans, cursors and probes, but still in the leaves
+		index.setExpiryWatermark(1000);
+		index.setExpiryWatermark(500);
+		checkPassFail(index.getExpiryWatermark(), 1000)
+		checkPassFail(intScan(&index,0,GTE,relationSize - 1,LTE), relationSize - 1000)
+		checkPassFail(intScan(&index,0,GTE,1000,LT), 0)
+		checkPassFail(intScan(&index,990,GT,1010,LT), 10)
+		BTreeScanRange range;
+		range.lowVal = 0;
+		range.lowOp = GTE;
+		range.highVal = relationSize - 1;
+		range.highOp = LTE;
+		std::vector<RecordId> rids;
+		index.parallelScan(range, 4, rids);
+		checkPassFail((int)rids.size(), relationSize - 1000)
+		BTreeSnapshot snapshot = index.takeSnapshot();
+		{
+			BTreeProbeCursor cursor(index, snapshot);
+			checkPassFail(cursor.probe(999, rids), 0)
+			checkPassFail(cursor.probe(1000, rids), 1)
+		}
+		index.releaseSnapshot(snapshot);
+		BTreeShapeStats stats;
+		index.analyzeShape(stats);
+		checkPassFail(stats.leafEntries, relationSize)
+		int key = 10;
+		checkPassFail(index.insertEntry(&key, rid), EXPIRED)
+
+		// insertions purge the leaves they reach, the first leaf split drops the expired subtrees
+		index.clearWriteStats();
+		int added = 2000;
+		for(key = relationSize; key < relationSize + added; key++)
+		{
+			index.insertEntry(&key, rid);
+		}
+		BTreeWriteStats writeStats;
+		index.getWriteStats(writeStats);
+		checkPassFail((writeStats.expiredPagesReleased > 0), true)
+		index.analyzeShape(stats);
+		checkPassFail(stats.leafEntries, relationSize - 1000 + added)
+		checkPassFail(stats.unreachablePages, 0)
+		checkPassFail(intScan(&index,0,GTE,relationSize + added,LTE), relationSize - 1000 + added)
+
+		// a leaf that holds expired keys loses them to the next insertion that reaches it
+		index.setExpiryWatermark(1100);
+		key = 1200;
+		index.clearWriteStats();
+		index.insertEntry(&key, rid);
+		index.getWriteStats(writeStats);
+		checkPassFail((writeStats.entriesExpired > 0), true)
+		checkPassFail(intScan(&index,1000,GTE,1300,LT), 201)
+	}
+
+	// the watermark is recorded in the meta page
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(index.getExpiryWatermark(), 1100)
+		checkPassFail(intScan(&index,0,GTE,1300,LT), 201)
+	}
+	File::remove(intIndexName);
+
+	// with a time to live the watermark follows the newest key
+	BTreeIndexOptions options;
+	options.timeToLive = 1000;
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, options);
+		checkPassFail(index.getExpiryWatermark(), relationSize - 1 - 1000)
+		checkPassFail(intScan(&index,0,GTE,relationSize - 1,LTE), 1001)
+	}
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(index.getExpiryWatermark(), relationSize - 1 - 1000)
+		int key = relationSize + 500;
+		checkPassFail(index.insertEntry(&key, rid), INSERTED)
+		checkPassFail(index.getExpiryWatermark(), relationSize - 500)
+		checkPassFail(intScan(&index,0,GTE,relationSize + 500,LTE), 501)
+	}
+}
+
+// -----------------------------------------------------------------------------
+// forestTests
+// -----------------------------------------------------------------------------
+
+int forestScan(BTreeForest *forest, int lowVal, Operator lowOp, int highVal, Operator highOp)
+{
+	BTreeScanRange range;
+	range.lowVal = lowVal;
+	range.lowOp = lowOp;
+	range.highVal = highVal;
+	range.highOp = highOp;
+	std::vector<RecordId> rids;
+	forest->scan(range, rids);
+
+	// the records come in key order across the partitions
+	int lastKey = INT_MIN;
+	for(size_t i = 0; i < rids.size(); i++)
+	{
+		Page *curPage;
+		bufMgr->readPage(file1, rids[i].page_number, curPage);
+		RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(rids[i]).data()));
+		bufMgr->unPinPage(file1, rids[i].page_number, false);
+		if(myRec.i < lastKey)
+			return -1;
+		lastKey = myRec.i;
+	}
+	return rids.size();
+}
+
+void forestTests()
+{
+	std::vector<int> boundaries;
+	boundaries.push_back(1000);
+	boundaries.push_back(2500);
+	boundaries.push_back(4000);
+	{
+		std::cout << "Create a B+ Tree forest of four partitions on the integer field" << std::endl;
+		BTreeForest forest(relationName, offsetof(tuple,i), INTEGER, boundaries);
+		checkPassFail(forest.partitionCount(), 4)
+		checkPassFail(forest.route(INT_MIN), 0)
+		checkPassFail(forest.route(999), 0)
+		checkPassFail(forest.route(1000), 1)
+		checkPassFail(forest.route(relationSize), 3)
+		int sizes[] = {1000, 1500, 1500, relationSize - 4000};
+		int mismatches = 0;
+		for(int i = 0; i < forest.partitionCount(); i++)
+		{
+			BTreeShapeStats stats;
+			forest.partition(i).analyzeShape(stats);
+			if(stats.leafEntries != sizes[i])
+				mismatches++;
+		}
+		checkPassFail(mismatches, 0)
+		checkPassFail(forestScan(&forest,0,GTE,relationSize - 1,LTE), relationSize)
+		checkPassFail(forestScan(&forest,900,GT,2600,LT), 1699)
+		checkPassFail(forestScan(&forest,1000,GTE,2499,LTE), 1500)
+
+		// a record appended to the relation goes to the last partition only
+		RECORD extra;
+		memset(&extra, ' ', sizeof(extra));
+		extra.i = relationSize;
+		RecordId extraRid;
+		int lowVal = relationSize - 1;
+		int highVal = relationSize - 1;
+		forest.partition(3).startScan(&lowVal, GTE, &highVal, LTE);
+		forest.partition(3).scanNext(extraRid);
+		forest.partition(3).endScan();
+		checkPassFail(forest.insertRecord(std::string(reinterpret_cast<char*>(&extra), sizeof(extra)), extraRid), INSERTED)
+		checkPassFail(forest.partition(0).insertRecord(std::string(reinterpret_cast<char*>(&extra), sizeof(extra)), extraRid), EXCLUDED)
+		checkPassFail(forestScan(&forest,relationSize - 1,GTE,relationSize,LTE), 2)
+
+		// the partitions are compacted and flushed in parallel
+		forest.compact(0.5);
+		forest.flush();
+		int unreachable = 0;
+		for(int i = 0; i < forest.partitionCount(); i++)
+		{
+			BTreeShapeStats stats;
+			forest.partition(i).analyzeShape(stats);
+			unreachable += stats.unreachablePages;
+		}
+		checkPassFail(unreachable, 0)
+		checkPassFail(forestScan(&forest,INT_MIN,GTE,INT_MAX,LTE), relationSize + 1)
+
+		// one partition is emptied and built again without touching the others
+		checkPassFail((forest.dropPartition(1) > 0), true)
+		checkPassFail(forestScan(&forest,INT_MIN,GTE,INT_MAX,LTE), relationSize + 1 - 1500)
+		forest.rebuildPartition(1);
+		checkPassFail(forestScan(&forest,1000,GTE,2499,LTE), 1500)
+	}
+
+	// the routing table comes from the key ranges recorded in the partitions
+	{
+		BTreeForest forest(relationName, offsetof(tuple,i), INTEGER, std::vector<int>());
+		checkPassFail(forest.partitionCount(), 4)
+		checkPassFail(forest.route(2500), 2)
+		checkPassFail(forestScan(&forest,INT_MIN,GTE,INT_MAX,LTE), relationSize + 1)
+	}
+
+	// records appended since reach the partitions of their keys from one read of the new pages
+	appendRelation(0, 1000);
+	appendRelation(relationSize + 1, relationSize + 1001);
+	{
+		BTreeForest forest(relationName, offsetof(tuple,i), INTEGER, std::vector<int>());
+		checkPassFail(forestScan(&forest,INT_MIN,GTE,999,LTE), 2000)
+		checkPassFail(forestScan(&forest,1000,GTE,3999,LTE), 3000)
+		checkPassFail(forestScan(&forest,INT_MIN,GTE,INT_MAX,LTE), relationSize + 2001)
+	}
+	for(int i = 0; i < 4; i++)
+	{
+		File::remove(relationName + "." + std::to_string(offsetof(tuple,i)) + "." + std::to_string(i));
+	}
+
+	// the partitions opened before a failure are closed again
+	try
+	{
+		BTreeForest forest("relMissing", offsetof(tuple,i), INTEGER, boundaries);
+		std::cout << "a forest over a missing relation was built" << std::endl;
+		exit(1);
+	}
+	catch(FileNotFoundException e)
+	{
+		std::cout << "Forest over a missing relation failed as expected" << std::endl;
+	}
+	for(int i = 0; i < 4; i++)
+	{
+		File::remove("relMissing." + std::to_string(offsetof(tuple,i)) + "." + std::to_string(i));
+	}
+
+	try
+	{
+		boundaries[1] = 500;
+		BTreeForest forest(relationName, offsetof(tuple,i), INTEGER, boundaries);
+		std::cout << "a forest with decreasing boundaries was created" << std::endl;
+		exit(1);
+	}
+	catch(BadIndexInfoException e)
+	{
+	}
+}
+
+// -----------------------------------------------------------------------------
+// shardedTests
+// -----------------------------------------------------------------------------
+
+int shardedScan(BTreeShardedIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp)
+{
+	BTreeScanRange range;
+	range.lowVal = lowVal;
+	range.lowOp = lowOp;
+	range.highVal = highVal;
+	range.highOp = highOp;
+	std::vector<RecordId> rids;
+	index->scan(range, rids);
+
+	// the records of all shards come merged in key order
+	int lastKey = INT_MIN;
+	for(size_t i = 0; i < rids.size(); i++)
+	{
+		Page *curPage;
+		bufMgr->readPage(file1, rids[i].page_number, curPage);
+		RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(rids[i]).data()));
+		bufMgr->unPinPage(file1, rids[i].page_number, false);
+		if(myRec.i < lastKey)
+			return -1;
+		lastKey = myRec.i;
+	}
+	return rids.size();
+}
+
+void shardedTests()
+{
+	RecordId rid;
+	{
+		std::cout << "Create a B+ Tree index of four hash shards on the integer field" << std::endl;
+		BTreeShardedIndex index(relationName, offsetof(tuple,i), INTEGER, 4);
+		checkPassFail(index.shardCount(), 4)
+		int entries = 0;
+		int emptyShards = 0;
+		int misrouted = 0;
+		for(int i = 0; i < index.shardCount(); i++)
+		{
+			BTreeShapeStats stats;
+			index.shard(i).analyzeShape(stats);
+			entries += stats.leafEntries;
+			if(stats.leafEntries < relationSize / 8)
+				emptyShards++;
+			int count;
+			if(index.shard(i).getShard(count) != i || count != 4)
+				misrouted++;
+		}
+		checkPassFail(entries, relationSize)
+		checkPassFail(emptyShards, 0)
+		checkPassFail(misrouted, 0)
+
+		std::vector<RecordId> rids;
+		int found = 0;
+		for(int key = 0; key < relationSize; key++)
+		{
+			found += index.lookup(key, rids);
+		}
+		checkPassFail(found, relationSize)
+		checkPassFail(index.lookup(relationSize, rids), 0)
+		checkPassFail(shardedScan(&index,0,GTE,relationSize - 1,LTE), relationSize)
+		checkPassFail(shardedScan(&index,900,GT,2600,LT), 1699)
+
+		// new keys share the record of the last key, the writers apply them in the background
+		index.lookup(relationSize - 1, rids);
+		rid = rids[0];
+		for(int key = relationSize; key < relationSize + 1000; key++)
+		{
+			index.insertEntry(key, rid);
+		}
+		std::vector<RIDKeyPair<int> > batch;
+		for(int key = relationSize + 1000; key < relationSize + 2000; key++)
+		{
+			RIDKeyPair<int> entry;
+			entry.set(rid, key);
+			batch.push_back(entry);
+		}
+		index.insertBatch(batch);
+
+		// lookups run while the writers insert
+		found = 0;
+		for(int key = 0; key < relationSize; key++)
+		{
+			found += index.lookup(key, rids);
+		}
+		checkPassFail(found, relationSize)
+		index.drain();
+		checkPassFail(index.lookup(relationSize + 500, rids), 1)
+		checkPassFail(index.lookup(relationSize + 1500, rids), 1)
+		checkPassFail(shardedScan(&index,relationSize - 1,GTE,INT_MAX,LTE), 2001)
+	}
+
+	// the number of shards is recorded in the meta pages
+	{
+		BTreeShardedIndex index(relationName, offsetof(tuple,i), INTEGER, 2);
+		checkPassFail(index.shardCount(), 4)
+		checkPassFail(shardedScan(&index,INT_MIN,GTE,INT_MAX,LTE), relationSize + 2000)
+	}
+
+	// records appended since reach the shards of their keys from one read of the new pages
+	appendRelation(relationSize + 2000, relationSize + 3000);
+	{
+		BTreeShardedIndex index(relationName, offsetof(tuple,i), INTEGER, 4);
+		checkPassFail(shardedScan(&index,INT_MIN,GTE,INT_MAX,LTE), relationSize + 3000)
+		// a lookup reads the shard of its key only
+		int found = 0;
+		std::vector<RecordId> rids;
+		for(int key = relationSize + 2000; key < relationSize + 3000; key++)
+		{
+			found += index.lookup(key, rids);
+		}
+		checkPassFail(found, 1000)
+	}
+	for(int i = 0; i < 4; i++)
+	{
+		File::remove(relationName + "." + std::to_string(offsetof(tuple,i)) + ".s" + std::to_string(i));
+	}
+
+	// drain() reports the entries unique shards refused
+	{
+		BTreeIndexOptions options;
+		options.unique = true;
+		BTreeShardedIndex index(relationName, offsetof(tuple,i), INTEGER, 2, FORESTBUFFERPAGES, options);
+		std::vector<RecordId> rids;
+		index.lookup(5, rids);
+		for(int key = 0; key < 10; key++)
+		{
+			index.insertEntry(key, rids[0]);
+		}
+		index.insertEntry(relationSize, rids[0]);
+		BTreeShardedInsertStats stats;
+		index.drain(stats);
+		checkPassFail(stats.inserted, 1)
+		checkPassFail(stats.duplicateKeys, 10)
+		index.drain(stats);
+		checkPassFail(stats.duplicateKeys, 0)
+	}
+	for(int i = 0; i < 2; i++)
+	{
+		File::remove(relationName + "." + std::to_string(offsetof(tuple,i)) + ".s" + std::to_string(i));
+	}
+
+	// the writers carry no included columns
+	try
+	{
+		BTreeIndexOptions options;
+		IncludedColumn column;
+		column.offset = offsetof(tuple,d);
+		column.length = sizeof(double);
+		options.includedColumns.push_back(column);
+		BTreeShardedIndex index(relationName, offsetof(tuple,i), INTEGER, 2, FORESTBUFFERPAGES, options);
+		std::cout << "a covering sharded index was created" << std::endl;
+		exit(1);
+	}
+	catch(BadIndexInfoException e)
+	{
+	}
+
+	// nor do they apply a predicate or a key range
+	try
+	{
+		BTreeIndexOptions options;
+		options.predicate.enabled = true;
+		options.predicate.offset = offsetof(tuple,d);
+		options.predicate.type = DOUBLE;
+		options.predicate.value = 100;
+		BTreeShardedIndex index(relationName, offsetof(tuple,i), INTEGER, 2, FORESTBUFFERPAGES, options);
+		std::cout << "a partial sharded index was created" << std::endl;
+		exit(1);
+	}
+	catch(BadIndexInfoException e)
+	{
+	}
+	try
+	{
+		BTreeIndexOptions options;
+		options.hasKeyRange = true;
+		options.keyRangeLow = 0;
+		options.keyRangeHigh = 1000;
+		BTreeShardedIndex index(relationName, offsetof(tuple,i), INTEGER, 2, FORESTBUFFERPAGES, options);
+		std::cout << "a sharded index over a key range was created" << std::endl;
+		exit(1);
+	}
+	catch(BadIndexInfoException e)
+	{
+	}
+
+	try
+	{
+		BTreeShardedIndex index(relationName, offsetof(tuple,i), INTEGER, 0);
+		std::cout << "a sharded index without shards was created" << std::endl;
+		exit(1);
+	}
+	catch(BadIndexInfoException e)
+	{
+	}
+}
+
+// -----------------------------------------------------------------------------
+// numaTests
+// -----------------------------------------------------------------------------
+
+void numaTests()
+{
+	std::vector<int> cpus;
+	checkPassFail(NumaTopology::parseList("0-3,8\n", cpus), true)
+	checkPassFail(cpus.size(), 5)
+	checkPassFail(cpus[4], 8)
+	checkPassFail(NumaTopology::parseList("3-1", cpus), false)
+	NumaPlacement placement;
+	checkPassFail(parseNumaPlacement("interleaved", placement), true)
+	checkPassFail(placement, NUMA_INTERLEAVED)
+	checkPassFail(parseNumaPlacement("remote", placement), false)
+
+	// without several nodes the placements degrade to one node and give the same results
+	const NumaTopology &topology = NumaTopology::system();
+	checkPassFail((topology.nodeCount() >= 1), true)
+	checkPassFail(topology.nodeOfPartition(topology.nodeCount()), 0)
+	std::vector<int> boundaries;
+	boundaries.push_back(2500);
+	for(int p = NUMA_NONE; p <= NUMA_INTERLEAVED; p++)
+	{
+		std::cout << "Create a B+ Tree forest and a sharded index placed " << numaPlacementName((NumaPlacement)p) << std::endl;
+		{
+			BTreeForest forest(relationName, offsetof(tuple,i), INTEGER, boundaries, FORESTBUFFERPAGES,
+				BTreeIndexOptions(), (NumaPlacement)p);
+			checkPassFail(forestScan(&forest,INT_MIN,GTE,INT_MAX,LTE), relationSize)
+			forest.flush();
+		}
+		{
+			BTreeShardedIndex index(relationName, offsetof(tuple,i), INTEGER, 3, FORESTBUFFERPAGES,
+				BTreeIndexOptions(), (NumaPlacement)p);
+			checkPassFail(shardedScan(&index,1000,GTE,1999,LTE), 1000)
+		}
+		for(int i = 0; i < 3; i++)
+		{
+			if(i < 2)
+				File::remove(relationName + "." + std::to_string(offsetof(tuple,i)) + "." + std::to_string(i));
+			File::remove(relationName + "." + std::to_string(offsetof(tuple,i)) + ".s" + std::to_string(i));
+		}
+	}
+}
+
 // -----------------------------------------------------------------------------
 // errorTests
 // -----------------------------------------------------------------------------
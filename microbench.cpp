@@ -0,0 +1,304 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "btree.h"
+
+using namespace badgerdb;
+
+// -----------------------------------------------------------------------------
+// Microbenchmarks of the node kernels of BTreeIndex. They run on synthetic pages
+// in memory, without the buffer manager, and report nanoseconds per operation.
+// -----------------------------------------------------------------------------
+
+/**
+ * A page sized, suitably aligned buffer that is cast to a node.
+ */
+struct NodeBuffer {
+	union {
+		char data[Page::SIZE];
+		int align;
+	};
+};
+
+/**
+ * A microbenchmark: setup() builds the synthetic page once, run() performs operation i on a copy of it.
+ * Pages are restored from the template before every timed batch when the operation mutates them.
+ */
+struct MicroBench {
+	const char *name;
+	void (*setup)(NodeBuffer &page);
+	void (*run)(NodeBuffer &page, NodeBuffer &scratch, int i);
+	bool mutates;
+};
+
+// number of page copies timed together, small enough to stay in cache
+const int BATCHSIZE = 64;
+// random probe keys shared by all benchmarks
+std::vector<int> probeKeys;
+volatile int sink;
+
+// -----------------------------------------------------------------------------
+// Synthetic pages, keys are 0, 2, 4, ... so that odd keys land between entries
+// -----------------------------------------------------------------------------
+
+static void fillLeaf(NodeBuffer &page, int entries)
+{
+	memset(page.data, 0, Page::SIZE);
+	LeafNodeInt *leaf = (LeafNodeInt *)page.data;
+	leaf->level = -1;
+	for(int i = 0; i < entries; i++)
+	{
+		leaf->keyArray[i] = 2 * i;
+		leaf->ridArray[i].page_number = 1 + i;
+		leaf->ridArray[i].slot_number = 1;
+	}
+}
+
+static void fillNonLeaf(NodeBuffer &page, int keys)
+{
+	memset(page.data, 0, Page::SIZE);
+	NonLeafNodeInt *node = (NonLeafNodeInt *)page.data;
+	node->level = 1;
+	node->pageNoArray[0] = 1;
+	for(int i = 0; i < keys; i++)
+	{
+		node->keyArray[i] = 2 * i;
+		node->pageNoArray[i+1] = 2 + i;
+	}
+}
+
+static void fillSlottedLeaf(NodeBuffer &page, int entries)
+{
+	SlottedLeafNodeInt *leaf = (SlottedLeafNodeInt *)page.data;
+	BTreeIndex::initSlottedLeaf(leaf, sizeof(SlottedLeafEntry));
+	for(int i = 0; i < entries; i++)
+	{
+		RecordId rid;
+		rid.page_number = 1 + i;
+		rid.slot_number = 1;
+		BTreeIndex::insertSlottedLeafEntry(leaf, 2 * i, rid);
+	}
+}
+
+static void fullLeaf(NodeBuffer &page) { fillLeaf(page, INTARRAYLEAFSIZE); }
+static void halfLeaf(NodeBuffer &page) { fillLeaf(page, INTARRAYLEAFSIZE / 2); }
+static void fullNonLeaf(NodeBuffer &page) { fillNonLeaf(page, INTARRAYNONLEAFSIZE); }
+static void halfNonLeaf(NodeBuffer &page) { fillNonLeaf(page, INTARRAYNONLEAFSIZE / 2); }
+static void fullSlottedLeaf(NodeBuffer &page) { fillSlottedLeaf(page, SLOTTEDLEAFSIZE); }
+static void halfSlottedLeaf(NodeBuffer &page) { fillSlottedLeaf(page, SLOTTEDLEAFSIZE / 2); }
+
+static RecordId benchRid()
+{
+	RecordId rid;
+	rid.page_number = 7;
+	rid.slot_number = 1;
+	return rid;
+}
+
+// -----------------------------------------------------------------------------
+// Operations
+// -----------------------------------------------------------------------------
+
+static void searchNonLeaf(NodeBuffer &page, NodeBuffer &, int i)
+{
+	sink = BTreeIndex::findNonLeafIndex((NonLeafNodeInt *)page.data, probeKeys[i % probeKeys.size()] % (2 * INTARRAYNONLEAFSIZE));
+}
+
+static void insertLeafHead(NodeBuffer &page, NodeBuffer &, int)
+{
+	BTreeIndex::insertLeafEntry((LeafNodeInt *)page.data, -1, benchRid());
+}
+
+static void insertLeafMiddle(NodeBuffer &page, NodeBuffer &, int)
+{
+	BTreeIndex::insertLeafEntry((LeafNodeInt *)page.data, INTARRAYLEAFSIZE / 2 - 1, benchRid());
+}
+
+static void insertLeafTail(NodeBuffer &page, NodeBuffer &, int)
+{
+	BTreeIndex::insertLeafEntry((LeafNodeInt *)page.data, 2 * INTARRAYLEAFSIZE, benchRid());
+}
+
+static void insertNonLeafHead(NodeBuffer &page, NodeBuffer &, int)
+{
+	BTreeIndex::insertNonLeafEntry((NonLeafNodeInt *)page.data, -1, 9);
+}
+
+static void insertNonLeafTail(NodeBuffer &page, NodeBuffer &, int)
+{
+	BTreeIndex::insertNonLeafEntry((NonLeafNodeInt *)page.data, 2 * INTARRAYNONLEAFSIZE, 9);
+}
+
+static void splitLeafHead(NodeBuffer &page, NodeBuffer &scratch, int)
+{
+	memset(scratch.data, 0, Page::SIZE);
+	sink = BTreeIndex::splitLeafEntries((LeafNodeInt *)page.data, (LeafNodeInt *)scratch.data, -1, benchRid());
+}
+
+static void splitLeafTail(NodeBuffer &page, NodeBuffer &scratch, int)
+{
+	memset(scratch.data, 0, Page::SIZE);
+	sink = BTreeIndex::splitLeafEntries((LeafNodeInt *)page.data, (LeafNodeInt *)scratch.data, 2 * INTARRAYLEAFSIZE, benchRid());
+}
+
+static void splitNonLeafHead(NodeBuffer &page, NodeBuffer &scratch, int)
+{
+	memset(scratch.data, 0, Page::SIZE);
+	sink = BTreeIndex::splitNonLeafEntries((NonLeafNodeInt *)page.data, (NonLeafNodeInt *)scratch.data, -1, 9);
+}
+
+static void splitNonLeafTail(NodeBuffer &page, NodeBuffer &scratch, int)
+{
+	memset(scratch.data, 0, Page::SIZE);
+	sink = BTreeIndex::splitNonLeafEntries((NonLeafNodeInt *)page.data, (NonLeafNodeInt *)scratch.data, 2 * INTARRAYNONLEAFSIZE, 9);
+}
+
+static void insertSlottedLeafHead(NodeBuffer &page, NodeBuffer &, int)
+{
+	BTreeIndex::insertSlottedLeafEntry((SlottedLeafNodeInt *)page.data, -1, benchRid());
+}
+
+static void insertSlottedLeafTail(NodeBuffer &page, NodeBuffer &, int)
+{
+	BTreeIndex::insertSlottedLeafEntry((SlottedLeafNodeInt *)page.data, 2 * SLOTTEDLEAFSIZE, benchRid());
+}
+
+static void splitSlottedLeafHead(NodeBuffer &page, NodeBuffer &scratch, int)
+{
+	BTreeIndex::initSlottedLeaf((SlottedLeafNodeInt *)scratch.data, sizeof(SlottedLeafEntry));
+	sink = BTreeIndex::splitSlottedLeafEntries((SlottedLeafNodeInt *)page.data, (SlottedLeafNodeInt *)scratch.data, -1, benchRid());
+}
+
+static void splitSlottedLeafTail(NodeBuffer &page, NodeBuffer &scratch, int)
+{
+	BTreeIndex::initSlottedLeaf((SlottedLeafNodeInt *)scratch.data, sizeof(SlottedLeafEntry));
+	sink = BTreeIndex::splitSlottedLeafEntries((SlottedLeafNodeInt *)page.data, (SlottedLeafNodeInt *)scratch.data, 2 * SLOTTEDLEAFSIZE, benchRid());
+}
+
+static void filterLeaf(NodeBuffer &page, const KeyPredicate &predicate)
+{
+	int selection[INTARRAYLEAFSIZE];
+	sink = BTreeIndex::filterKeys(((LeafNodeInt *)page.data)->keyArray, INTARRAYLEAFSIZE, predicate, selection);
+}
+
+static void filterLeafPowerOfTwo(NodeBuffer &page, NodeBuffer &, int)
+{
+	static KeyPredicate predicate;
+	predicate.modulus = 16;
+	predicate.excluded.assign(1, 64);
+	filterLeaf(page, predicate);
+}
+
+static void filterLeafModulo(NodeBuffer &page, NodeBuffer &, int)
+{
+	static KeyPredicate predicate;
+	predicate.modulus = 3;
+	filterLeaf(page, predicate);
+}
+
+static void copyPage(NodeBuffer &page, NodeBuffer &scratch, int)
+{
+	memcpy(scratch.data, page.data, Page::SIZE);
+	sink = scratch.data[Page::SIZE - 1];
+}
+
+static const MicroBench benchmarks[] = {
+	{"BM_FindNonLeafIndex/full", fullNonLeaf, searchNonLeaf, false},
+	{"BM_FindNonLeafIndex/half", halfNonLeaf, searchNonLeaf, false},
+	{"BM_InsertLeafEntry/half/head", halfLeaf, insertLeafHead, true},
+	{"BM_InsertLeafEntry/half/middle", halfLeaf, insertLeafMiddle, true},
+	{"BM_InsertLeafEntry/half/tail", halfLeaf, insertLeafTail, true},
+	{"BM_InsertNonLeafEntry/half/head", halfNonLeaf, insertNonLeafHead, true},
+	{"BM_InsertNonLeafEntry/half/tail", halfNonLeaf, insertNonLeafTail, true},
+	{"BM_SplitLeafEntries/full/head", fullLeaf, splitLeafHead, true},
+	{"BM_SplitLeafEntries/full/tail", fullLeaf, splitLeafTail, true},
+	{"BM_InsertSlottedLeafEntry/half/head", halfSlottedLeaf, insertSlottedLeafHead, true},
+	{"BM_InsertSlottedLeafEntry/half/tail", halfSlottedLeaf, insertSlottedLeafTail, true},
+	{"BM_SplitSlottedLeafEntries/full/head", fullSlottedLeaf, splitSlottedLeafHead, true},
+	{"BM_SplitSlottedLeafEntries/full/tail", fullSlottedLeaf, splitSlottedLeafTail, true},
+	{"BM_SplitNonLeafEntries/full/head", fullNonLeaf, splitNonLeafHead, true},
+	{"BM_SplitNonLeafEntries/full/tail", fullNonLeaf, splitNonLeafTail, true},
+	{"BM_FilterKeys/full/pow2", fullLeaf, filterLeafPowerOfTwo, false},
+	{"BM_FilterKeys/full/mod3", fullLeaf, filterLeafModulo, false},
+	{"BM_PageCopy", fullLeaf, copyPage, false}
+};
+
+// -----------------------------------------------------------------------------
+// Runner
+// -----------------------------------------------------------------------------
+
+typedef std::chrono::steady_clock Clock;
+
+// run batches until minTime seconds were spent in the timed operations, return ns per operation
+double runBench(const MicroBench &bench, double minTime, long long &iterations)
+{
+	NodeBuffer templ;
+	NodeBuffer scratch;
+	std::vector<NodeBuffer> batch(BATCHSIZE);
+	bench.setup(templ);
+	for(int k = 0; k < BATCHSIZE; k++)
+		batch[k] = templ;
+
+	double elapsed = 0;
+	iterations = 0;
+	while(elapsed < minTime)
+	{
+		if(bench.mutates)
+		{
+			for(int k = 0; k < BATCHSIZE; k++)
+				batch[k] = templ;
+		}
+		Clock::time_point start = Clock::now();
+		for(int k = 0; k < BATCHSIZE; k++)
+		{
+			bench.run(batch[k], scratch, iterations + k);
+		}
+		elapsed += std::chrono::duration<double>(Clock::now() - start).count();
+		iterations += BATCHSIZE;
+	}
+	return elapsed * 1e9 / iterations;
+}
+
+int main(int argc, char **argv)
+{
+	std::string filter;
+	double minTime = 0.5;
+	for(int i = 1; i + 1 < argc; i += 2)
+	{
+		if(strcmp(argv[i], "--filter") == 0)
+			filter = argv[i+1];
+		else if(strcmp(argv[i], "--min-time") == 0)
+			minTime = atof(argv[i+1]);
+		else
+		{
+			fprintf(stderr, "usage: badgerdb_microbench [--filter SUBSTRING] [--min-time SECONDS]\n");
+			return 1;
+		}
+	}
+
+	std::mt19937 rng(1);
+	for(int i = 0; i < 4096; i++)
+		probeKeys.push_back(rng() & 0x7fffffff);
+
+	printf("%-40s %15s %12s\n", "Benchmark", "Iterations", "ns/op");
+	for(size_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++)
+	{
+		if(!filter.empty() && std::string(benchmarks[b].name).find(filter) == std::string::npos)
+			continue;
+		long long iterations;
+		double ns = runBench(benchmarks[b], minTime, iterations);
+		printf("%-40s %15lld %12.1f\n", benchmarks[b].name, iterations, ns);
+	}
+	return 0;
+}
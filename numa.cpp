@@ -0,0 +1,212 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include "numa.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace badgerdb
+{
+
+#ifdef __linux__
+// memory policies of set_mempolicy(2), from linux/mempolicy.h
+static const int MEMPOLICYDEFAULT = 0;
+static const int MEMPOLICYINTERLEAVE = 3;
+#endif
+
+static bool readFirstLine(const std::string &path, std::string &line)
+{
+	std::ifstream in(path.c_str());
+	return in && std::getline(in, line);
+}
+
+NumaTopology::NumaTopology()
+{
+	std::string line;
+	std::vector<int> online;
+	if(readFirstLine("/sys/devices/system/node/online", line) && parseList(line, online))
+	{
+		for(size_t i = 0; i < online.size(); i++)
+		{
+			std::ostringstream path;
+			path << "/sys/devices/system/node/node" << online[i] << "/cpulist";
+			std::vector<int> cpus;
+			//a node without CPUs only holds memory, no partition is placed on it
+			if(readFirstLine(path.str(), line) && parseList(line, cpus) && !cpus.empty())
+			{
+				nodeIds.push_back(online[i]);
+				nodeCpus.push_back(cpus);
+			}
+		}
+	}
+	if(nodeIds.empty())
+	{
+		//one node with every CPU
+		int cpuCount = std::max(1u, std::thread::hardware_concurrency());
+		nodeIds.push_back(0);
+		nodeCpus.push_back(std::vector<int>());
+		for(int cpu = 0; cpu < cpuCount; cpu++)
+		{
+			nodeCpus[0].push_back(cpu);
+		}
+	}
+}
+
+const NumaTopology &NumaTopology::system()
+{
+	static NumaTopology topology;
+	return topology;
+}
+
+int NumaTopology::nodeCount() const
+{
+	return nodeIds.size();
+}
+
+const std::vector<int> &NumaTopology::nodeCpuList(int i) const
+{
+	return nodeCpus[i];
+}
+
+int NumaTopology::nodeOfPartition(int part) const
+{
+	return part % nodeCount();
+}
+
+bool NumaTopology::bindThread(int i) const
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(size_t c = 0; c < nodeCpus[i].size(); c++)
+	{
+		if(nodeCpus[i][c] < CPU_SETSIZE)
+			CPU_SET(nodeCpus[i][c], &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+bool NumaTopology::setInterleave(bool interleave) const
+{
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+	if(!interleave)
+		return syscall(SYS_set_mempolicy, MEMPOLICYDEFAULT, nullptr, 0) == 0;
+	unsigned long mask = 0;
+	for(size_t i = 0; i < nodeIds.size(); i++)
+	{
+		if(nodeIds[i] < (int)(8 * sizeof(mask)))
+			mask |= 1ul << nodeIds[i];
+	}
+	return syscall(SYS_set_mempolicy, MEMPOLICYINTERLEAVE, &mask, 8 * sizeof(mask)) == 0;
+#else
+	return false;
+#endif
+}
+
+void NumaTopology::placeThread(int part, NumaPlacement placement) const
+{
+	//failures are ignored, the thread then runs where the system puts it
+	if(placement == NUMA_LOCAL)
+	{
+		bindThread(nodeOfPartition(part));
+		setInterleave(false);
+	}
+	else if(placement == NUMA_INTERLEAVED)
+	{
+		setInterleave(true);
+	}
+}
+
+void NumaTopology::runPlaced(int part, NumaPlacement placement, const std::function<void()> &task) const
+{
+	std::exception_ptr error;
+	std::thread thread([this, part, placement, &task, &error]()
+	{
+		placeThread(part, placement);
+		try
+		{
+			task();
+		}
+		catch(...)
+		{
+			error = std::current_exception();
+		}
+	});
+	thread.join();
+	if(error)
+		std::rethrow_exception(error);
+}
+
+bool NumaTopology::parseList(const std::string &list, std::vector<int> &out)
+{
+	out.clear();
+	std::istringstream in(list);
+	std::string item;
+	while(std::getline(in, item, ','))
+	{
+		if(item.empty() || item == "\n")
+			continue;
+		char *end;
+		long first = strtol(item.c_str(), &end, 10);
+		long last = first;
+		if(end == item.c_str())
+			return false;
+		if(*end == '-')
+		{
+			const char *rest = end + 1;
+			last = strtol(rest, &end, 10);
+			if(end == rest || last < first)
+				return false;
+		}
+		for(long n = first; n <= last; n++)
+		{
+			out.push_back(n);
+		}
+	}
+	return true;
+}
+
+const char *numaPlacementName(NumaPlacement placement)
+{
+	switch(placement)
+	{
+	case NUMA_LOCAL:
+		return "local";
+	case NUMA_INTERLEAVED:
+		return "interleaved";
+	default:
+		return "none";
+	}
+}
+
+bool parseNumaPlacement(const std::string &name, NumaPlacement &placement)
+{
+	if(name == "none")
+		placement = NUMA_NONE;
+	else if(name == "local")
+		placement = NUMA_LOCAL;
+	else if(name == "interleaved")
+		placement = NUMA_INTERLEAVED;
+	else
+		return false;
+	return true;
+}
+
+}
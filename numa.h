@@ -0,0 +1,114 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace badgerdb
+{
+
+/**
+ * @brief Placement of the partitions of a BTreeForest or BTreeShardedIndex on the NUMA nodes of the host.
+ */
+enum NumaPlacement
+{
+    NUMA_NONE = 0,          /* threads and memory are left to the operating system */
+    NUMA_LOCAL = 1,         /* partition i and its threads stay on node i mod nodes, its memory is allocated there */
+    NUMA_INTERLEAVED = 2    /* the memory of every partition is interleaved over all nodes, threads are not pinned */
+};
+
+/**
+ * @brief NUMA nodes of the host and the CPUs of each, read from /sys/devices/system/node on Linux.
+ * Without that directory, or on other systems, the host is one node holding every CPU and placement
+ * only pins threads where the system allows it.
+ *
+ * Memory is placed by first touch: a buffer pool allocated and initialized by a thread pinned to a node lives on
+ * that node, so the partitions allocate their buffer managers from threads placed by runPlaced(). Interleaving sets
+ * the memory policy of the allocating thread with set_mempolicy(2), without linking libnuma.
+ */
+class NumaTopology {
+
+ private:
+
+  /**
+   * Number of every node, and the CPUs of each.
+   */
+    std::vector<int> nodeIds;
+    std::vector<std::vector<int> > nodeCpus;
+
+    NumaTopology();
+
+ public:
+
+  /**
+   * Return the topology of the host, read once.
+   */
+    static const NumaTopology &system();
+
+  /**
+   * Number of nodes, at least 1.
+   */
+    int nodeCount() const;
+
+  /**
+   * CPUs of node i, i in [0, nodeCount()).
+   */
+    const std::vector<int> &nodeCpuList(int i) const;
+
+  /**
+   * Node of partition part: partitions are dealt round robin over the nodes.
+   */
+    int nodeOfPartition(int part) const;
+
+  /**
+   * Pin the calling thread to the CPUs of node i.
+   * @return false if the system does not allow it, the thread is left as it was
+   */
+    bool bindThread(int i) const;
+
+  /**
+   * Interleave the future allocations of the calling thread over every node, or go back to the default policy.
+   * @return false if the system does not support it
+   */
+    bool setInterleave(bool interleave) const;
+
+  /**
+   * Place the calling thread for partition part: pinned to its node with the default memory policy for
+   * NUMA_LOCAL, unpinned with interleaved memory for NUMA_INTERLEAVED, untouched for NUMA_NONE.
+   */
+    void placeThread(int part, NumaPlacement placement) const;
+
+  /**
+   * Run a task in a new thread placed for partition part, and wait for it.
+   * @throws  the exception thrown by the task
+   */
+    void runPlaced(int part, NumaPlacement placement, const std::function<void()> &task) const;
+
+  /**
+   * Parse a Linux CPU or node list such as "0-3,8,10-11".
+   * @param list the list
+   * @param out receives the numbers, in the order of the list
+   * @return false if the list is malformed
+   */
+    static bool parseList(const std::string &list, std::vector<int> &out);
+};
+
+/**
+ * Return the name of a placement: none, local or interleaved.
+ */
+const char *numaPlacementName(NumaPlacement placement);
+
+/**
+ * Parse a placement name as returned by numaPlacementName().
+ * @return false if the name is unknown
+ */
+bool parseNumaPlacement(const std::string &name, NumaPlacement &placement);
+
+}
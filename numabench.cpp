@@ -0,0 +1,219 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "btree.h"
+#include "numa.h"
+#include "relation_gen.h"
+#include "exceptions/file_not_found_exception.h"
+
+using namespace badgerdb;
+
+// -----------------------------------------------------------------------------
+// Benchmark description
+// -----------------------------------------------------------------------------
+
+struct NumaBenchConfig {
+	std::string relationName;
+	int relationSize;
+	int shards;
+	int bufferPages;
+	long long lookupsPerWorker;
+	std::vector<NumaPlacement> placements;
+	unsigned int seed;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// -----------------------------------------------------------------------------
+// Forward declarations
+// -----------------------------------------------------------------------------
+
+void usage();
+bool parseArgs(int argc, char **argv, NumaBenchConfig &config);
+void runPlacement(const NumaBenchConfig &config, NumaPlacement placement);
+void removeShards(const NumaBenchConfig &config);
+void report(NumaPlacement placement, int shards, const char *phase, long long ops, double seconds);
+
+int main(int argc, char **argv)
+{
+	NumaBenchConfig config;
+	if(!parseArgs(argc, argv, config))
+	{
+		usage();
+		return 1;
+	}
+
+	createRelation(config.relationName, config.relationSize, UNIFORM_KEYS, config.seed);
+	std::cout << "placement,nodes,shards,phase,ops,seconds,ops_per_sec" << std::endl;
+	for(size_t i = 0; i < config.placements.size(); i++)
+	{
+		runPlacement(config, config.placements[i]);
+	}
+	removeShards(config);
+	File::remove(config.relationName);
+	return 0;
+}
+
+void usage()
+{
+	std::cerr << "usage: badgerdb_numabench [options]\n"
+		<< "  --size N                 relation size (default 1000000)\n"
+		<< "  --shards N               shards of the index (default two per NUMA node, at least one per core)\n"
+		<< "  --buffers N              buffer pool size of every shard in pages (default 1000)\n"
+		<< "  --lookups N              point lookups per worker thread (default 200000)\n"
+		<< "  --placement P,P,...      placements to compare: none, local, interleaved (default local,interleaved)\n"
+		<< "  --seed N                 random seed (default 1)\n";
+}
+
+bool parseArgs(int argc, char **argv, NumaBenchConfig &config)
+{
+	config.relationName = "numabenchRel";
+	config.relationSize = 1000000;
+	config.shards = std::max(2 * NumaTopology::system().nodeCount(), (int)std::thread::hardware_concurrency());
+	config.bufferPages = 1000;
+	config.lookupsPerWorker = 200000;
+	config.placements.push_back(NUMA_LOCAL);
+	config.placements.push_back(NUMA_INTERLEAVED);
+	config.seed = 1;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(i + 1 >= argc)
+			return false;
+		const char *opt = argv[i];
+		const char *val = argv[++i];
+		if(strcmp(opt, "--size") == 0)
+			config.relationSize = atoi(val);
+		else if(strcmp(opt, "--shards") == 0)
+			config.shards = atoi(val);
+		else if(strcmp(opt, "--buffers") == 0)
+			config.bufferPages = atoi(val);
+		else if(strcmp(opt, "--lookups") == 0)
+			config.lookupsPerWorker = atoll(val);
+		else if(strcmp(opt, "--placement") == 0)
+		{
+			config.placements.clear();
+			std::istringstream in(val);
+			std::string name;
+			while(std::getline(in, name, ','))
+			{
+				NumaPlacement placement;
+				if(!parseNumaPlacement(name, placement))
+					return false;
+				config.placements.push_back(placement);
+			}
+		}
+		else if(strcmp(opt, "--seed") == 0)
+			config.seed = atoi(val);
+		else
+			return false;
+	}
+
+	return config.relationSize > 0 && config.shards > 0 && config.bufferPages > 0 && config.lookupsPerWorker > 0
+		&& !config.placements.empty();
+}
+
+// -----------------------------------------------------------------------------
+// runPlacement
+// -----------------------------------------------------------------------------
+
+// build a sharded index with the placement, then time lookups by one worker per shard, each placed like the
+// writer of its shard and reading only keys of that shard, and an ingest of new keys through the writers
+void runPlacement(const NumaBenchConfig &config, NumaPlacement placement)
+{
+	removeShards(config);
+	BTreeShardedIndex index(config.relationName, offsetof(GenRecord, i), INTEGER, config.shards, config.bufferPages,
+		BTreeIndexOptions(), placement);
+	int shards = index.shardCount();
+
+	// the keys of the relation, dealt to their shards
+	std::vector<std::vector<int> > shardKeys(shards);
+	for(int key = 0; key < config.relationSize; key++)
+	{
+		shardKeys[index.route(key)].push_back(key);
+	}
+
+	std::vector<long long> found(shards, 0);
+	std::vector<std::thread> workers;
+	Clock::time_point start = Clock::now();
+	for(int i = 0; i < shards; i++)
+	{
+		workers.push_back(std::thread([&config, &index, &shardKeys, &found, placement, i]()
+		{
+			NumaTopology::system().placeThread(i, placement);
+			const std::vector<int> &keys = shardKeys[i];
+			if(keys.empty())
+				return;
+			std::mt19937 rng(config.seed + 100 + i);
+			std::uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+			std::vector<RecordId> rids;
+			for(long long n = 0; n < config.lookupsPerWorker; n++)
+			{
+				found[i] += index.lookup(keys[pick(rng)], rids);
+			}
+		}));
+	}
+	for(size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	report(placement, shards, "lookup", config.lookupsPerWorker * shards, seconds);
+
+	// new keys past the relation, pointing at the record of the largest key present: keys are drawn with
+	// replacement, so any given key may be missing
+	std::vector<RecordId> rids;
+	for(int key = config.relationSize - 1; key >= 0 && index.lookup(key, rids) == 0; key--)
+	{
+	}
+	if(rids.empty())
+	{
+		std::cerr << "the index over " << config.relationName << " is empty" << std::endl;
+		exit(1);
+	}
+	std::vector<RIDKeyPair<int> > batch(config.relationSize);
+	for(int n = 0; n < config.relationSize; n++)
+	{
+		batch[n].set(rids[0], config.relationSize + n);
+	}
+	start = Clock::now();
+	index.insertBatch(batch);
+	index.drain();
+	seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	report(placement, shards, "ingest", config.relationSize, seconds);
+}
+
+void removeShards(const NumaBenchConfig &config)
+{
+	for(int i = 0; ; i++)
+	{
+		try
+		{
+			File::remove(config.relationName + "." + std::to_string(offsetof(GenRecord, i)) + ".s" + std::to_string(i));
+		}
+		catch(FileNotFoundException e)
+		{
+			return;
+		}
+	}
+}
+
+void report(NumaPlacement placement, int shards, const char *phase, long long ops, double seconds)
+{
+	std::cout << numaPlacementName(placement) << ',' << NumaTopology::system().nodeCount() << ',' << shards << ','
+		<< phase << ',' << ops << ',' << seconds << ',' << ops / seconds << std::endl;
+}
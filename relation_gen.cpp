@@ -0,0 +1,146 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "relation_gen.h"
+#include "page.h"
+#include "file.h"
+#include "exceptions/insufficient_space_exception.h"
+#include "exceptions/file_not_found_exception.h"
+
+namespace badgerdb
+{
+
+static const char *distributionNames[] = {"sequential", "reverse", "uniform", "zipfian", "clustered"};
+
+bool parseKeyDistribution(const std::string & name, KeyDistribution & dist)
+{
+	for(int i = 0; i <= CLUSTERED_KEYS; i++)
+	{
+		if(name == distributionNames[i])
+		{
+			dist = (KeyDistribution)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *keyDistributionName(KeyDistribution dist)
+{
+	return distributionNames[dist];
+}
+
+// -----------------------------------------------------------------------------
+// KeyGenerator
+// -----------------------------------------------------------------------------
+
+KeyGenerator::KeyGenerator(KeyDistribution distIn, int keySpaceIn, unsigned int seed, int clusterSizeIn, double zipfThetaIn)
+	: dist(distIn), keySpace(keySpaceIn > 0 ? keySpaceIn : 1), clusterSize(clusterSizeIn > 0 ? clusterSizeIn : 1),
+	  count(0), clusterKey(0), rng(seed), zipfTheta(zipfThetaIn), zipfZetaN(0), zipfAlpha(0), zipfEta(0)
+{
+	if(dist == ZIPFIAN_KEYS)
+	{
+		double zeta2 = 1.0 + std::pow(0.5, zipfTheta);
+		for(int i = 1; i <= keySpace; i++)
+		{
+			zipfZetaN += 1.0 / std::pow((double)i, zipfTheta);
+		}
+		zipfAlpha = 1.0 / (1.0 - zipfTheta);
+		zipfEta = (1.0 - std::pow(2.0 / keySpace, 1.0 - zipfTheta)) / (1.0 - zeta2 / zipfZetaN);
+	}
+}
+
+int KeyGenerator::uniform()
+{
+	return std::uniform_int_distribution<int>(0, keySpace - 1)(rng);
+}
+
+int KeyGenerator::next()
+{
+	long long n = count++;
+	switch(dist)
+	{
+		case SEQUENTIAL_KEYS:
+			return n % keySpace;
+		case REVERSE_KEYS:
+			return keySpace - 1 - n % keySpace;
+		case UNIFORM_KEYS:
+			return uniform();
+		case ZIPFIAN_KEYS:
+		{
+			double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+			double uz = u * zipfZetaN;
+			if(uz < 1.0)
+				return 0;
+			if(uz < 1.0 + std::pow(0.5, zipfTheta))
+				return std::min(1, keySpace - 1);
+			int key = (int)(keySpace * std::pow(zipfEta * u - zipfEta + 1.0, zipfAlpha));
+			return std::min(key, keySpace - 1);
+		}
+		case CLUSTERED_KEYS:
+			//start a new run of duplicates every clusterSize keys
+			if(n % clusterSize == 0)
+				clusterKey = uniform();
+			return clusterKey;
+	}
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+// createRelation
+// -----------------------------------------------------------------------------
+
+void createRelation(const std::string & relationName, int size, KeyDistribution dist, unsigned int seed)
+{
+	// destroy any old copies of relation file
+	try
+	{
+		File::remove(relationName);
+	}
+	catch(FileNotFoundException e)
+	{
+	}
+
+	PageFile file = PageFile::create(relationName);
+	KeyGenerator keys(dist, size, seed);
+	GenRecord record;
+	// initialize all of record.s to keep purify happy
+	memset(&record, ' ', sizeof(record));
+	PageId new_page_number;
+	Page new_page = file.allocatePage(new_page_number);
+
+	for(int i = 0; i < size; i++)
+	{
+		int key = keys.next();
+		sprintf(record.s, "%05d string record", key);
+		record.i = key;
+		record.d = (double)key;
+		std::string new_data(reinterpret_cast<char*>(&record), sizeof(record));
+
+		while(1)
+		{
+			try
+			{
+				new_page.insertRecord(new_data);
+				break;
+			}
+			catch(InsufficientSpaceException e)
+			{
+				file.writePage(new_page_number, new_page);
+				new_page = file.allocatePage(new_page_number);
+			}
+		}
+	}
+
+	file.writePage(new_page_number, new_page);
+}
+
+}
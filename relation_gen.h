@@ -0,0 +1,134 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+namespace badgerdb
+{
+
+/**
+ * @brief Key distributions used to generate relations and request streams for benchmarks.
+ */
+enum KeyDistribution
+{
+    SEQUENTIAL_KEYS = 0,    /* 0, 1, 2, ... */
+    REVERSE_KEYS = 1,       /* size-1, size-2, ..., 0 */
+    UNIFORM_KEYS = 2,       /* Uniform random draws over the key space */
+    ZIPFIAN_KEYS = 3,       /* Zipfian draws, small keys are hot */
+    CLUSTERED_KEYS = 4      /* Random keys, each repeated in a run of duplicates */
+};
+
+/**
+ * @brief Layout of the tuples in generated relations. It is the same as the RECORD used by the tests
+ * in main.cpp so that an index on offsetof(GenRecord, i) can be built over it.
+ */
+struct GenRecord{
+    int i;
+    double d;
+    char s[64];
+};
+
+/**
+ * Parse a distribution name (sequential, reverse, uniform, zipfian, clustered).
+ * @param name     Name of the distribution
+ * @param dist     Return the distribution
+ * @return true if the name is known, false otherwise
+ */
+bool parseKeyDistribution(const std::string & name, KeyDistribution & dist);
+
+/**
+ * Return the name of a distribution, as accepted by parseKeyDistribution().
+ */
+const char *keyDistributionName(KeyDistribution dist);
+
+/**
+ * @brief Generates a stream of integer keys over [0, keySpace) following a KeyDistribution.
+*/
+class KeyGenerator {
+
+ private:
+
+  /**
+   * Distribution of the generated keys.
+   */
+    KeyDistribution dist;
+
+  /**
+   * Number of distinct keys that can be generated.
+   */
+    int keySpace;
+
+  /**
+   * Number of copies of each key for CLUSTERED_KEYS.
+   */
+    int clusterSize;
+
+  /**
+   * Number of keys generated so far.
+   */
+    long long count;
+
+  /**
+   * Key of the current run of duplicates for CLUSTERED_KEYS.
+   */
+    int clusterKey;
+
+  /**
+   * Random number generator.
+   */
+    std::mt19937 rng;
+
+  /**
+   * Constants of the Zipfian generator (Gray et al., "Quickly generating billion-record synthetic databases").
+   */
+    double zipfTheta;
+    double zipfZetaN;
+    double zipfAlpha;
+    double zipfEta;
+
+ public:
+
+  /**
+   * KeyGenerator Constructor.
+   *
+   * @param dist          Distribution of the keys
+   * @param keySpace      Keys are generated in [0, keySpace)
+   * @param seed          Seed of the random number generator
+   * @param clusterSize   Length of the runs of duplicate keys for CLUSTERED_KEYS
+   * @param zipfTheta     Skew of ZIPFIAN_KEYS, in (0, 1)
+   */
+    KeyGenerator(KeyDistribution dist, int keySpace, unsigned int seed, int clusterSize = 8, double zipfTheta = 0.99);
+
+  /**
+   * Return the next key of the stream.
+   */
+    int next();
+
+  /**
+   * Return a key drawn uniformly from [0, keySpace), whatever the distribution.
+   */
+    int uniform();
+};
+
+/**
+ * Create a relation file with size tuples whose integer attribute follows the given distribution.
+ * Any old copy of the relation is removed first. The file is closed when the function returns.
+ *
+ * @param relationName  Name of the relation file
+ * @param size          Number of tuples
+ * @param dist          Distribution of the integer attribute
+ * @param seed          Seed of the random number generator
+ */
+void createRelation(const std::string & relationName, int size, KeyDistribution dist, unsigned int seed);
+
+}
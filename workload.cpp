@@ -0,0 +1,357 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "btree.h"
+#include "relation_gen.h"
+#include "exceptions/file_not_found_exception.h"
+#include "exceptions/no_such_key_found_exception.h"
+#include "exceptions/index_scan_completed_exception.h"
+
+using namespace badgerdb;
+
+// -----------------------------------------------------------------------------
+// Workload description
+// -----------------------------------------------------------------------------
+
+/**
+ * Operation types of the mix. An update inserts a new entry for an existing key,
+ * as BTreeIndex has no in-place update.
+ */
+enum OpType
+{
+	OP_READ = 0,
+	OP_UPDATE = 1,
+	OP_INSERT = 2,
+	OP_SCAN = 3,
+	OP_TYPES = 4
+};
+
+static const char *opNames[OP_TYPES] = {"read", "update", "insert", "scan"};
+
+struct WorkloadConfig {
+	std::string relationName;
+	int relationSize;
+	int bufferPages;
+	double ratio[OP_TYPES];
+	bool readBeforeUpdate;
+	KeyDistribution dist;
+	int minScanLength;
+	int maxScanLength;
+	int threads;
+	long long opsPerThread;
+	int intervalMs;
+	unsigned int seed;
+};
+
+struct WorkerStats {
+	std::vector<double> latencies[OP_TYPES]; // microseconds
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// -----------------------------------------------------------------------------
+// Shared state of a run
+// -----------------------------------------------------------------------------
+
+// BTreeIndex and BufMgr are not thread safe and support one scan at a time,
+// so every operation runs under this latch
+std::mutex indexLatch;
+std::atomic<long long> completedOps(0);
+std::atomic<int> nextInsertKey(0);
+std::atomic<bool> workersDone(false);
+
+// -----------------------------------------------------------------------------
+// Forward declarations
+// -----------------------------------------------------------------------------
+
+void usage();
+bool setMix(const char *name, WorkloadConfig &config);
+bool parseArgs(int argc, char **argv, WorkloadConfig &config);
+void worker(BTreeIndex *index, const WorkloadConfig &config, int id, WorkerStats &stats);
+long long rangeScan(BTreeIndex *index, int lowVal, int maxResults);
+void reportLatencies(const std::vector<WorkerStats> &stats);
+
+int main(int argc, char **argv)
+{
+	WorkloadConfig config;
+	if(!parseArgs(argc, argv, config))
+	{
+		usage();
+		return 1;
+	}
+
+	createRelation(config.relationName, config.relationSize, UNIFORM_KEYS, config.seed);
+	BufMgr *bufMgr = new BufMgr(config.bufferPages);
+	std::string indexName;
+	BTreeIndex *index = new BTreeIndex(config.relationName, indexName, bufMgr, offsetof(GenRecord, i), INTEGER);
+	nextInsertKey = config.relationSize;
+
+	// run the workers while sampling throughput every interval
+	std::vector<WorkerStats> stats(config.threads);
+	std::vector<std::thread> workers;
+	Clock::time_point start = Clock::now();
+	for(int i = 0; i < config.threads; i++)
+	{
+		workers.push_back(std::thread(worker, index, std::cref(config), i, std::ref(stats[i])));
+	}
+	std::thread sampler([&config, start]()
+	{
+		std::cout << "time_s,ops,ops_per_sec" << std::endl;
+		long long lastOps = 0;
+		Clock::time_point last = start;
+		while(!workersDone)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(config.intervalMs));
+			Clock::time_point now = Clock::now();
+			long long ops = completedOps;
+			double elapsed = std::chrono::duration<double>(now - last).count();
+			std::cout << std::chrono::duration<double>(now - start).count() << ',' << ops - lastOps << ','
+				<< (ops - lastOps) / elapsed << std::endl;
+			lastOps = ops;
+			last = now;
+		}
+	});
+	for(size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	workersDone = true;
+	sampler.join();
+
+	std::cout << "total ops: " << completedOps << ", seconds: " << seconds << ", ops/sec: " << completedOps / seconds << std::endl;
+	reportLatencies(stats);
+
+	delete index;
+	File::remove(indexName);
+	delete bufMgr;
+	File::remove(config.relationName);
+	return 0;
+}
+
+void usage()
+{
+	std::cerr << "usage: badgerdb_workload [options]\n"
+		<< "  --workload A|B|C|D|E|F   YCSB style mix (default A)\n"
+		<< "  --mix R,U,I,S            read/update/insert/scan ratios, overrides --workload\n"
+		<< "  --dist D                 request key distribution: uniform, zipfian, sequential (default zipfian)\n"
+		<< "  --size N                 relation size (default 100000)\n"
+		<< "  --buffers N              buffer pool size in pages (default 1000)\n"
+		<< "  --scan-length MIN,MAX    entries per scan (default 1,100)\n"
+		<< "  --threads N              worker threads (default 1)\n"
+		<< "  --ops N                  operations per thread (default 100000)\n"
+		<< "  --interval MS            throughput sampling interval (default 1000)\n"
+		<< "  --seed N                 random seed (default 1)\n";
+}
+
+bool setMix(const char *name, WorkloadConfig &config)
+{
+	// read, update, insert, scan
+	static const double mixes[6][OP_TYPES] = {
+		{0.50, 0.50, 0.00, 0.00},   // A: update heavy
+		{0.95, 0.05, 0.00, 0.00},   // B: read mostly
+		{1.00, 0.00, 0.00, 0.00},   // C: read only
+		{0.95, 0.00, 0.05, 0.00},   // D: read latest
+		{0.00, 0.00, 0.05, 0.95},   // E: short ranges
+		{0.50, 0.50, 0.00, 0.00}    // F: read-modify-write, the update follows a read of the same key
+	};
+	if(strlen(name) != 1 || name[0] < 'A' || name[0] > 'F')
+		return false;
+	memcpy(config.ratio, mixes[name[0] - 'A'], sizeof(config.ratio));
+	config.readBeforeUpdate = name[0] == 'F';
+	return true;
+}
+
+bool parseArgs(int argc, char **argv, WorkloadConfig &config)
+{
+	config.relationName = "workloadRel";
+	config.relationSize = 100000;
+	config.bufferPages = 1000;
+	setMix("A", config);
+	config.dist = ZIPFIAN_KEYS;
+	config.minScanLength = 1;
+	config.maxScanLength = 100;
+	config.threads = 1;
+	config.opsPerThread = 100000;
+	config.intervalMs = 1000;
+	config.seed = 1;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(i + 1 >= argc)
+			return false;
+		const char *opt = argv[i];
+		const char *val = argv[++i];
+		if(strcmp(opt, "--workload") == 0)
+		{
+			if(!setMix(val, config))
+				return false;
+		}
+		else if(strcmp(opt, "--mix") == 0)
+		{
+			if(sscanf(val, "%lf,%lf,%lf,%lf", &config.ratio[OP_READ], &config.ratio[OP_UPDATE],
+					&config.ratio[OP_INSERT], &config.ratio[OP_SCAN]) != OP_TYPES)
+				return false;
+			config.readBeforeUpdate = false;
+		}
+		else if(strcmp(opt, "--dist") == 0)
+		{
+			if(!parseKeyDistribution(val, config.dist))
+				return false;
+		}
+		else if(strcmp(opt, "--size") == 0)
+			config.relationSize = atoi(val);
+		else if(strcmp(opt, "--buffers") == 0)
+			config.bufferPages = atoi(val);
+		else if(strcmp(opt, "--scan-length") == 0)
+		{
+			if(sscanf(val, "%d,%d", &config.minScanLength, &config.maxScanLength) != 2)
+				return false;
+		}
+		else if(strcmp(opt, "--threads") == 0)
+			config.threads = atoi(val);
+		else if(strcmp(opt, "--ops") == 0)
+			config.opsPerThread = atoll(val);
+		else if(strcmp(opt, "--interval") == 0)
+			config.intervalMs = atoi(val);
+		else if(strcmp(opt, "--seed") == 0)
+			config.seed = atoi(val);
+		else
+			return false;
+	}
+
+	double total = 0;
+	for(int i = 0; i < OP_TYPES; i++)
+		total += config.ratio[i];
+	return total > 0 && config.relationSize > 0 && config.bufferPages > 0 && config.threads > 0
+		&& config.minScanLength > 0 && config.maxScanLength >= config.minScanLength && config.intervalMs > 0;
+}
+
+// -----------------------------------------------------------------------------
+// worker
+// -----------------------------------------------------------------------------
+
+void worker(BTreeIndex *index, const WorkloadConfig &config, int id, WorkerStats &stats)
+{
+	std::mt19937 rng(config.seed + 100 + id);
+	std::uniform_real_distribution<double> pick(0.0, 1.0);
+	std::uniform_int_distribution<int> scanLength(config.minScanLength, config.maxScanLength);
+	KeyGenerator keys(config.dist, config.relationSize, config.seed + 200 + id);
+	double total = 0;
+	for(int i = 0; i < OP_TYPES; i++)
+		total += config.ratio[i];
+
+	for(long long n = 0; n < config.opsPerThread; n++)
+	{
+		// choose the operation
+		double p = pick(rng) * total;
+		int op = 0;
+		while(op < OP_TYPES - 1 && p >= config.ratio[op])
+		{
+			p -= config.ratio[op];
+			op++;
+		}
+
+		int key = keys.next();
+		RecordId rid;
+		rid.page_number = 1 + id;
+		rid.slot_number = 1 + n % 1000;
+		Clock::time_point start = Clock::now();
+		{
+			std::lock_guard<std::mutex> guard(indexLatch);
+			switch(op)
+			{
+				case OP_READ:
+					rangeScan(index, key, 1);
+					break;
+				case OP_UPDATE:
+					if(config.readBeforeUpdate)
+						rangeScan(index, key, 1);
+					index->insertEntry(&key, rid);
+					break;
+				case OP_INSERT:
+					key = nextInsertKey++;
+					index->insertEntry(&key, rid);
+					break;
+				case OP_SCAN:
+					rangeScan(index, key, scanLength(rng));
+					break;
+			}
+		}
+		stats.latencies[op].push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+		completedOps++;
+	}
+}
+
+// scan from lowVal on and return the number of entries found, at most maxResults
+long long rangeScan(BTreeIndex *index, int lowVal, int maxResults)
+{
+	int highVal = maxResults == 1 ? lowVal : 0x7fffffff;
+	long long found = 0;
+	try
+	{
+		index->startScan(&lowVal, GTE, &highVal, LTE);
+	}
+	catch(NoSuchKeyFoundException e)
+	{
+		return 0;
+	}
+	try
+	{
+		RecordId rid;
+		while(found < maxResults)
+		{
+			index->scanNext(rid);
+			found++;
+		}
+	}
+	catch(IndexScanCompletedException e)
+	{
+	}
+	index->endScan();
+	return found;
+}
+
+// -----------------------------------------------------------------------------
+// reportLatencies
+// -----------------------------------------------------------------------------
+
+void reportLatencies(const std::vector<WorkerStats> &stats)
+{
+	static const double percentiles[] = {50, 95, 99, 99.9};
+	std::cout << "op,count,mean_us,p50_us,p95_us,p99_us,p99.9_us,max_us" << std::endl;
+	for(int op = 0; op < OP_TYPES; op++)
+	{
+		std::vector<double> all;
+		for(size_t i = 0; i < stats.size(); i++)
+			all.insert(all.end(), stats[i].latencies[op].begin(), stats[i].latencies[op].end());
+		if(all.empty())
+			continue;
+		std::sort(all.begin(), all.end());
+		double sum = 0;
+		for(size_t i = 0; i < all.size(); i++)
+			sum += all[i];
+		std::cout << opNames[op] << ',' << all.size() << ',' << sum / all.size();
+		for(int p = 0; p < 4; p++)
+		{
+			size_t idx = std::min(all.size() - 1, (size_t)(all.size() * percentiles[p] / 100));
+			std::cout << ',' << all[idx];
+		}
+		std::cout << ',' << all.back() << std::endl;
+	}
+}